@@ -0,0 +1,137 @@
+// Parse throughput of a large tree object: the char-by-char loop ls-tree and
+// extractTree used before TreeView (tree_view.h), against TreeView with and
+// without formatting each id as hex. The tree is synthetic and lives in
+// memory, so only parsing is measured.
+//
+//     bench_tree_parse [--entries <n>] [--runs <n>]
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include "tree_view.h"
+using namespace std;
+
+// "tree <size>\0" followed by <entries> entries, one in eight a subtree
+static string makeTree(size_t entries) {
+    string body;
+    unsigned char id[20];
+    for (size_t i = 0; i < entries; ++i) {
+        body += i % 8 == 0 ? "40000 dir_" : "100644 file_";
+        body += to_string(i);
+        body += i % 8 == 0 ? "" : ".cpp";
+        body.push_back('\0');
+        for (size_t b = 0; b < sizeof(id); ++b) {
+            id[b] = static_cast<unsigned char>((i >> (b % 4 * 8)) * 31 + b);
+        }
+        body.append(reinterpret_cast<const char*>(id), sizeof(id));
+    }
+    return "tree " + to_string(body.size()) + '\0' + body;
+}
+
+// The hex formatting utils.cpp used before TreeView
+static string oldHex(const unsigned char* data, size_t length) {
+    ostringstream result;
+    for (size_t i = 0; i < length; ++i) {
+        result << hex << setw(2) << setfill('0') << (int)data[i];
+    }
+    return result.str();
+}
+
+// The old loop: copy the body to strip the header, then build the mode, the
+// name and the hex id one character at a time
+static size_t parseOld(const string& object) {
+    string treeContent = object;
+    size_t nullPos = treeContent.find('\0');
+    if (nullPos != string::npos) {
+        treeContent = treeContent.substr(nullPos + 1);
+    }
+
+    size_t checksum = 0;
+    size_t i = 0;
+    while (i < treeContent.size()) {
+        string mode;
+        while (treeContent[i] != ' ') {
+            mode += treeContent[i];
+            i++;
+        }
+        if (mode[0] == '4') mode = '0' + mode;
+        i++;
+
+        string filename;
+        while (treeContent[i] != '\0') {
+            filename += treeContent[i];
+            i++;
+        }
+        i++;
+
+        string sha1 = oldHex(reinterpret_cast<const unsigned char*>(&treeContent[i]), 20);
+        i += 20;
+        checksum += stoul(mode, nullptr, 8) + filename.size() + sha1[39];
+    }
+    return checksum;
+}
+
+static size_t parseViewHex(const string& object) {
+    size_t checksum = 0;
+    for (const TreeEntry& entry : TreeView::fromObject(object)) {
+        checksum += entry.mode + entry.name.size() + entry.id.hex()[39];
+    }
+    return checksum;
+}
+
+static size_t parseViewRaw(const string& object) {
+    size_t checksum = 0;
+    for (const TreeEntry& entry : TreeView::fromObject(object)) {
+        checksum += entry.mode + entry.name.size() + entry.id.bytes[19];
+    }
+    return checksum;
+}
+
+int main(int argc, char* argv[]) {
+    size_t entries = 500000;
+    size_t runs = 5;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            entries = stoul(argv[++i]);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = max<size_t>(stoul(argv[++i]), 1);
+        } else {
+            cerr << "Usage: bench_tree_parse [--entries <n>] [--runs <n>]\n";
+            return 1;
+        }
+    }
+
+    string tree = makeTree(entries);
+    double megabytes = tree.size() / 1e6;
+    printf("%zu entries, %.1f MB, best of %zu\n\n", entries, megabytes, runs);
+
+    auto measure = [&](const char* name, const function<size_t(const string&)>& parse) {
+        double best = 0;
+        size_t checksum = 0;
+        for (size_t i = 0; i < runs; ++i) {
+            auto start = chrono::steady_clock::now();
+            checksum = parse(tree);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            best = i == 0 ? ms : min(best, ms);
+        }
+        printf("  %-22s %7.0f ms %6.0f MB/s\n", name, best, megabytes / (best / 1000));
+        return checksum;
+    };
+
+    try {
+        size_t old = measure("old char-by-char loop", parseOld);
+        if (measure("TreeView + hex ids", parseViewHex) != old) {
+            throw runtime_error("TreeView and the old loop parsed the tree differently");
+        }
+        measure("TreeView, raw ids", parseViewRaw);
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <zlib.h>
+#include "headers.h"
+#include "tree_view.h"
+using namespace std;
+
+// archive streams a tree as a tar file (the ustar layout git archive writes,
+// with its default tar.umask of 0002) straight from the object store. The
+// walk lists the entries first; blobs are then inflated on worker threads a
+// bounded window ahead of the writer, which emits them strictly in tree order.
+
+namespace {
+
+const size_t TAR_BLOCK = 512;
+const size_t TAR_RECORD = 10240;             // output is padded to whole records, like tar and git
+const size_t ARCHIVE_WINDOW = 16;            // blobs inflated ahead of the writer
+const size_t ARCHIVE_WINDOW_BYTES = 64 << 20;
+const size_t ARCHIVE_OUTPUT_BUFFER = 1 << 16;
+const unsigned int TAR_UMASK = 0002;
+
+struct TarHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+static_assert(sizeof(TarHeader) == TAR_BLOCK);
+
+// Buffered output, gzip-compressed on the way out when asked
+class ArchiveOutput {
+public:
+    ArchiveOutput(ostream& out, bool gzip) : out_(out), gzip_(gzip) {
+        if (gzip_) {
+            memset(&zs_, 0, sizeof(zs_));
+            // windowBits 15 + 16: a gzip wrapper with no name and a zero mtime
+            if (deflateInit2(&zs_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw runtime_error("deflateInit2 failed");
+            }
+        }
+    }
+    ~ArchiveOutput() {
+        if (gzip_) {
+            deflateEnd(&zs_);
+        }
+    }
+
+    void write(const char* data, size_t size) {
+        written_ += size;
+        if (buffer_.size() + size > ARCHIVE_OUTPUT_BUFFER) {
+            flushBuffer(false);
+        }
+        if (size >= ARCHIVE_OUTPUT_BUFFER) {
+            emit(data, size, false);
+        } else {
+            buffer_.append(data, size);
+        }
+    }
+
+    void pad() {
+        static const char zeros[TAR_BLOCK] = {};
+        write(zeros, (TAR_BLOCK - written_ % TAR_BLOCK) % TAR_BLOCK);
+    }
+
+    // Two zero blocks end the archive; the record it ends in is zero-filled
+    void finish() {
+        static const char zeros[TAR_BLOCK] = {};
+        write(zeros, TAR_BLOCK);
+        write(zeros, TAR_BLOCK);
+        while (written_ % TAR_RECORD) {
+            write(zeros, TAR_BLOCK);
+        }
+        flushBuffer(true);
+        out_.flush();
+        if (!out_) {
+            throw runtime_error("Could not write the archive");
+        }
+    }
+
+private:
+    void flushBuffer(bool finish) {
+        emit(buffer_.data(), buffer_.size(), finish);
+        buffer_.clear();
+    }
+
+    void emit(const char* data, size_t size, bool finish) {
+        if (!gzip_) {
+            out_.write(data, size);
+            return;
+        }
+        char compressed[ARCHIVE_OUTPUT_BUFFER];
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs_.avail_in = static_cast<uInt>(size);
+        int ret;
+        do {
+            zs_.next_out = reinterpret_cast<Bytef*>(compressed);
+            zs_.avail_out = sizeof(compressed);
+            ret = deflate(&zs_, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                throw runtime_error("deflate failed");
+            }
+            out_.write(compressed, sizeof(compressed) - zs_.avail_out);
+        } while (zs_.avail_out == 0 || (finish && ret != Z_STREAM_END));
+    }
+
+    ostream& out_;
+    bool gzip_;
+    z_stream zs_;
+    string buffer_;
+    uint64_t written_ = 0;
+};
+
+// Inflates blobs on worker threads at most ARCHIVE_WINDOW (and, past the next
+// one, ARCHIVE_WINDOW_BYTES) ahead of take(), which hands them out in order
+class BlobPipeline {
+public:
+    BlobPipeline(const vector<string>& shas, const string& git_dir) : shas_(shas), git_dir_(git_dir) {
+        size_t threads = clamp<size_t>(thread::hardware_concurrency(), 2, 8);
+        for (size_t i = 0; i < min(threads, shas_.size()); ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+    ~BlobPipeline() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        changed_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    // The next blob's object, with its header
+    string take() {
+        unique_lock<mutex> lock(mutex_);
+        Slot& slot = slots_[taken_ % ARCHIVE_WINDOW];
+        changed_.wait(lock, [&] { return slot.ready; });
+        if (slot.error) {
+            rethrow_exception(slot.error);
+        }
+        string object = std::move(slot.object);
+        slot = Slot();
+        inFlightBytes_ -= object.size();
+        ++taken_;
+        changed_.notify_all();
+        return object;
+    }
+
+private:
+    struct Slot {
+        string object;
+        exception_ptr error;
+        bool ready = false;
+    };
+
+    void work() {
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            changed_.wait(lock, [&] {
+                return stopped_ || next_ >= shas_.size() ||
+                       (next_ < taken_ + ARCHIVE_WINDOW && (next_ == taken_ || inFlightBytes_ < ARCHIVE_WINDOW_BYTES));
+            });
+            if (stopped_ || next_ >= shas_.size()) {
+                return;
+            }
+            size_t index = next_++;
+            lock.unlock();
+            Slot loaded;
+            try {
+                loaded.object = readObject(shas_[index], git_dir_);
+            } catch (...) {
+                loaded.error = current_exception();
+            }
+            loaded.ready = true;
+            lock.lock();
+            inFlightBytes_ += loaded.object.size();
+            slots_[index % ARCHIVE_WINDOW] = std::move(loaded);
+            changed_.notify_all();
+        }
+    }
+
+    const vector<string>& shas_;
+    string git_dir_;
+    vector<thread> workers_;
+    mutex mutex_;
+    condition_variable changed_;
+    Slot slots_[ARCHIVE_WINDOW];
+    size_t next_ = 0;
+    size_t taken_ = 0;
+    size_t inFlightBytes_ = 0;
+    bool stopped_ = false;
+};
+
+template <size_t N>
+void octal(char (&field)[N], uint64_t value) {
+    snprintf(field, N, "%0*llo", static_cast<int>(N - 1), static_cast<unsigned long long>(value));
+}
+
+// "<length> <key>=<value>\n", where length counts its own digits
+string paxRecord(const string& key, string_view value) {
+    size_t length = key.size() + value.size() + 3;
+    size_t digits = to_string(length).size();
+    if (to_string(length + digits).size() > digits) {
+        ++digits;
+    }
+    return to_string(length + digits) + " " + key + "=" + string(value) + "\n";
+}
+
+class TarWriter {
+public:
+    TarWriter(ArchiveOutput& out, uint64_t mtime) : out_(out), mtime_(mtime) {}
+
+    // A pax global header naming the commit, as git archive writes
+    void comment(const string& commitSHA) {
+        writeExtended('g', "pax_global_header", paxRecord("comment", commitSHA));
+    }
+
+    void entry(const string& path, unsigned int mode, char typeflag, uint64_t size, string_view linkname,
+               const string& sha) {
+        TarHeader header;
+        memset(&header, 0, sizeof(header));
+        string extended;
+        if (!fitsName(path, header)) {
+            extended += paxRecord("path", path);
+            snprintf(header.name, sizeof(header.name), "%s.data", sha.c_str());
+        }
+        if (linkname.size() > sizeof(header.linkname)) {
+            extended += paxRecord("linkpath", linkname);
+            snprintf(header.linkname, sizeof(header.linkname), "see %s.paxheader", sha.c_str());
+        } else {
+            memcpy(header.linkname, linkname.data(), linkname.size());
+        }
+        if (!extended.empty()) {
+            writeExtended('x', sha + ".paxheader", extended);
+        }
+        finishHeader(header, mode, typeflag, size);
+    }
+
+    void content(const char* data, size_t size) { out_.write(data, size); }
+    void endContent() { out_.pad(); }
+
+private:
+    // ustar splits a long path into prefix and name at the last slash that
+    // fits the prefix, as git does
+    static bool fitsName(const string& path, TarHeader& header) {
+        if (path.size() <= sizeof(header.name)) {
+            memcpy(header.name, path.data(), path.size());
+            return true;
+        }
+        size_t slash = path.size() - (path.back() == '/' ? 1 : 0);
+        slash = min(slash, sizeof(header.prefix));
+        do {
+            --slash;
+        } while (slash > 0 && path[slash] != '/');
+        size_t rest = path.size() - slash - 1;
+        if (slash == 0 || rest > sizeof(header.name)) {
+            return false;
+        }
+        memcpy(header.prefix, path.data(), slash);
+        memcpy(header.name, path.data() + slash + 1, rest);
+        return true;
+    }
+
+    void writeExtended(char typeflag, const string& name, const string& records) {
+        TarHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.name, name.data(), min(name.size(), sizeof(header.name)));
+        finishHeader(header, 0666, typeflag, records.size());
+        content(records.data(), records.size());
+        endContent();
+    }
+
+    void finishHeader(TarHeader& header, unsigned int mode, char typeflag, uint64_t size) {
+        octal(header.mode, mode & 07777);
+        octal(header.uid, 0);
+        octal(header.gid, 0);
+        octal(header.size, size);
+        octal(header.mtime, mtime_);
+        header.typeflag = typeflag;
+        memcpy(header.magic, "ustar", 6);
+        memcpy(header.version, "00", 2);
+        strcpy(header.uname, "root");
+        strcpy(header.gname, "root");
+        octal(header.devmajor, 0);
+        octal(header.devminor, 0);
+        // The checksum is taken with its own field filled with spaces
+        memset(header.chksum, ' ', sizeof(header.chksum));
+        unsigned int sum = 0;
+        for (unsigned char byte : string_view(reinterpret_cast<const char*>(&header), sizeof(header))) {
+            sum += byte;
+        }
+        snprintf(header.chksum, sizeof(header.chksum), "%07o", sum);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    ArchiveOutput& out_;
+    uint64_t mtime_;
+};
+
+} // namespace
+
+void writeArchive(const string& treeSHA, const string& commitSHA, int64_t mtime, ostream& out, bool gzip,
+                  const string& git_dir) {
+    vector<mygit::TreeItem> items;
+    TreeWalkOptions options;
+    options.recursive = true;
+    options.showTrees = true;
+    options.threads = 4;
+    walkTree(treeSHA, [&](const string& sha) { return make_shared<const string>(readObject(sha, git_dir)); },
+             options, [&](const mygit::TreeItem& item) { items.push_back(item); });
+
+    vector<string> blobs;
+    for (const auto& item : items) {
+        if (item.type == "blob") {
+            blobs.push_back(item.sha);
+        }
+    }
+
+    ArchiveOutput output(out, gzip);
+    TarWriter tar(output, static_cast<uint64_t>(max<int64_t>(mtime, 0)));
+    if (!commitSHA.empty()) {
+        tar.comment(commitSHA);
+    }
+    BlobPipeline pipeline(blobs, git_dir);
+    for (const auto& item : items) {
+        if (item.type != "blob") {
+            // Trees, and submodules as the empty directories git leaves for them
+            tar.entry(item.name + "/", (item.mode | 0777) & ~TAR_UMASK, '5', 0, "", item.sha);
+            continue;
+        }
+        string object = pipeline.take();
+        string_view body = string_view(object).substr(object.find('\0') + 1);
+        if ((item.mode & FILE_MODE_MASK) == SYMLINK_MODE) {
+            tar.entry(item.name, 0777, '2', 0, body, item.sha);
+            continue;
+        }
+        unsigned int mode = (item.mode | ((item.mode & 0100) ? 0777 : 0666)) & ~TAR_UMASK;
+        if (!object.starts_with("chunked ")) {
+            tar.entry(item.name, mode, '0', body.size(), "", item.sha);
+            tar.content(body.data(), body.size());
+            tar.endContent();
+            continue;
+        }
+        // Large files are streamed a chunk at a time
+        vector<pair<string, size_t>> chunks = chunkListing(body);
+        uint64_t size = 0;
+        for (const auto& chunk : chunks) {
+            size += chunk.second;
+        }
+        tar.entry(item.name, mode, '0', size, "", item.sha);
+        for (const auto& [chunkSha, length] : chunks) {
+            string chunk = readObject(chunkSha, git_dir);
+            string_view data = string_view(chunk).substr(chunk.find('\0') + 1);
+            if (data.size() != length) {
+                throw runtime_error("Chunk " + chunkSha + " has the wrong size.");
+            }
+            tar.content(data.data(), data.size());
+        }
+        tar.endContent();
+    }
+    output.finish();
+}
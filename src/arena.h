@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory_resource>
+#include <string_view>
+#include <cstring>
+#include <cstddef>
+
+// Bump allocator for what one command builds and throws away: worktree
+// paths, tree entries, index entries. Allocating is a pointer increment in
+// blocks that double in size, and everything is released at once when the
+// arena goes out of scope. Containers take it as their memory resource
+// (std::pmr::vector<T> v(&arena)); strings are copied in with copy() and
+// handed around as string_views.
+class Arena : public std::pmr::monotonic_buffer_resource {
+public:
+    static constexpr size_t INITIAL_BLOCK = 64 * 1024;
+
+    Arena() : std::pmr::monotonic_buffer_resource(INITIAL_BLOCK) {}
+
+    std::string_view copy(std::string_view text) { return join(text, {}); }
+
+    // a followed by b, as one string in the arena
+    std::string_view join(std::string_view a, std::string_view b) {
+        if (a.size() + b.size() == 0) {
+            return {};
+        }
+        char* out = static_cast<char*>(allocate(a.size() + b.size(), 1));
+        memcpy(out, a.data(), a.size());
+        memcpy(out + a.size(), b.data(), b.size());
+        return std::string_view(out, a.size() + b.size());
+    }
+};
+
+#endif // ARENA_H
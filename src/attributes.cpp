@@ -0,0 +1,172 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+#include <fnmatch.h>
+#include <zlib.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+struct AttributeRule {
+    string pattern;
+    bool matchBasename;          // pattern has no '/', so it matches any directory
+    map<string, string> values;  // attribute -> "set", "unset" or a value
+};
+
+static vector<AttributeRule> parseAttributes(const string& path) {
+    vector<AttributeRule> rules;
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        istringstream fields(line);
+        AttributeRule rule;
+        if (!(fields >> rule.pattern) || rule.pattern[0] == '#') {
+            continue;
+        }
+        if (rule.pattern[0] == '/') {
+            rule.pattern.erase(0, 1);
+            rule.matchBasename = false;
+        } else {
+            rule.matchBasename = rule.pattern.find('/') == string::npos;
+        }
+
+        string attribute;
+        while (fields >> attribute) {
+            size_t equals = attribute.find('=');
+            if (equals != string::npos) {
+                rule.values[attribute.substr(0, equals)] = attribute.substr(equals + 1);
+            } else if (attribute[0] == '-') {
+                rule.values[attribute.substr(1)] = "unset";
+            } else {
+                rule.values[attribute] = "set";
+            }
+        }
+        rules.push_back(rule);
+    }
+    return rules;
+}
+
+// Value of attribute for a worktree-relative path from <root>/.gitattributes:
+// "set", "unset", an explicit value, or "" when no line mentions it. Like git,
+// the last matching line wins.
+string getAttribute(const fs::path& root, const string& relativePath, const string& attribute) {
+    static mutex cacheMutex;
+    static map<string, pair<fs::file_time_type, vector<AttributeRule>>> cache;
+    string path = (root / ".gitattributes").string();
+    error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    if (ec) {
+        return "";
+    }
+
+    lock_guard<mutex> lock(cacheMutex);
+    auto cached = cache.find(path);
+    if (cached == cache.end() || cached->second.first != modified) {
+        cached = cache.insert_or_assign(path, make_pair(modified, parseAttributes(path))).first;
+    }
+
+    string basename = fs::path(relativePath).filename().string();
+    const auto& rules = cached->second.second;
+    for (auto rule = rules.rbegin(); rule != rules.rend(); ++rule) {
+        auto value = rule->values.find(attribute);
+        if (value == rule->values.end()) {
+            continue;
+        }
+        const string& subject = rule->matchBasename ? basename : relativePath;
+        if (fnmatch(rule->pattern.c_str(), subject.c_str(), rule->matchBasename ? 0 : FNM_PATHNAME) == 0) {
+            return value->second;
+        }
+    }
+    return "";
+}
+
+// Formats that are already compressed, recognised by their leading bytes
+static bool hasCompressedMagic(string_view data) {
+    static const string_view prefixes[] = {
+        string_view("\xFF\xD8\xFF", 3),                 // JPEG
+        string_view("\x89PNG", 4),                      // PNG
+        string_view("GIF8", 4),                         // GIF
+        string_view("PK\x03\x04", 4),                   // zip, jar, docx, apk
+        string_view("\x1F\x8B", 2),                     // gzip
+        string_view("BZh", 3),                          // bzip2
+        string_view("\xFD" "7zXZ\x00", 6),              // xz
+        string_view("\x28\xB5\x2F\xFD", 4),             // zstd
+        string_view("7z\xBC\xAF\x27\x1C", 6),           // 7-zip
+        string_view("\x04\x22\x4D\x18", 4),             // lz4
+        string_view("Rar!", 4),                         // rar
+        string_view("OggS", 4),                         // ogg
+        string_view("wOF2", 4),                         // woff2
+        string_view("fLaC", 4),                         // flac
+    };
+    for (string_view prefix : prefixes) {
+        if (data.substr(0, prefix.size()) == prefix) {
+            return true;
+        }
+    }
+    // ISO media (mp4, mov, heic) and WebP keep their tag at an offset
+    return (data.size() >= 8 && data.substr(4, 4) == "ftyp") ||
+           (data.size() >= 12 && data.substr(0, 4) == "RIFF" && data.substr(8, 4) == "WEBP");
+}
+
+// Guess whether deflate would gain anything, looking at no more than 4 KiB:
+// known compressed formats, or a byte histogram of four spread-out samples
+// that is close to uniform.
+bool looksIncompressible(string_view data) {
+    const size_t MIN_SIZE = 512;
+    const size_t SAMPLE = 1024;
+    const double ENTROPY_LIMIT = 7.8;  // bits per byte; random 4 KiB samples score about 7.95
+
+    if (data.size() < MIN_SIZE) {
+        return false;
+    }
+    if (hasCompressedMagic(data)) {
+        return true;
+    }
+
+    uint32_t histogram[256] = {0};
+    size_t sampled = 0;
+    auto sample = [&](size_t offset) {
+        size_t length = min(SAMPLE, data.size() - offset);
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data() + offset);
+        for (size_t i = 0; i < length; ++i) {
+            histogram[bytes[i]]++;
+        }
+        sampled += length;
+    };
+    if (data.size() <= 4 * SAMPLE) {
+        sample(0);  // sample() stops at SAMPLE bytes, so cover the rest too
+        for (size_t offset = SAMPLE; offset < data.size(); offset += SAMPLE) sample(offset);
+    } else {
+        for (size_t i = 0; i < 4; ++i) {
+            sample(i * (data.size() - SAMPLE) / 3);
+        }
+    }
+
+    double entropy = 0;
+    for (uint32_t count : histogram) {
+        if (count) {
+            double p = static_cast<double>(count) / sampled;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy > ENTROPY_LIMIT;
+}
+
+// zlib level for a blob's content. The "compress" attribute forces the
+// choice for matching paths; otherwise incompressible data is written as
+// stored blocks (level 0), which every inflate reads like any other stream.
+int blobCompressionLevel(string_view content, const fs::path& root, const string& relativePath) {
+    if (!relativePath.empty()) {
+        string attribute = getAttribute(root, relativePath, "compress");
+        if (attribute == "set") return Z_DEFAULT_COMPRESSION;
+        if (attribute == "unset") return Z_NO_COMPRESSION;
+    }
+    return looksIncompressible(content) ? Z_NO_COMPRESSION : Z_DEFAULT_COMPRESSION;
+}
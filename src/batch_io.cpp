@@ -0,0 +1,391 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "headers.h"
+using namespace std;
+
+// Batched file I/O. Checkout and add touch thousands of small files, and one
+// blocking open/read/write/close sequence per file spends much of its time on
+// syscall overhead.
+//
+// The io_uring backend (raw syscalls, no liburing) queues each file as one
+// chain of linked operations and enters the kernel once per ring-full of
+// chains. Reads go through a fixed per-slot buffer; files that do not fit,
+// like short writes, are finished with plain syscalls.
+//
+// The thread-pool backend runs the same requests with plain syscalls spread
+// over worker threads. It is used wherever io_uring is missing, disabled or
+// too old to link operations on a file opened in the same chain (5.17).
+
+const unsigned URING_SLOTS = 128;               // chains in flight per submission
+const size_t URING_READ_BUFFER = 64 * 1024;     // per slot; larger files take the slow path
+
+IoBackend parseIoBackend(const string& name) {
+    if (name == "auto") return IoBackend::Auto;
+    if (name == "io_uring" || name == "uring") return IoBackend::Uring;
+    if (name == "threads") return IoBackend::Threads;
+    throw invalid_argument("Invalid core.ioBackend: " + name + " (expected auto, io_uring or threads)");
+}
+
+IoBackend ioBackend(const string& git_dir) {
+    return parseIoBackend(getConfigValue(git_dir, "core.ioBackend", "auto"));
+}
+
+namespace {
+
+// One request with plain syscalls
+void readOne(FileRead& read) {
+    read.error = 0;
+    read.data.clear();
+    int fd = open(read.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        read.error = errno;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        read.error = errno;
+    } else {
+        read.size = st.st_size;
+        if (read.size < read.maxSize) {
+            read.data.resize(read.size);
+            size_t done = 0;
+            while (done < read.data.size()) {
+                ssize_t n = pread(fd, read.data.data() + done, read.data.size() - done, done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    read.error = errno;
+                    break;
+                }
+                if (n == 0) {
+                    read.data.resize(done);  // shrank since fstat
+                    break;
+                }
+                done += n;
+            }
+        }
+    }
+    close(fd);
+}
+
+int createFlags(const FileWrite& write) {
+    return O_WRONLY | O_CREAT | O_CLOEXEC | (write.exclusive ? O_EXCL : O_TRUNC);
+}
+
+void writeOne(FileWrite& write) {
+    write.error = 0;
+    int fd = open(write.path.c_str(), createFlags(write), 0666);
+    if (fd < 0) {
+        write.error = errno;
+        return;
+    }
+    size_t done = 0;
+    while (done < write.data.size()) {
+        ssize_t n = pwrite(fd, write.data.data() + done, write.data.size() - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            write.error = errno;
+            break;
+        }
+        done += n;
+    }
+    if (close(fd) != 0 && !write.error) {
+        write.error = errno;
+    }
+}
+
+class Uring {
+public:
+    // nullptr when the kernel refuses io_uring or lacks what the chains need
+    static unique_ptr<Uring> create() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = syscall(__NR_io_uring_setup, URING_SLOTS * 3, &params);
+        if (fd < 0) {
+            return nullptr;
+        }
+        unique_ptr<Uring> ring(new Uring(fd));
+        if (!(params.features & IORING_FEAT_LINKED_FILE) || !ring->map(params) || !ring->supportsOperations() ||
+            !ring->registerSlots()) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    ~Uring() {
+        if (buffers_ != MAP_FAILED) munmap(buffers_, URING_SLOTS * URING_READ_BUFFER);
+        if (sqes_) munmap(sqes_, sqesSize_);
+        if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+        if (sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingSize_);
+        close(fd_);
+    }
+
+    char* buffer(unsigned slot) const { return static_cast<char*>(buffers_) + slot * URING_READ_BUFFER; }
+
+    // Queues count chains of steps operations each and waits for every
+    // completion. complete receives the chain, the step and the result
+    // (negative errno on failure).
+    void run(unsigned count, unsigned steps, const function<void(io_uring_sqe*, unsigned, unsigned)>& prepare,
+             const function<void(unsigned, unsigned, int)>& complete) {
+        unsigned tail = *sqTail_;
+        for (unsigned chain = 0; chain < count; ++chain) {
+            for (unsigned step = 0; step < steps; ++step) {
+                unsigned index = tail & *sqMask_;
+                io_uring_sqe* sqe = &sqes_[index];
+                memset(sqe, 0, sizeof(*sqe));
+                prepare(sqe, chain, step);
+                sqe->user_data = chain * steps + step;
+                sqArray_[index] = index;
+                ++tail;
+            }
+        }
+        __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+        unsigned unsubmitted = count * steps;
+        unsigned completed = 0;
+        while (completed < count * steps) {
+            int submitted = syscall(__NR_io_uring_enter, fd_, unsubmitted, count * steps - completed,
+                                    IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+            }
+            if (submitted > 0) {
+                unsubmitted -= submitted;
+            }
+            unsigned head = *cqHead_;
+            while (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+                complete(cqe.user_data / steps, cqe.user_data % steps, cqe.res);
+                ++head;
+                ++completed;
+            }
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        }
+    }
+
+private:
+    explicit Uring(int fd) : fd_(fd) {}
+
+    bool map(const io_uring_params& params) {
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqRingSize_ = cqRingSize_ = max(sqRingSize_, cqRingSize_);
+        }
+        sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sqRing_ == MAP_FAILED) return false;
+        cqRing_ = single ? sqRing_
+                         : mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) return false;
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+        buffers_ = mmap(nullptr, URING_SLOTS * URING_READ_BUFFER, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+        if (buffers_ == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(sqRing_);
+        char* cq = static_cast<char*>(cqRing_);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool supportsOperations() {
+        vector<char> buffer(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+            return false;
+        }
+        for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+            if (op >= probe->ops_len || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // An empty file table for the chains to open into
+    bool registerSlots() {
+        vector<int> empty(URING_SLOTS, -1);
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, empty.data(), URING_SLOTS) == 0;
+    }
+
+    int fd_;
+    void* sqRing_ = MAP_FAILED;
+    void* cqRing_ = MAP_FAILED;
+    void* buffers_ = MAP_FAILED;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    size_t sqesSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqMask_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned* cqMask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+// One ring per thread, so concurrent callers (serve mode) never share queues
+Uring* threadRing() {
+    thread_local unique_ptr<Uring> ring = Uring::create();
+    return ring.get();
+}
+
+bool useUring(IoBackend backend) {
+    return backend != IoBackend::Threads && threadRing();
+}
+
+// Each read is one chain: open into the chain's slot, read the fixed file
+// into the slot buffer, close the slot. The hard link keeps a failed or short
+// read from cancelling the close. Slots are never inherited by exec, and the
+// kernel rejects O_CLOEXEC for them.
+void readWithUring(Uring& ring, vector<FileRead>& reads) {
+    vector<size_t> slowPath;  // did not fit in the slot buffer
+    for (size_t start = 0; start < reads.size(); start += URING_SLOTS) {
+        unsigned count = min<size_t>(URING_SLOTS, reads.size() - start);
+        ring.run(count, 3, [&](io_uring_sqe* sqe, unsigned slot, unsigned step) {
+            if (step == 0) {
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(reads[start + slot].path.c_str());
+                sqe->open_flags = O_RDONLY;
+                sqe->file_index = slot + 1;
+                sqe->flags = IOSQE_IO_LINK;
+            } else if (step == 1) {
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = slot;
+                sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+                sqe->addr = reinterpret_cast<uint64_t>(ring.buffer(slot));
+                sqe->len = URING_READ_BUFFER;
+            } else {
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->file_index = slot + 1;
+            }
+        }, [&](unsigned slot, unsigned step, int result) {
+            FileRead& read = reads[start + slot];
+            if (step == 0 && result < 0) {
+                read.error = -result;
+            } else if (step == 1 && !read.error) {
+                if (result < 0 || static_cast<size_t>(result) >= min(URING_READ_BUFFER, read.maxSize)) {
+                    slowPath.push_back(start + slot);  // interrupted, too large for the buffer, or over maxSize
+                } else {
+                    read.size = result;
+                    read.data.assign(ring.buffer(slot), result);
+                }
+            }
+        });
+    }
+    for (size_t i : slowPath) {
+        readOne(reads[i]);
+    }
+}
+
+// Opens that create or truncate always leave the submitting thread for
+// io_uring's workers, which costs more than the open itself, so files are
+// created with plain openat and each write is one write -> close chain.
+void writeWithUring(Uring& ring, vector<FileWrite>& writes) {
+    vector<size_t> slowPath;  // short or interrupted writes
+    for (size_t start = 0; start < writes.size(); start += URING_SLOTS) {
+        vector<pair<size_t, int>> opened;  // request, descriptor
+        for (size_t i = start; i < min<size_t>(start + URING_SLOTS, writes.size()); ++i) {
+            int fd = open(writes[i].path.c_str(), createFlags(writes[i]), 0666);
+            if (fd < 0) {
+                writes[i].error = errno;
+            } else {
+                opened.emplace_back(i, fd);
+            }
+        }
+        ring.run(opened.size(), 2, [&](io_uring_sqe* sqe, unsigned chain, unsigned step) {
+            const auto& [i, fd] = opened[chain];
+            sqe->fd = fd;
+            if (step == 0) {
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->flags = IOSQE_IO_HARDLINK;
+                sqe->addr = reinterpret_cast<uint64_t>(writes[i].data.data());
+                sqe->len = writes[i].data.size();
+            } else {
+                sqe->opcode = IORING_OP_CLOSE;
+            }
+        }, [&](unsigned chain, unsigned step, int result) {
+            FileWrite& write = writes[opened[chain].first];
+            if (step == 0 && result != static_cast<int>(write.data.size())) {
+                if (result == -EINTR || result == -EAGAIN || result >= 0) {
+                    slowPath.push_back(opened[chain].first);
+                } else {
+                    write.error = -result;
+                }
+            } else if (step == 1 && result < 0 && !write.error) {
+                write.error = -result;
+            }
+        });
+    }
+    for (size_t i : slowPath) {
+        writes[i].exclusive = false;  // the file is the one created above
+        writeOne(writes[i]);
+    }
+}
+
+} // namespace
+
+// Runs work(i) for every index on up to 16 threads
+void runOnThreads(size_t count, const function<void(size_t)>& work) {
+    size_t threadCount = min(count, clamp<size_t>(thread::hardware_concurrency(), 4, 16));
+    atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i; (i = next++) < count;) {
+            work(i);
+        }
+    };
+    vector<thread> workers;
+    for (size_t t = 1; t < threadCount; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+bool uringAvailable() {
+    return threadRing() != nullptr;
+}
+
+void readFiles(vector<FileRead>& reads, IoBackend backend) {
+    if (useUring(backend)) {
+        readWithUring(*threadRing(), reads);
+    } else {
+        runOnThreads(reads.size(), [&](size_t i) { readOne(reads[i]); });
+    }
+}
+
+void writeFiles(vector<FileWrite>& writes, IoBackend backend) {
+    if (useUring(backend)) {
+        writeWithUring(*threadRing(), writes);
+    } else {
+        runOnThreads(writes.size(), [&](size_t i) { writeOne(writes[i]); });
+    }
+}
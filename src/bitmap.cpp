@@ -0,0 +1,430 @@
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+#include "commit_graph.h"
+#include "tree_view.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Reachability bitmaps in .git/objects/info/bitmaps. Every object reachable
+// from a ref or HEAD when the file is written gets a position: commits in the
+// order a parents-first walk finishes them, each followed by the objects its
+// tree brings in for the first time. The set reachable from a commit is then
+// mostly a prefix of the positions, which EWAH (runs of all-zero or all-one
+// 64-bit words, with literal words between the runs) stores in a few words.
+// Every ref tip and one commit in BITMAP_INTERVAL gets such a bitmap.
+//
+// A query walks back from its roots until it meets bitmapped commits, ORs
+// their bitmaps and reads only what lies in between: commits made since the
+// file was written and the trees they changed. Objects never change, so a
+// bitmap never goes stale; new history only lengthens that walk until the
+// next `bitmap write`.
+
+const char BITMAP_MAGIC[4] = {'M', 'G', 'B', 'M'};
+const uint32_t BITMAP_VERSION = 1;
+const uint32_t BITMAP_INTERVAL = 100;  // commits, in walk order, per bitmap
+const uint32_t BITMAP_NO_POSITION = UINT32_MAX;
+
+struct BitmapHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t objects;
+    uint32_t bitmaps;
+};
+
+// The header is followed by the objects' raw SHAs in position order, their
+// positions sorted by SHA, one ObjectKind byte per object, padding to 8
+// bytes, the BitmapEntries sorted by commit, and the EWAH words.
+struct BitmapEntry {
+    uint32_t commit;  // position
+    uint32_t words;
+    uint64_t offset;  // of the EWAH words, from the start of the file
+};
+
+enum ObjectKind : uint8_t { KIND_COMMIT = 1, KIND_TREE, KIND_BLOB, KIND_CHUNKED, KIND_FILE };  // a file entry not yet read
+
+// An EWAH marker word: bit 0 is the running bit, bits 1-32 count the words
+// of it that follow, bits 33-63 the literal words after those
+const uint64_t EWAH_MAX_RUN = (1ULL << 32) - 1;
+const uint64_t EWAH_MAX_LITERALS = (1ULL << 31) - 1;
+
+static vector<uint64_t> ewahCompress(const vector<uint64_t>& words) {
+    vector<uint64_t> out;
+    auto clean = [](uint64_t word) { return word == 0 || word == ~0ULL; };
+    for (size_t i = 0; i < words.size();) {
+        uint64_t bit = words[i] == ~0ULL;
+        uint64_t run = 0;
+        while (i < words.size() && run < EWAH_MAX_RUN && clean(words[i]) && (words[i] == ~0ULL) == bit) {
+            ++run;
+            ++i;
+        }
+        size_t literals = i;
+        while (i < words.size() && i - literals < EWAH_MAX_LITERALS && !clean(words[i])) {
+            ++i;
+        }
+        out.push_back(bit | run << 1 | uint64_t(i - literals) << 33);
+        out.insert(out.end(), words.begin() + literals, words.begin() + i);
+    }
+    return out;
+}
+
+static void ewahOr(const uint64_t* ewah, size_t count, vector<uint64_t>& words) {
+    size_t position = 0;
+    for (size_t i = 0; i < count;) {
+        uint64_t marker = ewah[i++];
+        uint64_t run = (marker >> 1) & EWAH_MAX_RUN;
+        uint64_t literals = marker >> 33;
+        if (position + run + literals > words.size() || i + literals > count) {
+            throw runtime_error("Corrupt reachability bitmap");
+        }
+        if (marker & 1) {
+            fill(words.begin() + position, words.begin() + position + run, ~0ULL);
+        }
+        position += run;
+        for (uint64_t j = 0; j < literals; ++j) {
+            words[position++] |= ewah[i++];
+        }
+    }
+}
+
+static bool testAndSet(vector<uint64_t>& words, uint32_t position) {
+    uint64_t bit = 1ULL << (position % 64);
+    bool set = words[position / 64] & bit;
+    words[position / 64] |= bit;
+    return set;
+}
+
+static string bitmapPath(const string& git_dir) {
+    return git_dir + "/objects/info/bitmaps";
+}
+
+namespace {
+
+// Read-only view of the bitmap file, memory mapped
+class ReachabilityBitmaps {
+public:
+    explicit ReachabilityBitmaps(const string& git_dir) {
+        int fd = open(bitmapPath(git_dir).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        void* mapped = fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(BitmapHeader))
+                           ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                           : MAP_FAILED;
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+        data_ = static_cast<const char*>(mapped);
+        size_ = st.st_size;
+
+        const BitmapHeader& header = *reinterpret_cast<const BitmapHeader*>(data_);
+        size_t objects = header.objects;
+        size_t entriesOffset = (sizeof(BitmapHeader) + objects * 25 + 7) / 8 * 8;
+        if (memcmp(header.magic, BITMAP_MAGIC, 4) != 0 || header.version != BITMAP_VERSION ||
+            entriesOffset + size_t(header.bitmaps) * sizeof(BitmapEntry) > size_) {
+            return;  // unknown or truncated: queries fall back to a full walk
+        }
+        objects_ = header.objects;
+        shas_ = reinterpret_cast<const unsigned char*>(data_ + sizeof(BitmapHeader));
+        bySha_ = reinterpret_cast<const uint32_t*>(shas_ + objects * 20);
+        kinds_ = reinterpret_cast<const uint8_t*>(bySha_ + objects);
+        entries_ = reinterpret_cast<const BitmapEntry*>(data_ + entriesOffset);
+        bitmaps_ = header.bitmaps;
+    }
+    ReachabilityBitmaps(const ReachabilityBitmaps&) = delete;
+    ReachabilityBitmaps& operator=(const ReachabilityBitmaps&) = delete;
+    ~ReachabilityBitmaps() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    bool empty() const { return bitmaps_ == 0; }
+    uint32_t size() const { return objects_; }
+    ObjectKind kind(uint32_t position) const { return static_cast<ObjectKind>(kinds_[position]); }
+
+    // Position of a raw SHA, or BITMAP_NO_POSITION
+    uint32_t find(string_view raw) const {
+        const uint32_t* it = lower_bound(bySha_, bySha_ + objects_, raw, [&](uint32_t position, string_view sha) {
+            return memcmp(shas_ + size_t(position) * 20, sha.data(), 20) < 0;
+        });
+        return it != bySha_ + objects_ && memcmp(shas_ + size_t(*it) * 20, raw.data(), 20) == 0 ? *it
+                                                                                               : BITMAP_NO_POSITION;
+    }
+
+    // ORs the commit's bitmap into words; false when it has none
+    bool orInto(uint32_t commit, vector<uint64_t>& words) const {
+        const BitmapEntry* it = lower_bound(entries_, entries_ + bitmaps_, commit,
+                                            [](const BitmapEntry& entry, uint32_t c) { return entry.commit < c; });
+        if (it == entries_ + bitmaps_ || it->commit != commit) {
+            return false;
+        }
+        if (it->offset % 8 || it->offset + size_t(it->words) * 8 > size_) {
+            throw runtime_error("Corrupt reachability bitmap");
+        }
+        ewahOr(reinterpret_cast<const uint64_t*>(data_ + it->offset), it->words, words);
+        return true;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    uint32_t objects_ = 0;
+    uint32_t bitmaps_ = 0;
+    const unsigned char* shas_ = nullptr;
+    const uint32_t* bySha_ = nullptr;
+    const uint8_t* kinds_ = nullptr;
+    const BitmapEntry* entries_ = nullptr;
+};
+
+} // namespace
+
+mygit::BitmapWriteResult writeReachabilityBitmaps(const string& git_dir) {
+    // Positions are handed out as objects are first reached and objects are
+    // read in position order, so children[childStart[p]..childStart[p + 1])
+    // are the objects p points at
+    string shas;  // raw SHAs in position order
+    vector<uint8_t> kinds;
+    unordered_map<string, uint32_t> positions;  // raw SHA -> position
+    vector<uint32_t> childStart = {0};
+    vector<uint32_t> children;
+    deque<uint32_t> unread;
+
+    auto position = [&](const string& hex, ObjectKind kind) {
+        string raw = BytesFromHexSha(hex);
+        auto [it, added] = positions.try_emplace(raw, static_cast<uint32_t>(kinds.size()));
+        if (added) {
+            shas += raw;
+            kinds.push_back(kind);
+            unread.push_back(it->second);
+        }
+        return it->second;
+    };
+    auto readUnread = [&] {
+        while (!unread.empty()) {
+            uint32_t object = unread.front();
+            unread.pop_front();
+            string sha = to_hex_string(reinterpret_cast<const unsigned char*>(shas.data()) + size_t(object) * 20, 20);
+            if (kinds[object] == KIND_FILE) {
+                kinds[object] = readObjectType(sha, git_dir) == "chunked" ? KIND_CHUNKED : KIND_BLOB;
+            }
+            if (kinds[object] == KIND_TREE) {
+                string tree = readObject(sha, git_dir);
+                for (const TreeEntry& entry : TreeView::fromObject(tree)) {
+                    if ((entry.mode & FILE_MODE_MASK) != GITLINK_MODE) {
+                        children.push_back(position(entry.id.hex(), isTreeMode(entry.mode) ? KIND_TREE : KIND_FILE));
+                    }
+                }
+            } else if (kinds[object] == KIND_CHUNKED) {
+                for (const string& chunk : referencedObjects(readObject(sha, git_dir))) {
+                    children.push_back(position(chunk, KIND_BLOB));
+                }
+            }
+            childStart.push_back(static_cast<uint32_t>(children.size()));
+        }
+    };
+
+    // Commits reachable from a ref or HEAD, parents first, as in
+    // writeCommitGraph. Each finished commit is numbered, then everything
+    // new below its tree.
+    vector<pair<string, bool>> stack;  // SHA, parents pushed
+    unordered_set<string> tips;
+    for (const auto& [name, sha] : listRefs(git_dir)) {
+        stack.emplace_back(sha, false);
+    }
+    string head = getHeadSHA(git_dir);
+    if (!head.empty()) {
+        stack.emplace_back(head, false);
+    }
+    erase_if(stack, [&](const auto& entry) { return readObjectType(entry.first, git_dir) != "commit"; });
+    for (const auto& [sha, expanded] : stack) {
+        tips.insert(sha);
+    }
+
+    unordered_map<string, CommitInfo> pending;
+    vector<uint32_t> selected;
+    size_t commits = 0;
+    while (!stack.empty()) {
+        auto [sha, expanded] = stack.back();
+        if (positions.contains(BytesFromHexSha(sha))) {
+            stack.pop_back();
+            continue;
+        }
+        if (!expanded) {
+            stack.back().second = true;
+            CommitInfo& commit = pending[sha] = readCommitInfo(sha, git_dir);
+            for (auto it = commit.parents.rbegin(); it != commit.parents.rend(); ++it) {
+                stack.emplace_back(*it, false);
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        CommitInfo commit = std::move(pending[sha]);
+        pending.erase(sha);
+        uint32_t self = position(sha, KIND_COMMIT);
+        unread.pop_back();  // read here, so its children come first
+        children.push_back(position(commit.tree, KIND_TREE));
+        for (const string& parent : commit.parents) {
+            children.push_back(positions.at(BytesFromHexSha(parent)));
+        }
+        childStart.push_back(static_cast<uint32_t>(children.size()));
+        readUnread();
+        if (commits++ % BITMAP_INTERVAL == 0 || tips.contains(sha)) {
+            selected.push_back(self);
+        }
+    }
+
+    // Each selected commit's set: its own walk down to the bitmapped
+    // commits below it, whose sets are ORed in. Parents are pushed last, so
+    // the walk meets those commits before it reads any tree.
+    uint32_t objects = static_cast<uint32_t>(kinds.size());
+    unordered_map<uint32_t, vector<uint64_t>> bitmaps;
+    vector<uint64_t> words((objects + 63) / 64);
+    vector<uint32_t> walk;
+    for (uint32_t commit : selected) {
+        fill(words.begin(), words.end(), 0);
+        walk.assign(1, commit);
+        while (!walk.empty()) {
+            uint32_t object = walk.back();
+            walk.pop_back();
+            if (words[object / 64] & (1ULL << (object % 64))) {
+                continue;
+            }
+            auto bitmap = object == commit ? bitmaps.end() : bitmaps.find(object);
+            if (bitmap != bitmaps.end()) {
+                ewahOr(bitmap->second.data(), bitmap->second.size(), words);
+                continue;
+            }
+            testAndSet(words, object);
+            walk.insert(walk.end(), children.begin() + childStart[object], children.begin() + childStart[object + 1]);
+        }
+        bitmaps[commit] = ewahCompress(words);
+    }
+
+    // The file: header, SHAs, lookup table, kinds, entries, EWAH words
+    vector<uint32_t> bySha(objects);
+    for (uint32_t i = 0; i < objects; ++i) {
+        bySha[i] = i;
+    }
+    sort(bySha.begin(), bySha.end(), [&](uint32_t a, uint32_t b) {
+        return memcmp(shas.data() + size_t(a) * 20, shas.data() + size_t(b) * 20, 20) < 0;
+    });
+    sort(selected.begin(), selected.end());
+
+    BitmapHeader header;
+    memcpy(header.magic, BITMAP_MAGIC, 4);
+    header.version = BITMAP_VERSION;
+    header.objects = objects;
+    header.bitmaps = static_cast<uint32_t>(selected.size());
+    string file(reinterpret_cast<const char*>(&header), sizeof(header));
+    file += shas;
+    file.append(reinterpret_cast<const char*>(bySha.data()), bySha.size() * sizeof(uint32_t));
+    file.append(reinterpret_cast<const char*>(kinds.data()), kinds.size());
+    file.resize((file.size() + 7) / 8 * 8, '\0');
+    uint64_t offset = file.size() + selected.size() * sizeof(BitmapEntry);
+    for (uint32_t commit : selected) {
+        BitmapEntry entry{commit, static_cast<uint32_t>(bitmaps[commit].size()), offset};
+        file.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        offset += entry.words * sizeof(uint64_t);
+    }
+    for (uint32_t commit : selected) {
+        const vector<uint64_t>& ewah = bitmaps[commit];
+        file.append(reinterpret_cast<const char*>(ewah.data()), ewah.size() * sizeof(uint64_t));
+    }
+
+    fs::create_directories(git_dir + "/objects/info");
+    LockFile(bitmapPath(git_dir)).commit(file);
+    return mygit::BitmapWriteResult{objects, selected.size()};
+}
+
+size_t countReachableObjects(const string& git_dir) {
+    vector<string> roots = reachabilityRoots(git_dir);
+    ReachabilityBitmaps bitmaps(git_dir);
+    if (bitmaps.empty()) {
+        vector<string> objects = listLooseObjects(git_dir);
+        vector<bool> reachable = markReachable(git_dir, objects, roots, nullptr);
+        return count(reachable.begin(), reachable.end(), true);
+    }
+
+    // Objects with a position are marked in words, newer ones in extra
+    vector<uint64_t> words((bitmaps.size() + 63) / 64);
+    unordered_set<string> extra;
+    auto mark = [&](const string& sha, uint32_t position) {
+        return position != BITMAP_NO_POSITION ? !testAndSet(words, position) : extra.insert(sha).second;
+    };
+
+    // Commits first, so bitmaps are ORed in before any tree is read
+    vector<string> commits;
+    vector<pair<string, bool>> objects;  // SHA, and whether a tree (or the index) lists it as a file
+    for (const string& root : roots) {
+        uint32_t position = bitmaps.find(BytesFromHexSha(root));
+        if (position != BITMAP_NO_POSITION ? bitmaps.kind(position) == KIND_COMMIT
+                                           : objectExists(root, git_dir) && readObjectType(root, git_dir) == "commit") {
+            commits.push_back(root);
+        } else {
+            objects.emplace_back(root, false);
+        }
+    }
+    while (!commits.empty()) {
+        string sha = std::move(commits.back());
+        commits.pop_back();
+        uint32_t position = bitmaps.find(BytesFromHexSha(sha));
+        if (position != BITMAP_NO_POSITION && (words[position / 64] & (1ULL << (position % 64)))) {
+            continue;
+        }
+        if (position != BITMAP_NO_POSITION && bitmaps.orInto(position, words)) {
+            continue;
+        }
+        if (!mark(sha, position)) {
+            continue;
+        }
+        CommitInfo commit = readCommitInfo(sha, git_dir);
+        objects.emplace_back(commit.tree, false);
+        commits.insert(commits.end(), commit.parents.begin(), commit.parents.end());
+    }
+
+    while (!objects.empty()) {
+        auto [sha, listedAsFile] = std::move(objects.back());
+        objects.pop_back();
+        uint32_t position = bitmaps.find(BytesFromHexSha(sha));
+        if (position == BITMAP_NO_POSITION && !objectExists(sha, git_dir)) {
+            continue;  // referenced but missing, as gc would report
+        }
+        if (!mark(sha, position)) {
+            continue;
+        }
+        ObjectKind kind = position != BITMAP_NO_POSITION ? bitmaps.kind(position) : KIND_FILE;
+        if (kind == KIND_BLOB || (listedAsFile && kind == KIND_FILE && readObjectType(sha, git_dir) == "blob")) {
+            continue;
+        }
+        vector<string> fileEntries;
+        for (string& reference : referencedObjects(readObject(sha, git_dir), &fileEntries)) {
+            objects.emplace_back(std::move(reference), false);
+        }
+        for (string& fileEntry : fileEntries) {
+            objects.emplace_back(std::move(fileEntry), true);
+        }
+    }
+
+    size_t count = extra.size();
+    for (uint64_t word : words) {
+        count += popcount(word);
+    }
+    return count;
+}
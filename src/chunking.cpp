@@ -0,0 +1,308 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Files at or above chunking.threshold bytes are stored as a "chunked" object:
+// a list of "<blob-sha> <length>\n" lines, one per content-defined chunk. Each
+// chunk is an ordinary blob, so an edit in the middle of a large file only
+// produces new objects for the chunks around it.
+
+const size_t CHUNK_MIN_SIZE = 256 * 1024;
+const size_t CHUNK_AVG_SIZE = 1024 * 1024;
+const size_t CHUNK_MAX_SIZE = 8 * 1024 * 1024;
+
+// FastCDC normalized chunking: a stricter mask before the average size and a
+// looser one after it pulls chunk sizes towards the average. The gear hash
+// shifts left every byte, so only the high bits cover the full 64-byte window.
+const uint64_t MASK_STRICT = ~0ULL << (64 - 22);
+const uint64_t MASK_LOOSE = ~0ULL << (64 - 18);
+
+struct GearTable {
+    uint64_t values[256];
+
+    constexpr GearTable() : values() {
+        // splitmix64 with a fixed seed, so boundaries never change between builds
+        uint64_t state = 0x6d79676974636463ULL;
+        for (auto& value : values) {
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+    }
+};
+
+static constexpr GearTable GEAR;
+
+// Gear hash of data[hashStart, end). Bytes more than 64 positions back have
+// been shifted out, so starting 64 bytes early gives the exact value.
+static inline uint64_t gearHashAt(const unsigned char* data, size_t hashStart, size_t end) {
+    uint64_t hash = 0;
+    for (size_t i = (end - hashStart > 64 ? end - 64 : hashStart); i < end; ++i) {
+        hash = (hash << 1) + GEAR.values[data[i]];
+    }
+    return hash;
+}
+
+static size_t scanScalar(const unsigned char* data, size_t hashStart, size_t from, size_t to, uint64_t mask) {
+    uint64_t hash = gearHashAt(data, hashStart, from);
+    for (size_t i = from; i < to; ++i) {
+        hash = (hash << 1) + GEAR.values[data[i]];
+        if ((hash & mask) == 0) {
+            return i;
+        }
+    }
+    return to;
+}
+
+// First i in [from, to) whose hash (accumulated from hashStart) matches mask,
+// or to. The hash is one long dependency chain, so the range is cut into
+// SCAN_LANES segments hashed in lockstep; the independent chains keep the
+// pipeline full (about 1.6x the scalar loop). Only the first lane that saw a
+// match is rescanned to find the exact byte.
+const size_t SCAN_LANES = 4;
+
+static size_t scanForBoundary(const unsigned char* data, size_t hashStart, size_t from, size_t to, uint64_t mask) {
+    const size_t SEGMENT = 16384;
+    const size_t BLOCK = SCAN_LANES * SEGMENT;
+
+    size_t pos = from;
+    while (to - pos >= BLOCK) {
+        const unsigned char* base = data + pos;
+        uint64_t h0 = gearHashAt(data, hashStart, pos);
+        uint64_t h1 = gearHashAt(data, hashStart, pos + SEGMENT);
+        uint64_t h2 = gearHashAt(data, hashStart, pos + 2 * SEGMENT);
+        uint64_t h3 = gearHashAt(data, hashStart, pos + 3 * SEGMENT);
+        uint64_t m0 = 0, m1 = 0, m2 = 0, m3 = 0;
+
+        for (size_t k = 0; k < SEGMENT; ++k) {
+            h0 = (h0 << 1) + GEAR.values[base[k]];
+            h1 = (h1 << 1) + GEAR.values[base[SEGMENT + k]];
+            h2 = (h2 << 1) + GEAR.values[base[2 * SEGMENT + k]];
+            h3 = (h3 << 1) + GEAR.values[base[3 * SEGMENT + k]];
+            m0 |= (h0 & mask) == 0;
+            m1 |= (h1 & mask) == 0;
+            m2 |= (h2 & mask) == 0;
+            m3 |= (h3 & mask) == 0;
+        }
+
+        uint64_t matched[SCAN_LANES] = {m0, m1, m2, m3};
+        for (size_t j = 0; j < SCAN_LANES; ++j) {
+            if (matched[j]) {
+                size_t laneStart = pos + j * SEGMENT;
+                return scanScalar(data, hashStart, laneStart, laneStart + SEGMENT, mask);
+            }
+        }
+        pos += BLOCK;
+    }
+    return scanScalar(data, hashStart, pos, to, mask);
+}
+
+// Length of the chunk starting at data, which has size bytes left
+static size_t nextChunkLength(const unsigned char* data, size_t size) {
+    if (size <= CHUNK_MIN_SIZE) {
+        return size;
+    }
+    size_t normal = min(size, CHUNK_AVG_SIZE);
+    size_t limit = min(size, CHUNK_MAX_SIZE);
+
+    size_t cut = scanForBoundary(data, CHUNK_MIN_SIZE, CHUNK_MIN_SIZE, normal, MASK_STRICT);
+    if (cut < normal) {
+        return cut + 1;
+    }
+    cut = scanForBoundary(data, CHUNK_MIN_SIZE, normal, limit, MASK_LOOSE);
+    return cut < limit ? cut + 1 : limit;
+}
+
+vector<size_t> chunkLengths(const unsigned char* data, size_t size) {
+    vector<size_t> lengths;
+    for (size_t offset = 0; offset < size;) {
+        size_t length = nextChunkLength(data + offset, size - offset);
+        lengths.push_back(length);
+        offset += length;
+    }
+    return lengths;
+}
+
+size_t chunkingThreshold(const string& git_dir) {
+    string value = getConfigValue(git_dir, "chunking.threshold", "0");
+    size_t multiplier = 1;
+    if (!value.empty()) {
+        switch (tolower(value.back())) {
+            case 'k': multiplier = 1024; break;
+            case 'm': multiplier = 1024 * 1024; break;
+            case 'g': multiplier = 1024 * 1024 * 1024; break;
+        }
+        if (multiplier != 1) value.pop_back();
+    }
+    try {
+        return stoull(value) * multiplier;
+    } catch (const exception&) {
+        throw runtime_error("Invalid chunking.threshold: " + value);
+    }
+}
+
+// Hash a worktree file as the object it is stored as, writing the object
+// (and its chunks) when write is set. Returns the hex SHA.
+string hashFileObject(const string& filePath, const string& git_dir, bool write) {
+    size_t threshold = chunkingThreshold(git_dir);
+    fs::path root = fs::path(git_dir).parent_path();
+    string relativePath = fs::path(filePath).lexically_relative(root).generic_string();
+    auto storeBlob = [&](const string& sha1, const string& blob, size_t headerSize) {
+        if (freshenObject(sha1, git_dir)) {
+            return;
+        }
+        string_view content = string_view(blob).substr(headerSize);
+        int level = blobCompressionLevel(content, root, relativePath);
+        storeCompressedFile(sha1, compressContent(blob, level), git_dir);
+    };
+
+    error_code ec;
+    uintmax_t size = fs::file_size(filePath, ec);
+    if (threshold == 0 || ec || size < threshold) {
+        string blob = CreateBlobString(filePath);
+        string sha1 = calculateSHA1(blob);
+        if (write) {
+            storeBlob(sha1, blob, blob.find('\0') + 1);
+        }
+        return sha1;
+    }
+
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error(filePath + " not found.");
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw runtime_error("Failed to map " + filePath);
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const unsigned char* data = static_cast<const unsigned char*>(mapped);
+
+    string listing;
+    size_t offset = 0;
+    try {
+        for (size_t length : chunkLengths(data, size)) {
+            string header = "blob " + to_string(length) + '\0';
+            string blob = header + string(reinterpret_cast<const char*>(data + offset), length);
+            string sha1 = calculateSHA1(blob);
+            if (write) {
+                storeBlob(sha1, blob, header.size());
+            }
+            listing += sha1 + " " + to_string(length) + "\n";
+            offset += length;
+        }
+    } catch (...) {
+        munmap(mapped, size);
+        throw;
+    }
+    munmap(mapped, size);
+
+    if (write) {
+        return writeObject("chunked", listing, git_dir);
+    }
+    return calculateSHA1("chunked " + to_string(listing.size()) + '\0' + listing);
+}
+
+const size_t HASH_BATCH = 512;  // files read, and new blobs written, per batch
+
+// hashFileObject for many files. Files below chunking.threshold are read in
+// one batch and their new blobs written in another; larger files are chunked
+// one at a time.
+vector<string> hashFileObjects(const vector<string>& filePaths, const string& git_dir, bool write, IoBackend backend) {
+    size_t threshold = chunkingThreshold(git_dir);
+    fs::path root = fs::path(git_dir).parent_path();
+    vector<string> shas(filePaths.size());
+
+    for (size_t start = 0; start < filePaths.size(); start += HASH_BATCH) {
+        size_t end = min(start + HASH_BATCH, filePaths.size());
+        vector<FileRead> reads(end - start);
+        for (size_t i = start; i < end; ++i) {
+            reads[i - start].path = filePaths[i];
+            reads[i - start].maxSize = threshold ? threshold : SIZE_MAX;
+        }
+        readFiles(reads, backend);
+
+        vector<pair<string, string>> newObjects;
+        set<string> queued;  // identical files in one batch are stored once
+        for (size_t i = start; i < end; ++i) {
+            const FileRead& read = reads[i - start];
+            if (read.error) {
+                throw runtime_error(read.path + " not found.");
+            }
+            if (read.size >= read.maxSize) {
+                shas[i] = hashFileObject(read.path, git_dir, write);
+                continue;
+            }
+            string blob = "blob " + to_string(read.data.size()) + '\0' + read.data;
+            shas[i] = calculateSHA1(blob);
+            if (write && !freshenObject(shas[i], git_dir) && queued.insert(shas[i]).second) {
+                string relativePath = fs::path(read.path).lexically_relative(root).generic_string();
+                int level = blobCompressionLevel(read.data, root, relativePath);
+                newObjects.emplace_back(shas[i], compressContent(blob, level));
+            }
+        }
+        if (!newObjects.empty()) {
+            storeCompressedFiles(newObjects, git_dir, backend);
+        }
+    }
+    return shas;
+}
+
+// Write the file content of a blob or chunked object to out. Chunked objects
+// are streamed one chunk at a time, so memory stays bounded by the chunk size.
+void writeFileContent(const string& sha, ostream& out, const string& git_dir) {
+    string object = readObject(sha, git_dir);
+    size_t nullPos = object.find('\0');
+    size_t start = nullPos == string::npos ? 0 : nullPos + 1;
+
+    if (object.compare(0, 8, "chunked ") != 0) {
+        out.write(object.data() + start, object.size() - start);
+        return;
+    }
+
+    for (const auto& [chunkSha, length] : chunkListing(string_view(object).substr(start))) {
+        string chunk = readObject(chunkSha, git_dir);
+        size_t chunkStart = chunk.find('\0') + 1;
+        if (chunk.size() - chunkStart != length) {
+            throw runtime_error("Chunk " + chunkSha + " has the wrong size.");
+        }
+        out.write(chunk.data() + chunkStart, length);
+    }
+}
+
+vector<pair<string, size_t>> chunkListing(string_view listing) {
+    vector<pair<string, size_t>> chunks;
+    istringstream lines{string(listing)};
+    string chunkSha;
+    size_t length;
+    while (lines >> chunkSha >> length) {
+        chunks.emplace_back(chunkSha, length);
+    }
+    return chunks;
+}
+
+string readFileContent(const string& sha, const string& git_dir) {
+    string object = readObject(sha, git_dir);
+    if (object.compare(0, 8, "chunked ") == 0) {
+        ostringstream out;
+        writeFileContent(sha, out, git_dir);
+        return out.str();
+    }
+    object.erase(0, object.find('\0') + 1);
+    return object;
+}
@@ -0,0 +1,128 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// clone --local: object files never change once in place. Writers create
+// them with O_EXCL or rename them over from a temporary name
+// (durability.cpp), even when they rewrite an object the filter missed,
+// and gc only unlinks. So the new repository hard links them instead of
+// copying. Everything that is rewritten or appended in place (the object
+// filter, the commit graph, logs, config) is copied, so neither repository
+// can change the other's.
+
+static bool isHexName(const string& name, size_t length) {
+    return name.size() == length && all_of(name.begin(), name.end(), [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    });
+}
+
+// Hard link source to destination, or copy it when the two are on different
+// file systems (or the file system has no hard links)
+static void linkOrCopy(const fs::path& source, const fs::path& destination) {
+    if (link(source.c_str(), destination.c_str()) == 0) {
+        return;
+    }
+    if (errno != EXDEV && errno != EPERM && errno != EMLINK) {
+        throw runtime_error("Could not link " + destination.string() + ": " + strerror(errno));
+    }
+    fs::copy_file(source, destination);
+}
+
+// Links the loose objects (objects/<2 hex>/<38 hex>) and packs; temporary
+// files of writes in progress are left behind
+static void linkObjects(const fs::path& sourceObjects, const fs::path& objects) {
+    vector<fs::path> directories;
+    for (const auto& entry : fs::directory_iterator(sourceObjects)) {
+        string name = entry.path().filename().string();
+        if (entry.is_directory() && (isHexName(name, 2) || name == "pack")) {
+            directories.push_back(entry.path());
+        }
+    }
+
+    mutex mutex;
+    string error;
+    runOnThreads(directories.size(), [&](size_t i) {
+        try {
+            string name = directories[i].filename().string();
+            fs::path target = objects / name;
+            fs::create_directory(target);
+            for (const auto& entry : fs::directory_iterator(directories[i])) {
+                string file = entry.path().filename().string();
+                bool immutable = name == "pack" ? file.ends_with(".pack") || file.ends_with(".idx")
+                                                : isHexName(file, 38);
+                if (immutable && entry.is_regular_file()) {
+                    linkOrCopy(entry.path(), target / file);
+                }
+            }
+        } catch (const exception& e) {
+            lock_guard<std::mutex> lock(mutex);
+            error = e.what();
+        }
+    });
+    if (!error.empty()) {
+        throw runtime_error(error);
+    }
+}
+
+static void copyIfExists(const fs::path& source, const fs::path& destination) {
+    if (fs::exists(source)) {
+        fs::create_directories(destination.parent_path());
+        fs::copy(source, destination, fs::copy_options::recursive | fs::copy_options::overwrite_existing);
+    }
+}
+
+static string firstLine(const fs::path& path) {
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+void cloneLocal(const fs::path& source, const fs::path& destination) {
+    fs::path sourceGitDir = fs::is_directory(source / ".git") ? source / ".git" : source;
+    if (!fs::is_directory(sourceGitDir / "objects") || !fs::exists(sourceGitDir / "HEAD")) {
+        throw runtime_error("Not a git repository: " + source.string());
+    }
+    if (fs::exists(destination) && (!fs::is_directory(destination) || !fs::is_empty(destination))) {
+        throw runtime_error("Destination " + destination.string() + " already exists and is not empty");
+    }
+
+    fs::path gitDir = destination / ".git";
+    fs::create_directories(gitDir / "objects");
+    fs::create_directory(gitDir / "refs");
+    string git_dir = gitDir.string();
+
+    linkObjects(sourceGitDir / "objects", gitDir / "objects");
+    copyIfExists(sourceGitDir / "objects" / "info", gitDir / "objects" / "info");
+    copyIfExists(sourceGitDir / "config", gitDir / "config");
+    copyIfExists(sourceGitDir / "logs", gitDir / "logs");
+    copyIfExists(sourceGitDir / "commit-graph", gitDir / "commit-graph");
+
+    // One batch: many refs go into a single sorted packed-refs, however the
+    // source stored them
+    vector<mygit::RefUpdate> refs;
+    for (const auto& [name, sha] : listRefs(sourceGitDir.string())) {
+        refs.push_back({name, sha, ""});
+    }
+    if (!refs.empty()) {
+        updateRefs(git_dir, refs, true);
+    }
+    string head = firstLine(sourceGitDir / "HEAD");
+    setHead(git_dir, head.starts_with("ref: ") ? head.substr(5) : head);
+
+    string headSHA = getHeadSHA(git_dir);
+    if (headSHA.empty()) {
+        return;  // nothing committed yet
+    }
+    // Also writes an index matching HEAD, so the clone starts out clean
+    extractCommit(destination, headSHA, true);
+}
@@ -0,0 +1,208 @@
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <zlib.h>
+#ifdef MYGIT_CODEC_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include "headers.h"
+using namespace std;
+
+// Every object is stored as one zlib stream. All compression and inflation
+// goes through this file; the backend is picked at build time with
+// -DMYGIT_CODEC=zlib (the default) or libdeflate. libdeflate works on whole
+// buffers only, so streaming work (reading an object's header, the gzip
+// output of archive) stays on zlib. Either backend reads what the other
+// writes: the compressed bytes may differ, the format does not.
+
+// Full size of the inflated object from its "<type> <size>\0" header, or 0
+// while the header is not complete
+static size_t objectSizeFromHeader(const char* data, size_t size) {
+    const char* end = static_cast<const char*>(memchr(data, '\0', size));
+    const char* space = end ? static_cast<const char*>(memchr(data, ' ', end - data)) : nullptr;
+    if (!space || space + 1 == end) {
+        return 0;
+    }
+    size_t length = 0;
+    for (const char* digit = space + 1; digit < end; ++digit) {
+        if (*digit < '0' || *digit > '9') {
+            return 0;
+        }
+        length = length * 10 + (*digit - '0');
+    }
+    return (end - data) + 1 + length;
+}
+
+static string zlibCompress(const string& content, int level) {
+    uLongf compressedSize = compressBound(content.size());
+    string compressedData(compressedSize, '\0');
+
+    int result = compress2(reinterpret_cast<Bytef*>(&compressedData[0]), &compressedSize,
+                           reinterpret_cast<const Bytef*>(content.data()), content.size(), level);
+    if (result != Z_OK) {
+        throw runtime_error("Failed to compress content.");
+    }
+    compressedData.resize(compressedSize);  // Resize to the actual compressed size
+    return compressedData;
+}
+
+// Inflates straight into the result: the header comes out first and gives
+// the exact size, so large objects are allocated once and never copied
+static string zlibDecompress(string_view compressed, size_t* unusedInput) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) {
+        throw runtime_error("inflateInit failed while decompressing.");
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    zs.avail_in = compressed.size();
+
+    string out(64, '\0');
+    size_t produced = 0;
+    bool sized = false;
+    int ret;
+    do {
+        if (produced == out.size()) {
+            size_t total = sized ? 0 : objectSizeFromHeader(out.data(), produced);
+            sized = sized || total;
+            // One byte past the announced size, so a longer stream still shows
+            out.resize(total > produced ? total + 1 : out.size() * 2);
+        }
+        zs.next_out = reinterpret_cast<Bytef*>(out.data() + produced);
+        zs.avail_out = out.size() - produced;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        produced = out.size() - zs.avail_out;
+    } while (ret == Z_OK);
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END) {
+        throw runtime_error("Exception during zlib decompression: (" + to_string(ret) + ") " +
+                            (zs.msg ? zs.msg : "truncated input"));
+    }
+    if (unusedInput) {
+        *unusedInput = zs.avail_in;
+    }
+    out.resize(produced);
+    return out;
+}
+
+string decompressPrefix(string_view compressed, size_t maxOutput) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) {
+        throw runtime_error("inflateInit failed while decompressing.");
+    }
+    string out(maxOutput, '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    zs.avail_in = compressed.size();
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+    int ret = inflate(&zs, Z_SYNC_FLUSH);
+    out.resize(out.size() - zs.avail_out);
+    inflateEnd(&zs);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        throw runtime_error("Exception during zlib decompression: (" + to_string(ret) + ")");
+    }
+    return out;
+}
+
+#ifdef MYGIT_CODEC_LIBDEFLATE
+
+namespace {
+
+struct CompressorDeleter {
+    void operator()(libdeflate_compressor* compressor) const { libdeflate_free_compressor(compressor); }
+};
+struct DecompressorDeleter {
+    void operator()(libdeflate_decompressor* decompressor) const { libdeflate_free_decompressor(decompressor); }
+};
+
+// Compressors are sized for their level, so each thread keeps one per level
+libdeflate_compressor* compressor(int level) {
+    thread_local unique_ptr<libdeflate_compressor, CompressorDeleter> compressors[10];
+    auto& slot = compressors[level];
+    if (!slot) {
+        slot.reset(libdeflate_alloc_compressor(level));
+        if (!slot) {
+            throw runtime_error("Could not allocate a compressor.");
+        }
+    }
+    return slot.get();
+}
+
+libdeflate_decompressor* decompressor() {
+    thread_local unique_ptr<libdeflate_decompressor, DecompressorDeleter> slot(libdeflate_alloc_decompressor());
+    if (!slot) {
+        throw runtime_error("Could not allocate a decompressor.");
+    }
+    return slot.get();
+}
+
+} // namespace
+
+const char* codecName() {
+    return "libdeflate";
+}
+
+string compressContent(const string& content, int level) {
+    libdeflate_compressor* c = compressor(level < 0 || level > 9 ? 6 : level);  // 6 is zlib's default
+    string compressed(libdeflate_zlib_compress_bound(c, content.size()), '\0');
+    size_t size = libdeflate_zlib_compress(c, content.data(), content.size(), compressed.data(), compressed.size());
+    if (size == 0) {
+        throw runtime_error("Failed to compress content.");
+    }
+    compressed.resize(size);
+    return compressed;
+}
+
+// libdeflate needs room for the whole output up front. Most objects fit a
+// guess from the compressed size; the rest are retried at the size their
+// header announces.
+string decompressContent(const string& compressedContent, size_t* unusedInput) {
+    size_t capacity = compressedContent.size() * 4 + 1024;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        string out(capacity, '\0');
+        size_t consumed = 0;
+        size_t produced = 0;
+        libdeflate_result result =
+            libdeflate_zlib_decompress_ex(decompressor(), compressedContent.data(), compressedContent.size(),
+                                          out.data(), out.size(), &consumed, &produced);
+        if (result == LIBDEFLATE_SUCCESS) {
+            if (unusedInput) {
+                *unusedInput = compressedContent.size() - consumed;
+            }
+            out.resize(produced);
+            return out;
+        }
+        if (result != LIBDEFLATE_INSUFFICIENT_SPACE) {
+            break;
+        }
+        string header = decompressPrefix(compressedContent, 64);
+        size_t total = objectSizeFromHeader(header.data(), header.size());
+        if (total <= capacity) {
+            break;
+        }
+        capacity = total;
+    }
+    // Not an object, or a broken stream: zlib grows as it goes and says what is wrong
+    return zlibDecompress(compressedContent, unusedInput);
+}
+
+#else
+
+const char* codecName() {
+    return "zlib";
+}
+
+string compressContent(const string& content, int level) {
+    return zlibCompress(content, level);
+}
+
+string decompressContent(const string& compressedContent, size_t* unusedInput) {
+    return zlibDecompress(compressedContent, unusedInput);
+}
+
+#endif
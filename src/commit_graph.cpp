@@ -0,0 +1,493 @@
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+#include "commit_graph.h"
+#include "tree_view.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Each record carries the commit's tree, its first parent's tree and a Bloom
+// filter of the paths that changed between the two, directories leading to
+// them included. `log -- <path>` rejects most commits with one probe of that
+// filter, and only diffs the trees along the path for the few that may have
+// touched it. Parent positions, generation numbers and dates let merge-base
+// walk history without reading commit objects (merge_base.cpp).
+//
+// Commits without a record are read from the object store, so the graph only
+// ever makes `log` and merge-base faster.
+
+const uint32_t COMMIT_GRAPH_HASHES = 7;
+const uint64_t COMMIT_GRAPH_BITS_PER_PATH = 10;  // about 1% false positives
+const size_t COMMIT_GRAPH_MAX_PATHS = 512;       // commits changing more paths match every query
+const uint32_t COMMIT_GRAPH_SCANS = 8;           // lookups find() answers by scanning before it indexes
+
+static string commitGraphPath(const string& git_dir) {
+    return git_dir + "/commit-graph";
+}
+
+static uint64_t mixBits(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// FNV-1a, so the filters stay valid across builds and platforms
+static uint64_t pathHash(string_view path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : path) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return mixBits(hash);
+}
+
+template <typename Visit>
+static void forEachPathBit(string_view path, uint64_t bits, Visit visit) {
+    uint64_t h1 = pathHash(path);
+    uint64_t h2 = mixBits(h1) | 1;
+    for (uint32_t i = 0; i < COMMIT_GRAPH_HASHES; ++i) {
+        visit((h1 + i * h2) % bits);
+    }
+}
+
+// "a/b/c" and the directories "a/b" and "a"
+template <typename Visit>
+static void forEachPathKey(string_view path, Visit visit) {
+    while (!path.empty()) {
+        visit(path);
+        size_t slash = path.rfind('/');
+        path = path.substr(0, slash == string_view::npos ? 0 : slash);
+    }
+}
+
+static string rawSha(const string& sha) {
+    return sha.empty() ? string(20, '\0') : BytesFromHexSha(sha);
+}
+
+static string hexSha(const unsigned char* raw) {
+    static const unsigned char zero[20] = {};
+    return memcmp(raw, zero, 20) == 0 ? "" : to_hex_string(raw, 20);
+}
+
+static ObjectLoader objectLoader(const string& git_dir) {
+    return [git_dir](const string& sha) { return make_shared<const string>(readObject(sha, git_dir)); };
+}
+
+CommitInfo readCommitInfo(const string& commitSHA, const string& git_dir) {
+    string object = readObject(commitSHA, git_dir);
+    if (!object.starts_with("commit ")) {
+        throw runtime_error(commitSHA + " is not a commit");
+    }
+    string_view body = string_view(object).substr(object.find('\0') + 1);
+    CommitInfo commit;
+    while (!body.empty() && body.front() != '\n') {
+        string_view line = body.substr(0, body.find('\n'));
+        if (line.starts_with("tree ")) {
+            commit.tree = string(line.substr(5));
+        } else if (line.starts_with("parent ")) {
+            commit.parents.emplace_back(line.substr(7));
+        } else if (line.starts_with("committer ")) {
+            // "committer <name> <<email>> <timestamp> <timezone>"
+            size_t email = line.rfind('>');
+            if (email != string_view::npos) {
+                commit.date = strtoll(string(line.substr(email + 1)).c_str(), nullptr, 10);
+            }
+        }
+        body.remove_prefix(min(body.size(), line.size() + 1));
+    }
+    return commit;
+}
+
+// One more than the highest parent, or infinite when a parent's is unknown
+static uint32_t generationAfter(const vector<uint32_t>& parentGenerations) {
+    uint32_t highest = 0;
+    for (uint32_t generation : parentGenerations) {
+        if (generation == GENERATION_INFINITY) {
+            return GENERATION_INFINITY;
+        }
+        highest = max(highest, generation);
+    }
+    return highest + 1;
+}
+
+static string buildRecord(const string& commitSHA, const CommitInfo& commit, const string& parentTreeSHA,
+                          const vector<CommitGraphParent>& parents, uint32_t generation, const string& git_dir) {
+    vector<string> changedPaths;
+    diffTrees(parentTreeSHA, commit.tree, objectLoader(git_dir),
+              [&](const mygit::TreeChange& change) { changedPaths.push_back(change.path); });
+
+    CommitGraphRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.commit, rawSha(commitSHA).data(), 20);
+    memcpy(record.tree, rawSha(commit.tree).data(), 20);
+    memcpy(record.parentTree, rawSha(parentTreeSHA).data(), 20);
+    record.generation = generation;
+    record.parentCount = static_cast<uint32_t>(parents.size());
+    record.date = commit.date;
+    vector<uint64_t> words;
+    if (changedPaths.size() > COMMIT_GRAPH_MAX_PATHS) {
+        record.flags = COMMIT_GRAPH_TOO_MANY_PATHS;
+    } else if (!changedPaths.empty()) {
+        // Paths sharing a directory add that directory once
+        vector<string_view> keys;
+        for (const string& path : changedPaths) {
+            forEachPathKey(path, [&](string_view key) { keys.push_back(key); });
+        }
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        words.resize((keys.size() * COMMIT_GRAPH_BITS_PER_PATH + 63) / 64);
+        for (string_view key : keys) {
+            forEachPathBit(key, words.size() * 64, [&](uint64_t bit) { words[bit / 64] |= 1ULL << (bit % 64); });
+        }
+    }
+    record.filterWords = static_cast<uint32_t>(words.size());
+
+    string bytes(reinterpret_cast<const char*>(&record), sizeof(record));
+    bytes.append(reinterpret_cast<const char*>(parents.data()), parents.size() * sizeof(CommitGraphParent));
+    bytes.append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+    return bytes;
+}
+
+static CommitGraphParent graphParent(const string& sha, uint32_t position) {
+    CommitGraphParent parent;
+    memcpy(parent.commit, BytesFromHexSha(sha).data(), 20);
+    parent.position = position;
+    return parent;
+}
+
+static string headerBytes() {
+    CommitGraphHeader header{};
+    memcpy(header.magic, COMMIT_GRAPH_MAGIC, 4);
+    header.version = COMMIT_GRAPH_VERSION;
+    header.hashes = COMMIT_GRAPH_HASHES;
+    return string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+static bool hasCurrentHeader(string_view data) {
+    CommitGraphHeader header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    return memcmp(header.magic, COMMIT_GRAPH_MAGIC, 4) == 0 && header.version == COMMIT_GRAPH_VERSION &&
+           header.hashes == COMMIT_GRAPH_HASHES;
+}
+
+// Written aside and renamed over the graph, so readers see the old or the new one
+static void replaceCommitGraph(const string& graph, const string& git_dir) {
+    string path = commitGraphPath(git_dir);
+    string tempPath = path + ".tmp." + to_string(getpid());
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Could not create " + tempPath);
+    }
+    bool written = write(fd, graph.data(), graph.size()) == static_cast<ssize_t>(graph.size());
+    close(fd);
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        throw runtime_error("Could not write " + path);
+    }
+}
+
+void recordCommit(const string& commitSHA, const CommitInfo& commit, const string& git_dir) {
+    CommitGraph graph(git_dir);
+    vector<CommitGraphParent> parents;
+    vector<uint32_t> parentGenerations;
+    for (const string& parent : commit.parents) {
+        uint32_t position = graph.find(BytesFromHexSha(parent));
+        parents.push_back(graphParent(parent, position));
+        parentGenerations.push_back(position == COMMIT_GRAPH_NO_POSITION ? GENERATION_INFINITY
+                                                                          : graph.record(position).generation);
+    }
+    string parentTree;
+    if (!parents.empty()) {
+        uint32_t position = parents.front().position;
+        parentTree = position != COMMIT_GRAPH_NO_POSITION ? hexSha(graph.record(position).tree)
+                                                          : commitTreeSHA(commit.parents.front(), git_dir);
+    }
+    string record = buildRecord(commitSHA, commit, parentTree, parents, generationAfter(parentGenerations), git_dir);
+
+    string path = commitGraphPath(git_dir);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Could not open " + path);
+    }
+    struct stat st;
+    char header[sizeof(CommitGraphHeader)];
+    bool current = fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(header)) &&
+                   pread(fd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                   hasCurrentHeader(string_view(header, sizeof(header)));
+    if (!current) {
+        // A new graph, or one in an older format: start over from this commit
+        close(fd);
+        replaceCommitGraph(headerBytes() + record, git_dir);
+        return;
+    }
+    // One write, so concurrent committers never interleave their records
+    bool written = write(fd, record.data(), record.size()) == static_cast<ssize_t>(record.size());
+    close(fd);
+    if (!written) {
+        throw runtime_error("Could not write " + path);
+    }
+}
+
+size_t writeCommitGraph(const string& git_dir) {
+    // Every commit reachable from a ref or HEAD, parents first: a commit is
+    // written when the depth-first walk comes back to it
+    vector<pair<string, bool>> stack;  // SHA, parents pushed
+    for (const auto& [name, sha] : listRefs(git_dir)) {
+        stack.emplace_back(sha, false);
+    }
+    string head = getHeadSHA(git_dir);
+    if (!head.empty()) {
+        stack.emplace_back(head, false);
+    }
+
+    unordered_map<string, uint32_t> positions;
+    unordered_map<string, CommitInfo> pending;
+    vector<uint32_t> generations;
+    vector<string> trees;
+    string graph = headerBytes();
+    while (!stack.empty()) {
+        auto [sha, expanded] = stack.back();
+        if (positions.contains(sha)) {
+            stack.pop_back();
+            continue;
+        }
+        if (!expanded) {
+            stack.back().second = true;
+            CommitInfo& commit = pending[sha] = readCommitInfo(sha, git_dir);
+            for (auto it = commit.parents.rbegin(); it != commit.parents.rend(); ++it) {
+                if (!positions.contains(*it)) {
+                    stack.emplace_back(*it, false);
+                }
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        CommitInfo commit = std::move(pending[sha]);
+        pending.erase(sha);
+        vector<CommitGraphParent> parents;
+        vector<uint32_t> parentGenerations;
+        for (const string& parent : commit.parents) {
+            uint32_t position = positions.at(parent);
+            parents.push_back(graphParent(parent, position));
+            parentGenerations.push_back(generations[position]);
+        }
+        uint32_t generation = generationAfter(parentGenerations);
+        string parentTree = parents.empty() ? "" : trees[parents.front().position];
+        graph += buildRecord(sha, commit, parentTree, parents, generation, git_dir);
+        positions[sha] = static_cast<uint32_t>(generations.size());
+        generations.push_back(generation);
+        trees.push_back(commit.tree);
+    }
+
+    replaceCommitGraph(graph, git_dir);
+    return generations.size();
+}
+
+CommitGraph::CommitGraph(const string& git_dir) {
+    string path = commitGraphPath(git_dir);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CommitGraphHeader))) {
+        close(fd);
+        return;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return;
+    }
+    data_ = static_cast<const char*>(mapped);
+    size_ = st.st_size;
+    if (!hasCurrentHeader(string_view(data_, size_))) {
+        return;
+    }
+    for (size_t offset = sizeof(CommitGraphHeader); offset + sizeof(CommitGraphRecord) <= size_;) {
+        const CommitGraphRecord& record = *reinterpret_cast<const CommitGraphRecord*>(data_ + offset);
+        size_t end = offset + sizeof(record) + size_t(record.parentCount) * sizeof(CommitGraphParent) +
+                     size_t(record.filterWords) * sizeof(uint64_t);
+        if (end > size_) {
+            break;  // cut short while being appended
+        }
+        offsets_.push_back(offset);
+        offset = end;
+    }
+}
+
+CommitGraph::~CommitGraph() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+uint32_t CommitGraph::find(string_view rawCommit) const {
+    if (!indexed_) {
+        // A walk looks up a couple of tips, and a new commit its parents:
+        // scanning beats hashing every record for those. The newest records
+        // are the likeliest, so they come first.
+        if (++scans_ <= COMMIT_GRAPH_SCANS) {
+            for (uint32_t position = size(); position > 0; --position) {
+                if (memcmp(record(position - 1).commit, rawCommit.data(), 20) == 0) {
+                    return position - 1;
+                }
+            }
+            return COMMIT_GRAPH_NO_POSITION;
+        }
+        positions_.reserve(size());
+        for (uint32_t position = 0; position < size(); ++position) {
+            positions_[string_view(reinterpret_cast<const char*>(record(position).commit), 20)] = position;
+        }
+        indexed_ = true;
+    }
+    auto it = positions_.find(rawCommit);
+    return it == positions_.end() ? COMMIT_GRAPH_NO_POSITION : it->second;
+}
+
+uint32_t CommitGraph::parentPosition(const CommitGraphParent& parent) const {
+    if (parent.position < size() && memcmp(record(parent.position).commit, parent.commit, 20) == 0) {
+        return parent.position;
+    }
+    return find(string_view(reinterpret_cast<const char*>(parent.commit), 20));
+}
+
+bool CommitGraph::mayHaveChanged(const CommitGraphRecord& record, string_view path) const {
+    if (record.flags & COMMIT_GRAPH_TOO_MANY_PATHS) {
+        return true;
+    }
+    if (record.filterWords == 0) {
+        return false;  // nothing changed
+    }
+    const char* words = reinterpret_cast<const char*>(parents(record) + record.parentCount);
+    uint64_t bits = uint64_t(record.filterWords) * 64;
+    bool present = true;
+    forEachPathKey(path, [&](string_view key) {
+        forEachPathBit(key, bits, [&](uint64_t bit) {
+            uint64_t word;
+            memcpy(&word, words + bit / 64 * sizeof(uint64_t), sizeof(word));
+            present = present && (word & (1ULL << (bit % 64)));
+        });
+    });
+    return present;
+}
+
+namespace {
+
+// Whether anything at or below path differs between the two trees, reading
+// only the trees along the path
+bool pathChanged(string oldTree, string newTree, string_view path, const ObjectLoader& load) {
+    auto lookup = [&](const string& tree, string_view name) -> pair<unsigned int, string> {
+        if (!tree.empty()) {
+            auto object = load(tree);
+            for (const TreeEntry& entry : TreeView::fromObject(*object)) {
+                if (entry.name == name) {
+                    return {entry.mode, entry.id.hex()};
+                }
+            }
+        }
+        return {0, ""};
+    };
+
+    while (true) {
+        if (oldTree == newTree) {
+            return false;
+        }
+        size_t slash = path.find('/');
+        string_view name = path.substr(0, slash);
+        auto [oldMode, oldId] = lookup(oldTree, name);
+        auto [newMode, newId] = lookup(newTree, name);
+        if (slash == string_view::npos) {
+            if (isTreeMode(oldMode) && isTreeMode(newMode)) {
+                // Differently sorted trees can hold the same files
+                bool changed = false;
+                diffTrees(oldId, newId, load, [&](const mygit::TreeChange&) { changed = true; });
+                return changed;
+            }
+            return oldMode != newMode || oldId != newId;
+        }
+        oldTree = isTreeMode(oldMode) ? oldId : "";
+        newTree = isTreeMode(newMode) ? newId : "";
+        path.remove_prefix(slash + 1);
+    }
+}
+
+} // namespace
+
+string filterLog(const string& log, const vector<string>& paths, const string& git_dir) {
+    vector<string> limits;
+    for (string path : paths) {
+        while (path.starts_with("./")) {
+            path.erase(0, 2);
+        }
+        while (!path.empty() && path.back() == '/') {
+            path.pop_back();
+        }
+        if (path.empty() || path == ".") {
+            return log;  // the whole tree
+        }
+        limits.push_back(path);
+    }
+
+    CommitGraph graph(git_dir);
+    ObjectLoader load = objectLoader(git_dir);
+    auto touches = [&](const string& commitSHA) {
+        uint32_t position = graph.find(BytesFromHexSha(commitSHA));
+        const CommitGraphRecord* record = position == COMMIT_GRAPH_NO_POSITION ? nullptr : &graph.record(position);
+        vector<const string*> candidates;
+        for (const string& limit : limits) {
+            if (!record || graph.mayHaveChanged(*record, limit)) {
+                candidates.push_back(&limit);
+            }
+        }
+        if (candidates.empty()) {
+            return false;
+        }
+
+        string tree, parentTree;
+        if (record) {
+            tree = hexSha(record->tree);
+            parentTree = hexSha(record->parentTree);
+        } else {
+            CommitInfo commit = readCommitInfo(commitSHA, git_dir);
+            tree = commit.tree;
+            parentTree = commit.parents.empty() ? "" : commitTreeSHA(commit.parents.front(), git_dir);
+        }
+        for (const string* limit : candidates) {
+            if (pathChanged(parentTree, tree, *limit, load)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Entries start at their "commit <sha>" line; message lines are indented
+    string filtered;
+    size_t start = 0;
+    while (start < log.size()) {
+        size_t next = log.find("\ncommit ", start);
+        next = next == string::npos ? log.size() : next + 1;
+        string_view entry = string_view(log).substr(start, next - start);
+        if (entry.starts_with("commit ") && entry.size() >= 47 && touches(string(entry.substr(7, 40)))) {
+            filtered.append(entry);
+        }
+        start = next;
+    }
+    return filtered;
+}
@@ -0,0 +1,96 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// The fields of a commit object the graph keeps (commit_graph.cpp)
+struct CommitInfo {
+    std::string tree;
+    std::vector<std::string> parents;
+    int64_t date = 0;              // committer timestamp
+};
+CommitInfo readCommitInfo(const std::string& commitSHA, const std::string& git_dir);
+// Append a new commit's record
+void recordCommit(const std::string& commitSHA, const CommitInfo& commit, const std::string& git_dir);
+
+// Commit graph in .git/commit-graph: a header, then one record per commit,
+// parents before their children. Records are appended as commits are made
+// and rebuilt by `commit-graph write`; a record cut short by a crash is
+// ignored.
+const char COMMIT_GRAPH_MAGIC[4] = {'M', 'G', 'C', 'G'};
+const uint32_t COMMIT_GRAPH_VERSION = 2;
+const uint32_t COMMIT_GRAPH_TOO_MANY_PATHS = 1;  // the filter matches every path
+const uint32_t COMMIT_GRAPH_NO_POSITION = UINT32_MAX;
+// Generation of commits whose ancestry the graph does not fully cover. It
+// sorts above every real generation, so walks stay correct, only slower.
+const uint32_t GENERATION_INFINITY = UINT32_MAX;
+
+struct CommitGraphHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t hashes;
+    uint32_t reserved;
+};
+
+// Followed by parentCount CommitGraphParents, then filterWords 64-bit words
+// of the changed-path Bloom filter against the first parent
+struct CommitGraphRecord {
+    unsigned char commit[20];
+    unsigned char tree[20];
+    unsigned char parentTree[20];  // all zero for a root commit
+    uint32_t flags;
+    uint32_t filterWords;
+    uint32_t generation;           // 1 for a root, else one more than the highest parent
+    uint32_t parentCount;
+    uint32_t reserved;
+    int64_t date;                  // committer timestamp
+};
+
+struct CommitGraphParent {
+    unsigned char commit[20];
+    uint32_t position;             // record index, or COMMIT_GRAPH_NO_POSITION
+};
+
+// Read-only view of the graph, memory mapped. Records are addressed by
+// position (their index in the file); opening only steps over the records
+// to find where each starts.
+class CommitGraph {
+public:
+    explicit CommitGraph(const std::string& git_dir);  // empty when missing or outdated
+    CommitGraph(const CommitGraph&) = delete;
+    CommitGraph& operator=(const CommitGraph&) = delete;
+    ~CommitGraph();
+
+    uint32_t size() const { return static_cast<uint32_t>(offsets_.size()); }
+    const CommitGraphRecord& record(uint32_t position) const {
+        return *reinterpret_cast<const CommitGraphRecord*>(data_ + offsets_[position]);
+    }
+    const CommitGraphParent* parents(const CommitGraphRecord& record) const {
+        return reinterpret_cast<const CommitGraphParent*>(&record + 1);
+    }
+    // Position of a raw 20-byte SHA, or COMMIT_GRAPH_NO_POSITION. The first
+    // few lookups scan the records, newest first; later ones go through a
+    // hash index built on demand.
+    uint32_t find(std::string_view rawCommit) const;
+    // A parent's position, checked against its SHA in case the graph was
+    // rewritten after the child's record was appended
+    uint32_t parentPosition(const CommitGraphParent& parent) const;
+
+    // False when the commit certainly did not change path or anything below it
+    bool mayHaveChanged(const CommitGraphRecord& record, std::string_view path) const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<size_t> offsets_;
+    mutable uint32_t scans_ = 0;
+    mutable bool indexed_ = false;
+    mutable std::unordered_map<std::string_view, uint32_t> positions_;  // raw SHA -> position
+};
+
+#endif // COMMIT_GRAPH_H
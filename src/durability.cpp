@@ -0,0 +1,167 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "headers.h"
+using namespace std;
+
+// core.durability decides what a crash or power loss can do to the store:
+//
+//   off    Nothing is synced (the default). Objects are created in place
+//          with O_EXCL; a crash can leave them, the index and refs
+//          truncated.
+//   batch  Objects are written under a temporary name. Before the index or
+//          a ref is pointed at them, one syncfs() makes all of them durable,
+//          they are renamed into place, and a second syncfs() makes the
+//          renames durable. The index and refs are replaced through a lock
+//          file that is fsynced before the rename.
+//   each   Like batch, but every object is fsynced and renamed into place
+//          on its own as it is written. Much slower; kept for comparison.
+//
+// In batch and each, an object only ever appears under its final name with
+// its full content, so existence checks never mistake a torn write for a
+// stored object. In every mode an object file is never opened for writing
+// once it exists: clone --local hard links them, and rewriting one (after
+// the object filter missed it, say) would reach into the other repository.
+
+const char OBJECT_TEMP_SUFFIX[] = ".tmp";
+
+Durability parseDurability(const string& name) {
+    if (name == "off") return Durability::Off;
+    if (name == "batch") return Durability::Batch;
+    if (name == "each") return Durability::Each;
+    throw invalid_argument("Invalid core.durability: " + name + " (expected off, batch or each)");
+}
+
+Durability durabilityMode(const string& git_dir) {
+    return parseDurability(getConfigValue(git_dir, "core.durability", "off"));
+}
+
+void syncFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        int error = errno;
+        if (fd >= 0) close(fd);
+        throw runtime_error("Could not sync " + path + ": " + strerror(error));
+    }
+    close(fd);
+}
+
+void syncDirectory(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        int error = errno;
+        if (fd >= 0) close(fd);
+        throw runtime_error("Could not sync directory " + path + ": " + strerror(error));
+    }
+    close(fd);
+}
+
+static string parentDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+}
+
+static void syncFilesystem(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || syncfs(fd) != 0) {
+        int error = errno;
+        if (fd >= 0) close(fd);
+        throw runtime_error("Could not sync the file system of " + path + ": " + strerror(error));
+    }
+    close(fd);
+}
+
+// Objects of the current operation still under their temporary name, per
+// repository; serve mode runs operations on many threads
+static mutex pendingObjectsMutex;
+static map<string, vector<string>> pendingObjects;
+
+string objectWritePath(const string& objectPath, Durability mode) {
+    return mode == Durability::Off ? objectPath : objectPath + OBJECT_TEMP_SUFFIX;
+}
+
+void objectWritten(const string& objectPath, const string& git_dir, Durability mode) {
+    if (mode == Durability::Each) {
+        string tempPath = objectPath + OBJECT_TEMP_SUFFIX;
+        syncFile(tempPath);
+        if (rename(tempPath.c_str(), objectPath.c_str()) != 0) {
+            throw runtime_error("Could not rename " + tempPath + ": " + strerror(errno));
+        }
+        syncDirectory(parentDirectory(objectPath));
+    } else if (mode == Durability::Batch) {
+        lock_guard<mutex> lock(pendingObjectsMutex);
+        pendingObjects[git_dir].push_back(objectPath);
+    }
+}
+
+void syncObjects(const string& git_dir) {
+    vector<string> pending;
+    {
+        lock_guard<mutex> lock(pendingObjectsMutex);
+        auto it = pendingObjects.find(git_dir);
+        if (it == pendingObjects.end()) {
+            return;
+        }
+        pending = std::move(it->second);
+        pendingObjects.erase(it);
+    }
+    if (pending.empty()) {
+        return;
+    }
+
+    string objectsDir = git_dir + "/objects";
+    syncFilesystem(objectsDir);
+    for (const auto& objectPath : pending) {
+        string tempPath = objectPath + OBJECT_TEMP_SUFFIX;
+        // ENOENT: the same object was written twice and is already in place
+        if (rename(tempPath.c_str(), objectPath.c_str()) != 0 && errno != ENOENT) {
+            throw runtime_error("Could not rename " + tempPath + ": " + strerror(errno));
+        }
+    }
+    syncFilesystem(objectsDir);
+}
+
+LockFile::LockFile(const string& path, bool durable)
+    : path_(path), lockPath_(path + ".lock"), durable_(durable) {
+    fd_ = ::open(lockPath_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw runtime_error("Unable to create '" + lockPath_ + "': " + strerror(errno) +
+                            ". Another process may be updating it; if not, remove the file.");
+    }
+}
+
+LockFile::~LockFile() {
+    if (fd_ >= 0) {
+        close(fd_);
+        unlink(lockPath_.c_str());
+    }
+}
+
+void LockFile::commit(const string& content) {
+    for (size_t written = 0; written < content.size();) {
+        ssize_t n = write(fd_, content.data() + written, content.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("Could not write " + lockPath_ + ": " + strerror(errno));
+        }
+        written += n;
+    }
+    if (durable_ && fsync(fd_) != 0) {
+        throw runtime_error("Could not sync " + lockPath_ + ": " + strerror(errno));
+    }
+    close(fd_);
+    fd_ = -1;
+    if (rename(lockPath_.c_str(), path_.c_str()) != 0) {
+        int error = errno;
+        unlink(lockPath_.c_str());
+        throw runtime_error("Could not replace " + path_ + ": " + strerror(error));
+    }
+    if (durable_) {
+        syncDirectory(parentDirectory(path_));
+    }
+}
@@ -0,0 +1,186 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "headers.h"
+#include "tree_view.h"
+using namespace std;
+
+static bool isHexDigits(string_view value) {
+    return all_of(value.begin(), value.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+static bool isDecimalDigits(string_view value) {
+    return all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Structural checks for one inflated object; throws with the reason
+static void checkObjectStructure(const string& object) {
+    size_t nul = object.find('\0');
+    size_t space = object.find(' ');
+    if (nul == string::npos || space == string::npos || space > nul) {
+        throw runtime_error("malformed header");
+    }
+    string_view type = string_view(object).substr(0, space);
+    string_view size = string_view(object).substr(space + 1, nul - space - 1);
+    string_view body = string_view(object).substr(nul + 1);
+    if (size.empty() || !isDecimalDigits(size) || stoull(string(size)) != body.size()) {
+        throw runtime_error("size in header does not match content");
+    }
+
+    if (type == "tree") {
+        string_view previous;
+        for (const TreeEntry& entry : TreeView(body)) {
+            if (entry.name.empty() || entry.name == "." || entry.name == ".." ||
+                entry.name.find('/') != string_view::npos) {
+                throw runtime_error("bad entry name '" + string(entry.name) + "'");
+            }
+            if (!isTreeMode(entry.mode) && !isBlobMode(entry.mode) && (entry.mode & FILE_MODE_MASK) != GITLINK_MODE) {
+                throw runtime_error("bad mode for '" + string(entry.name) + "'");
+            }
+            if (entry.name == previous) {
+                throw runtime_error("duplicate entry '" + string(entry.name) + "'");
+            }
+            previous = entry.name;
+        }
+    } else if (type == "commit") {
+        size_t pos = 0;
+        bool sawTree = false, sawAuthor = false, sawCommitter = false;
+        while (pos < body.size()) {
+            size_t end = body.find('\n', pos);
+            string_view line = body.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+            if (line.empty()) {
+                break;
+            }
+            if (line.substr(0, 5) == "tree ") {
+                if (sawTree || pos != 0 || line.size() != 45 || !isHexDigits(line.substr(5))) {
+                    throw runtime_error("bad tree line");
+                }
+                sawTree = true;
+            } else if (line.substr(0, 7) == "parent ") {
+                if (!sawTree || line.size() != 47 || !isHexDigits(line.substr(7))) {
+                    throw runtime_error("bad parent line");
+                }
+            } else if (line.substr(0, 7) == "author ") {
+                sawAuthor = true;
+            } else if (line.substr(0, 10) == "committer ") {
+                sawCommitter = true;
+            }
+            if (end == string_view::npos) break;
+            pos = end + 1;
+        }
+        if (!sawTree || !sawAuthor || !sawCommitter) {
+            throw runtime_error("missing tree, author or committer");
+        }
+    } else if (type == "chunked") {
+        size_t pos = 0;
+        while (pos < body.size()) {
+            size_t end = body.find('\n', pos);
+            if (end == string_view::npos) {
+                throw runtime_error("unterminated chunk line");
+            }
+            string_view line = body.substr(pos, end - pos);
+            if (line.size() < 42 || line[40] != ' ' || !isHexDigits(line.substr(0, 40)) ||
+                !isDecimalDigits(line.substr(41))) {
+                throw runtime_error("bad chunk line");
+            }
+            pos = end + 1;
+        }
+    } else if (type != "blob") {
+        throw runtime_error("unknown type '" + string(type) + "'");
+    }
+}
+
+// Re-inflate every loose object on a pool of threads, check that it hashes
+// to its name and is well formed, and that everything it references and
+// every root (refs, HEAD, index) exists. Workers take objects in batches from
+// a shared counter; progress is reported from the calling thread.
+mygit::FsckResult fsckObjects(const string& git_dir, const function<void(size_t, size_t)>& progress) {
+    vector<string> objects = listLooseObjects(git_dir);
+    vector<atomic<uint64_t>> referenced((objects.size() + 63) / 64);
+    auto indexOf = [&](const string& sha) -> ptrdiff_t {
+        string raw = BytesFromHexSha(sha);
+        auto it = lower_bound(objects.begin(), objects.end(), raw);
+        return it != objects.end() && *it == raw ? it - objects.begin() : -1;
+    };
+
+    mygit::FsckResult result;
+    result.objects = objects.size();
+    mutex resultMutex;
+    const size_t BATCH = 256;
+    atomic<size_t> nextObject{0};
+    atomic<size_t> checked{0};
+
+    auto work = [&] {
+        vector<string> problems;
+        for (size_t start; (start = nextObject.fetch_add(BATCH)) < objects.size();) {
+            for (size_t i = start; i < min(start + BATCH, objects.size()); ++i) {
+                string sha = to_hex_string(reinterpret_cast<const unsigned char*>(objects[i].data()), 20);
+                try {
+                    size_t trailing = 0;
+                    string object = decompressContent(readFile(getFilePathFromSHA(sha, git_dir)), &trailing);
+                    if (trailing) {
+                        problems.push_back("error: garbage at end of loose object " + sha);
+                    }
+                    if (ComputeShaHash(object) != objects[i]) {
+                        problems.push_back("error: sha1 mismatch for " + getFilePathFromSHA(sha, git_dir));
+                        continue;
+                    }
+                    checkObjectStructure(object);
+                    string type = object.substr(0, object.find(' '));
+                    for (const auto& reference : referencedObjects(object)) {
+                        ptrdiff_t index = indexOf(reference);
+                        if (index < 0) {
+                            problems.push_back("broken link from " + type + " " + sha + " to " + reference);
+                        } else {
+                            referenced[index / 64].fetch_or(1ULL << (index % 64), memory_order_relaxed);
+                        }
+                    }
+                } catch (const exception& e) {
+                    problems.push_back("error: " + sha + ": corrupt object (" + e.what() + ")");
+                }
+            }
+            checked.fetch_add(min(start + BATCH, objects.size()) - start);
+        }
+        lock_guard<mutex> lock(resultMutex);
+        result.problems.insert(result.problems.end(), problems.begin(), problems.end());
+    };
+
+    vector<thread> workers;
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back(work);
+    }
+    if (progress) {
+        while (checked < objects.size()) {
+            progress(checked, objects.size());
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+        progress(objects.size(), objects.size());
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    vector<bool> isRoot(objects.size());
+    for (const auto& root : reachabilityRoots(git_dir)) {
+        ptrdiff_t index = indexOf(root);
+        if (index < 0) {
+            result.problems.push_back("missing object " + root + " (named by a ref, HEAD or the index)");
+        } else {
+            isRoot[index] = true;
+        }
+    }
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (!isRoot[i] && !(referenced[i / 64].load(memory_order_relaxed) & (1ULL << (i % 64)))) {
+            ++result.dangling;
+        }
+    }
+    sort(result.problems.begin(), result.problems.end());
+    return result;
+}
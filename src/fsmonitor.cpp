@@ -0,0 +1,458 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <ctime>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// The daemon lives next to the repository it watches and runs with the
+// worktree root as its current directory, so its own paths are relative.
+const string FSMONITOR_SOCKET = ".git/fsmonitor.sock";
+const string FSMONITOR_TOKEN = ".git/fsmonitor-token";
+
+// Beyond this many remembered paths the older half is forgotten, and tokens
+// from before it get a full-scan reply
+const size_t MAX_CHANGED_PATHS = 100000;
+
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_EXCL_UNLINK;
+
+struct FsmonitorState {
+    int inotifyFd = -1;
+    map<int, string> watchDirs;      // watch descriptor -> directory ("" is the root)
+    map<string, uint64_t> changed;   // path -> sequence number of its last change
+    uint64_t seq = 0;                // bumped on every event
+    uint64_t floor = 0;              // tokens older than this need a full scan
+    string instance;                 // tokens from another daemon are never trusted
+};
+
+// Forget every change at or below newFloor. Tokens older than the floor are
+// answered with "full", so nothing they would need is lost.
+static void raiseFloor(FsmonitorState& state, uint64_t newFloor) {
+    state.floor = max(state.floor, newFloor);
+    erase_if(state.changed, [&](const auto& change) { return change.second <= state.floor; });
+}
+
+static void pruneChanged(FsmonitorState& state) {
+    if (state.changed.size() <= MAX_CHANGED_PATHS) {
+        return;
+    }
+    vector<uint64_t> sequences;
+    sequences.reserve(state.changed.size());
+    for (const auto& [path, changedAt] : state.changed) {
+        sequences.push_back(changedAt);
+    }
+    auto middle = sequences.begin() + sequences.size() / 2;
+    nth_element(sequences.begin(), middle, sequences.end());
+    raiseFloor(state, *middle);
+}
+
+static bool isIgnoredName(const string& name) {
+    return name == ".git" || name == "build" || name == "vcpkg";
+}
+
+static void addWatchRecursive(FsmonitorState& state, const string& dir) {
+    string target = dir.empty() ? "." : dir;
+    int wd = inotify_add_watch(state.inotifyFd, target.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        return;
+    }
+    state.watchDirs[wd] = dir;
+
+    error_code ec;
+    for (const auto& entry : fs::directory_iterator(target, fs::directory_options::skip_permission_denied, ec)) {
+        if (!entry.is_directory(ec) || entry.is_symlink(ec)) {
+            continue;
+        }
+        string name = entry.path().filename().string();
+        if (isIgnoredName(name)) {
+            continue;
+        }
+        addWatchRecursive(state, dir.empty() ? name : dir + "/" + name);
+    }
+}
+
+static void removeWatchesUnder(FsmonitorState& state, const string& dir) {
+    for (auto it = state.watchDirs.begin(); it != state.watchDirs.end();) {
+        if (it->second == dir || it->second.rfind(dir + "/", 0) == 0) {
+            inotify_rm_watch(state.inotifyFd, it->first);
+            it = state.watchDirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Drain every queued inotify event into the changed-path table.
+static void drainEvents(FsmonitorState& state) {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (true) {
+        ssize_t len = read(state.inotifyFd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            pruneChanged(state);
+            return;
+        }
+        for (char* ptr = buffer; ptr < buffer + len;) {
+            auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; nobody can trust a token issued before now
+                raiseFloor(state, ++state.seq);
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                state.watchDirs.erase(event->wd);
+                continue;
+            }
+
+            auto dirIt = state.watchDirs.find(event->wd);
+            if (dirIt == state.watchDirs.end() || event->len == 0) {
+                continue;
+            }
+            string name = event->name;
+            if (isIgnoredName(name)) {
+                continue;
+            }
+            string path = dirIt->second.empty() ? name : dirIt->second + "/" + name;
+            state.changed[path] = ++state.seq;
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    addWatchRecursive(state, path);
+                } else if (event->mask & IN_MOVED_FROM) {
+                    removeWatchesUnder(state, path);
+                }
+            }
+        }
+    }
+}
+
+static string currentToken(const FsmonitorState& state) {
+    return state.instance + ":" + to_string(state.seq);
+}
+
+static string answerRequest(FsmonitorState& state, const string& request, bool& quit) {
+    if (request == "quit") {
+        quit = true;
+        return "bye\n";
+    }
+    if (request == "ping") {
+        return "ok " + currentToken(state) + "\n";
+    }
+    if (request.rfind("query ", 0) != 0) {
+        return "error unknown request\n";
+    }
+
+    string token = request.substr(6);
+    size_t colon = token.rfind(':');
+    bool trusted = false;
+    uint64_t since = 0;
+    if (colon != string::npos && token.substr(0, colon) == state.instance) {
+        try {
+            since = stoull(token.substr(colon + 1));
+            trusted = since >= state.floor && since <= state.seq;
+        } catch (const exception&) {
+            trusted = false;
+        }
+    }
+    if (!trusted) {
+        return "full " + currentToken(state) + "\n";
+    }
+
+    string reply = "ok " + currentToken(state) + "\n";
+    for (const auto& [path, changedAt] : state.changed) {
+        if (changedAt > since) {
+            reply += path + "\n";
+        }
+    }
+    return reply;
+}
+
+// A connected client: the request line read so far, then the reply still
+// to be sent
+struct FsmonitorClient {
+    string request;
+    string reply;
+    size_t sent = 0;
+};
+
+// Longer requests are answered as they are; no valid one comes close
+const size_t MAX_REQUEST_SIZE = 4096;
+
+// Read what the client sent, or send more of its reply; every request gets
+// its reply once the newline (or end of input) arrives. Returns true when the
+// connection is done with.
+static bool serveClient(FsmonitorState& state, int clientFd, FsmonitorClient& client, bool& quit) {
+    if (client.reply.empty()) {
+        char buffer[4096];
+        ssize_t n = recv(clientFd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            return errno != EAGAIN && errno != EINTR;
+        }
+        client.request.append(buffer, n);
+        size_t newline = client.request.find('\n');
+        if (newline != string::npos) {
+            client.request.resize(newline);
+        } else if (n > 0 && client.request.size() < MAX_REQUEST_SIZE) {
+            return false;
+        } else if (client.request.empty()) {
+            return true;  // hung up without asking anything
+        }
+
+        // Changes made right before the request must be part of the answer
+        drainEvents(state);
+        client.reply = answerRequest(state, client.request, quit);
+    }
+
+    while (client.sent < client.reply.size()) {
+        ssize_t n = send(clientFd, client.reply.data() + client.sent, client.reply.size() - client.sent,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN && !quit) return false;  // wait for POLLOUT
+        if (n <= 0) return true;
+        client.sent += n;
+    }
+    return true;
+}
+
+static void runFsmonitorDaemon(int readyFd) {
+    FsmonitorState state;
+    state.instance = to_string(getpid()) + "." + to_string(time(nullptr));
+    state.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.inotifyFd < 0) {
+        _exit(1);
+    }
+    addWatchRecursive(state, "");
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, FSMONITOR_SOCKET.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(FSMONITOR_SOCKET.c_str());
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listenFd, 16) < 0) {
+        _exit(1);
+    }
+
+    // Only report readiness once every directory is watched
+    char ready = 1;
+    ssize_t ignored = write(readyFd, &ready, 1);
+    (void)ignored;
+    close(readyFd);
+
+    // Clients are served from the same loop that drains inotify, so a client
+    // that connects and says nothing holds up neither other clients nor the
+    // event queue
+    map<int, FsmonitorClient> clients;
+    vector<pollfd> fds;
+    bool quit = false;
+    while (!quit) {
+        fds.assign({{state.inotifyFd, POLLIN, 0}, {listenFd, POLLIN, 0}});
+        for (const auto& [clientFd, client] : clients) {
+            fds.push_back({clientFd, static_cast<short>(client.reply.empty() ? POLLIN : POLLOUT), 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            drainEvents(state);
+        }
+        for (size_t i = 2; i < fds.size() && !quit; ++i) {
+            if (!fds[i].revents) continue;
+            int clientFd = fds[i].fd;
+            if (serveClient(state, clientFd, clients.at(clientFd), quit)) {
+                close(clientFd);
+                clients.erase(clientFd);
+            }
+        }
+        if (!quit && (fds[1].revents & POLLIN)) {
+            int clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (clientFd >= 0) {
+                clients.emplace(clientFd, FsmonitorClient{});
+            }
+        }
+    }
+
+    for (const auto& [clientFd, client] : clients) {
+        close(clientFd);
+    }
+    close(listenFd);
+    unlink(FSMONITOR_SOCKET.c_str());
+    close(state.inotifyFd);
+    _exit(0);
+}
+
+// Send one request line to the daemon and return its full reply. An empty
+// string means the daemon is not reachable.
+static string fsmonitorRequest(const fs::path& root, const string& request) {
+    string socketPath = (root / FSMONITOR_SOCKET).string();
+    sockaddr_un addr{};
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        // Too long for a socket address; behave as if no daemon is running
+        return "";
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return "";
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return "";
+    }
+
+    timeval timeout{2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    string line = request + "\n";
+    if (write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+        close(fd);
+        return "";
+    }
+
+    string reply;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        reply.append(buffer, n);
+    }
+    close(fd);
+    return reply;
+}
+
+bool fsmonitorQuery(const fs::path& root, const string& sinceToken, string& newToken,
+                    vector<string>& changedPaths) {
+    newToken.clear();
+    changedPaths.clear();
+
+    string reply = fsmonitorRequest(root, "query " + (sinceToken.empty() ? string("none") : sinceToken));
+    istringstream stream(reply);
+    string status;
+    if (!(stream >> status >> newToken)) {
+        newToken.clear();
+        return false;
+    }
+    if (status != "ok") {
+        // The daemon is up but cannot vouch for this token; caller does a full scan
+        return false;
+    }
+
+    string path;
+    getline(stream, path);  // Rest of the status line
+    while (getline(stream, path)) {
+        if (!path.empty()) {
+            changedPaths.push_back(path);
+        }
+    }
+    return true;
+}
+
+string readFsmonitorToken(const fs::path& root) {
+    ifstream file(root / FSMONITOR_TOKEN);
+    string token;
+    if (file.is_open()) {
+        getline(file, token);
+    }
+    return token;
+}
+
+void writeFsmonitorToken(const fs::path& root, const string& token) {
+    if (token.empty()) {
+        return;
+    }
+    ofstream file(root / FSMONITOR_TOKEN, ios::trunc);
+    file << token << "\n";
+}
+
+bool isPathDirty(const set<string>& dirtyPaths, const string& path) {
+    // A path is dirty if it, or any directory containing it, changed
+    string current = path;
+    while (!current.empty()) {
+        if (dirtyPaths.count(current)) {
+            return true;
+        }
+        size_t slash = current.rfind('/');
+        if (slash == string::npos) {
+            break;
+        }
+        current.resize(slash);
+    }
+    return false;
+}
+
+string fsmonitorPing(const fs::path& root) {
+    string reply = fsmonitorRequest(root, "ping");
+    if (reply.rfind("ok ", 0) != 0) {
+        return "";
+    }
+    string token = reply.substr(3);
+    while (!token.empty() && token.back() == '\n') token.pop_back();
+    return token;
+}
+
+bool fsmonitorStop(const fs::path& root) {
+    return !fsmonitorRequest(root, "quit").empty();
+}
+
+// Returns false if a daemon was already running for this worktree
+bool fsmonitorStart(const fs::path& root) {
+    if (!fs::exists(root / ".git")) {
+        throw runtime_error("Not a git repository: " + root.string());
+    }
+    if (!fsmonitorPing(root).empty()) {
+        return false;
+    }
+
+    int readyPipe[2];
+    if (pipe(readyPipe) < 0) {
+        throw runtime_error("Failed to create pipe for fsmonitor.");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw runtime_error("Failed to fork fsmonitor daemon.");
+    }
+    if (pid == 0) {
+        // Detach twice so the daemon is reparented and has no terminal
+        close(readyPipe[0]);
+        setsid();
+        if (fork() != 0) {
+            _exit(0);
+        }
+        if (chdir(root.c_str()) < 0) {
+            _exit(1);
+        }
+        int devNull = open("/dev/null", O_RDWR);
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        runFsmonitorDaemon(readyPipe[1]);
+    }
+
+    close(readyPipe[1]);
+    char ready = 0;
+    ssize_t n = read(readyPipe[0], &ready, 1);
+    close(readyPipe[0]);
+    if (n != 1) {
+        throw runtime_error("fsmonitor daemon failed to start.");
+    }
+    // Any token from a previous daemon is useless now
+    fs::remove(root / FSMONITOR_TOKEN);
+    return true;
+}
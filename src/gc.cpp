@@ -0,0 +1,313 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <ctime>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "headers.h"
+#include "tree_view.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+static bool isHexSha(const string& value) {
+    return value.size() == 40 && all_of(value.begin(), value.end(), [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    });
+}
+
+static string firstLine(const fs::path& path) {
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+// Everything that keeps objects alive: HEAD, every ref (loose or packed), the
+// index, and the commits listed in the logs (so `log` never points at a
+// pruned commit)
+vector<string> reachabilityRoots(const string& git_dir) {
+    set<string> roots;
+    string head = firstLine(fs::path(git_dir) / "HEAD");
+    if (isHexSha(head)) {
+        roots.insert(head);
+    }
+
+    error_code ec;
+    for (fs::recursive_directory_iterator it(fs::path(git_dir) / "refs", ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file()) {
+            string sha = firstLine(it->path());
+            if (isHexSha(sha)) {
+                roots.insert(sha);
+            }
+        }
+    }
+
+    ifstream packedRefs(fs::path(git_dir) / "packed-refs");
+    string line;
+    while (getline(packedRefs, line)) {
+        // "<sha> <ref>", or "^<sha>" for the commit an annotated tag peels to
+        string sha = line.substr(line[0] == '^' ? 1 : 0, 40);
+        if (isHexSha(sha)) {
+            roots.insert(sha);
+        }
+    }
+
+    for (const auto& [path, sha] : readIndex(git_dir + "/index")) {
+        if (isHexSha(sha)) {
+            roots.insert(sha);
+        }
+    }
+
+    for (fs::recursive_directory_iterator it(fs::path(git_dir) / "logs", ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file()) {
+            continue;
+        }
+        ifstream log(it->path());
+        string line;
+        while (getline(log, line)) {
+            if (line.compare(0, 7, "commit ") == 0 && line.size() >= 47 && isHexSha(line.substr(7, 40))) {
+                roots.insert(line.substr(7, 40));
+            }
+        }
+    }
+    return vector<string>(roots.begin(), roots.end());
+}
+
+// SHAs an object points at: a commit's tree and parents, a tree's entries
+// (submodule commits excepted) and a chunked file's chunks. With fileEntries,
+// the SHAs that a tree lists as files go there instead of into the result.
+vector<string> referencedObjects(const string& object, vector<string>* fileEntries) {
+    vector<string> references;
+    size_t nul = object.find('\0');
+    if (nul == string::npos) {
+        throw runtime_error("Malformed object header");
+    }
+    string_view type = string_view(object).substr(0, object.find(' '));
+    string_view body = string_view(object).substr(nul + 1);
+
+    if (type == "commit") {
+        istringstream lines{string(body)};
+        string line;
+        while (getline(lines, line) && !line.empty()) {
+            if (line.compare(0, 5, "tree ") == 0) {
+                references.push_back(line.substr(5));
+            } else if (line.compare(0, 7, "parent ") == 0) {
+                references.push_back(line.substr(7));
+            }
+        }
+    } else if (type == "tree") {
+        for (const TreeEntry& entry : TreeView(body)) {
+            if (fileEntries && isBlobMode(entry.mode)) {
+                fileEntries->push_back(entry.id.hex());
+            } else if ((entry.mode & FILE_MODE_MASK) != GITLINK_MODE) {
+                references.push_back(entry.id.hex());
+            }
+        }
+    } else if (type == "chunked") {
+        istringstream lines{string(body)};
+        string sha;
+        size_t length;
+        while (lines >> sha >> length) {
+            references.push_back(sha);
+        }
+    }
+    return references;
+}
+
+// Parallel mark phase over the loose objects (sorted raw SHAs, as returned by
+// listLooseObjects). The visited set is one bit per object, indexed by the
+// object's position in that list and claimed with an atomic OR, so each
+// object is read exactly once. Tree entries with a file mode are almost
+// always plain blobs, so only their header is inflated to rule out chunked
+// files. Referenced objects that are not in the list are collected in missing.
+vector<bool> markReachable(const string& git_dir, const vector<string>& objects, const vector<string>& roots,
+                           vector<string>* missing) {
+    vector<atomic<uint64_t>> visited((objects.size() + 63) / 64);
+    mutex queueMutex;
+    condition_variable queueReady;
+    deque<pair<string, bool>> queue;  // SHA, and whether a tree listed it as a file
+    size_t active = 0;
+    exception_ptr failure;
+    set<string> missingObjects;
+
+    // Claims the object for this traversal; false when absent or already claimed
+    auto claim = [&](const string& sha) {
+        string raw = BytesFromHexSha(sha);
+        auto it = lower_bound(objects.begin(), objects.end(), raw);
+        if (it == objects.end() || *it != raw) {
+            lock_guard<mutex> lock(queueMutex);
+            missingObjects.insert(sha);
+            return false;
+        }
+        size_t index = it - objects.begin();
+        uint64_t bit = 1ULL << (index % 64);
+        return (visited[index / 64].fetch_or(bit, memory_order_relaxed) & bit) == 0;
+    };
+
+    for (const auto& root : roots) {
+        if (claim(root)) {
+            queue.emplace_back(root, false);
+        }
+    }
+
+    auto work = [&] {
+        unique_lock<mutex> lock(queueMutex);
+        while (true) {
+            queueReady.wait(lock, [&] { return failure || !queue.empty() || active == 0; });
+            if (failure || queue.empty()) {
+                return;
+            }
+            auto [sha, listedAsFile] = std::move(queue.front());
+            queue.pop_front();
+            ++active;
+            lock.unlock();
+
+            vector<pair<string, bool>> next;
+            try {
+                if (!listedAsFile || readObjectType(sha, git_dir) != "blob") {
+                    vector<string> fileEntries;
+                    for (const auto& reference : referencedObjects(readObject(sha, git_dir), &fileEntries)) {
+                        if (claim(reference)) {
+                            next.emplace_back(reference, false);
+                        }
+                    }
+                    for (const auto& fileEntry : fileEntries) {
+                        if (claim(fileEntry)) {
+                            next.emplace_back(fileEntry, true);
+                        }
+                    }
+                }
+            } catch (const exception& e) {
+                lock.lock();
+                failure = make_exception_ptr(runtime_error("Cannot read object " + sha + ": " + e.what()));
+                --active;
+                queueReady.notify_all();
+                return;
+            }
+
+            lock.lock();
+            --active;
+            queue.insert(queue.end(), make_move_iterator(next.begin()), make_move_iterator(next.end()));
+            queueReady.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    size_t threadCount = clamp<size_t>(thread::hardware_concurrency(), 4, 16);
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back(work);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (failure) {
+        rethrow_exception(failure);
+    }
+
+    if (missing) {
+        missing->assign(missingObjects.begin(), missingObjects.end());
+    }
+    vector<bool> reachable(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+        reachable[i] = visited[i / 64].load(memory_order_relaxed) & (1ULL << (i % 64));
+    }
+    return reachable;
+}
+
+// Seconds from an age such as "now", "never", "3600", "90m", "12h" or "14d"
+long parseExpiry(const string& age) {
+    if (age == "now") {
+        return 0;
+    }
+    if (age == "never") {
+        return -1;
+    }
+    long multiplier = 1;
+    string number = age;
+    if (!number.empty()) {
+        switch (number.back()) {
+            case 's': multiplier = 1; break;
+            case 'm': multiplier = 60; break;
+            case 'h': multiplier = 3600; break;
+            case 'd': multiplier = 86400; break;
+            case 'w': multiplier = 7 * 86400; break;
+            default: multiplier = 0;
+        }
+        if (multiplier) number.pop_back();
+        else multiplier = 1;
+    }
+    try {
+        size_t used;
+        long value = stol(number, &used);
+        if (used == number.size() && value >= 0) {
+            return value * multiplier;
+        }
+    } catch (const exception&) {
+    }
+    throw invalid_argument("Invalid expiry: " + age);
+}
+
+// Delete unreachable loose objects last modified more than expireSeconds
+// ago (-1 keeps them all). The grace period protects objects written by an
+// `add` that is still running; writers that find an object already stored
+// refresh its modification time (freshenObject), so that covers old objects
+// they are about to reference too. Nothing is deleted if any reachable
+// object cannot be read.
+mygit::GcResult collectGarbage(const string& git_dir, long expireSeconds) {
+    vector<string> objects = listLooseObjects(git_dir);
+    vector<string> missing;
+    vector<bool> reachable = markReachable(git_dir, objects, reachabilityRoots(git_dir), &missing);
+    if (!missing.empty()) {
+        // Packed by another tool, or lost: what they reference was never
+        // marked, so pruning now could delete live objects
+        throw runtime_error("Refusing to prune: " + to_string(missing.size()) +
+                            " referenced objects are not loose objects, e.g. " + missing.front());
+    }
+
+    mygit::GcResult result;
+    time_t cutoff = time(nullptr) - expireSeconds;
+    if (expireSeconds >= 0) {
+        // Objects a durable write never published because the operation died
+        // before syncing them
+        error_code ec;
+        for (fs::recursive_directory_iterator it(fs::path(git_dir) / "objects", ec), end; !ec && it != end;
+             it.increment(ec)) {
+            struct stat st;
+            if (it->path().extension() == ".tmp" && stat(it->path().c_str(), &st) == 0 && st.st_mtime <= cutoff &&
+                unlink(it->path().c_str()) == 0) {
+                ++result.pruned;
+            }
+        }
+    }
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (reachable[i]) {
+            ++result.reachable;
+            continue;
+        }
+        string path = getFilePathFromSHA(to_hex_string(reinterpret_cast<const unsigned char*>(objects[i].data()), 20),
+                                         git_dir);
+        struct stat st;
+        if (expireSeconds < 0 || stat(path.c_str(), &st) != 0 || st.st_mtime > cutoff) {
+            ++result.kept;
+            continue;
+        }
+        if (unlink(path.c_str()) == 0) {
+            ++result.pruned;
+            rmdir(fs::path(path).parent_path().c_str());  // only succeeds once the fan-out directory is empty
+        }
+    }
+
+    if (result.pruned) {
+        // Pruned objects would otherwise stay as false positives
+        rebuildObjectFilter(git_dir);
+    }
+    return result;
+}
@@ -17,25 +17,282 @@
 #define HEADERS_H
 
 #include <string> // Include the string header
+#include <string_view>
 #include <iostream> // Include iostream if using cout or other I/O
+#include <filesystem>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include "mygit.h"
 
 using namespace std; // Use the entire standard namespace
 
-// Declare functions
-void decompressGitObjectChunkwise(const string& filepath,string hash,string objectFlag);
-string getFilePathFromSHA(const string& sha);
+// Internal functions behind libmygit. git_dir is the repository's .git
+// directory and root its worktree; both default to the current directory.
+
+// Object compression (codec.cpp). Objects are zlib streams; the backend
+// (zlib or libdeflate) is chosen at build time with MYGIT_CODEC.
+const char* codecName();
+string compressContent(const string& content, int level = -1);  // -1 is Z_DEFAULT_COMPRESSION
+string decompressContent(const string& compressedContent, size_t* unusedInput = nullptr);
+// Inflate at most maxOutput bytes from the start of a stream, e.g. an object's header
+string decompressPrefix(string_view compressed, size_t maxOutput);
+
+// Object store (utils.cpp)
+string getFilePathFromSHA(const string& sha, const string& git_dir = ".git");
 string readFile(const string& filename);
 string calculateSHA1(const string& input);
-string compressContent(const string& content);
-void storeCompressedFile(const string& sha1, const string& compressedContent);
+void storeCompressedFile(const string& sha1, const string& compressedContent, const string& git_dir = ".git");
+string writeObject(const string& type, const string& content, const string& git_dir = ".git");
+string readObject(const string& sha, const string& git_dir = ".git");
+string readObjectType(const string& sha, const string& git_dir = ".git");
 string to_hex_string(const unsigned char *data, size_t length);
-void parse_tree_object(vector<unsigned char> &data, bool option);
-bool read_and_decompress_git_object(const string &sha1_hash,bool flag, const string &git_dir = ".git");
-int writeTree(string path);
-void commitTree(const string& flag1, const string& sha_parent, const string& flag2,
-               const string& message, const string& sha);
-void addFiles(vector<string>& paths);
-void commit(std::string& indexPath, std::string& message);
-void printLogs();
-void extractCommit(string& commitSHA);
+string HexadecimalSha(const string& sha);
+string BytesFromHexSha(const string& hex);
+string ComputeShaHash(const string& data);
+string CreateBlobString(const string& filename);
+map<string, string> readConfig(const string& path);
+string getConfigValue(const string& git_dir, const string& key, const string& defaultValue);
+
+// Batched file I/O (batch_io.cpp). Requests are independent; a failed one
+// keeps its errno in error. Runs on io_uring where the kernel allows it and
+// on a thread pool otherwise, or as core.ioBackend (auto, io_uring, threads)
+// says.
+enum class IoBackend { Auto, Uring, Threads };
+struct FileRead {
+    string path;
+    size_t maxSize = SIZE_MAX;  // larger files only get their size filled in
+    size_t size = 0;
+    string data;
+    int error = 0;
+};
+struct FileWrite {
+    string path;
+    string_view data;
+    int error = 0;
+    bool exclusive = false;  // fail with EEXIST instead of truncating an existing file
+};
+IoBackend parseIoBackend(const string& name);
+IoBackend ioBackend(const string& git_dir = ".git");
+bool uringAvailable();
+void readFiles(vector<FileRead>& reads, IoBackend backend = IoBackend::Auto);
+void writeFiles(vector<FileWrite>& writes, IoBackend backend = IoBackend::Auto);
+void runOnThreads(size_t count, const function<void(size_t)>& work);  // work(i) for each i, on up to 16 threads
+vector<string> readObjects(const vector<string>& shas, const string& git_dir, IoBackend backend);  // utils.cpp
+void storeCompressedFiles(const vector<pair<string, string>>& objects, const string& git_dir, IoBackend backend);
+
+// Crash safety (durability.cpp). core.durability is off, batch or each.
+// Objects are written to objectWritePath() and published by objectWritten();
+// syncObjects() must run before the index or a ref may point at them.
+enum class Durability { Off, Batch, Each };
+Durability parseDurability(const string& name);
+Durability durabilityMode(const string& git_dir = ".git");
+string objectWritePath(const string& objectPath, Durability mode);
+void objectWritten(const string& objectPath, const string& git_dir, Durability mode);
+void syncObjects(const string& git_dir = ".git");
+void syncFile(const string& path);
+void syncDirectory(const string& path);
+
+// Exclusive right to replace a file such as the index or a ref, held through
+// <path>.lock like git. Creating it fails if another writer holds the lock.
+// commit() writes the new content to the lock file and renames it over the
+// file, fsyncing both when durable; if commit() is never reached the lock
+// file is removed.
+class LockFile {
+public:
+    explicit LockFile(const string& path, bool durable = false);
+    LockFile(const LockFile&) = delete;
+    LockFile& operator=(const LockFile&) = delete;
+    ~LockFile();
+
+    void commit(const string& content);
+
+private:
+    string path_;
+    string lockPath_;
+    bool durable_;
+    int fd_ = -1;
+};
+
+// Refs (refs.cpp). Names are full, e.g. refs/heads/main. A loose file under
+// .git/refs wins over .git/packed-refs, which is kept sorted so lookups are
+// binary searches. Writes go through LockFile.
+bool isValidRefName(const string& name);
+string readRef(const string& git_dir, const string& name);  // empty when missing
+map<string, string> listRefs(const string& git_dir, const string& prefix = "refs/");
+void writeRef(const string& git_dir, const string& name, const string& sha, const string& expected = "");
+void deleteRef(const string& git_dir, const string& name);
+// All or nothing. initial: git_dir is a new repository no other process
+// uses yet (clone), so the refs are not locked one by one.
+void updateRefs(const string& git_dir, const vector<mygit::RefUpdate>& updates, bool initial = false);
+size_t packRefs(const string& git_dir);
+string headBranch(const string& git_dir);                     // empty when HEAD is detached
+void setHead(const string& git_dir, const string& target);    // a ref name, or a SHA to detach
+string resolveRevision(const string& git_dir, const string& revision);
+
+// clone --local (clone.cpp): hard links the source's objects and packs,
+// copies its refs, config, logs and commit graph, then checks out HEAD
+void cloneLocal(const filesystem::path& source, const filesystem::path& destination);
+
+// archive (archive.cpp): a tree as a tar stream, optionally gzipped. A
+// commit's SHA goes into a pax global header; mtime stamps every entry.
+void writeArchive(const string& treeSHA, const string& commitSHA, int64_t mtime, ostream& out, bool gzip,
+                  const string& git_dir = ".git");
+
+// Bloom filter of stored objects (object_filter.cpp)
+bool objectMayExist(const string& sha, const string& git_dir = ".git");
+bool objectExists(const string& sha, const string& git_dir = ".git");
+// objectExists() for writers: an object that is already stored gets its
+// modification time set to now, so gc's grace period covers it again
+// while the write that found it goes on to name it
+bool freshenObject(const string& sha, const string& git_dir = ".git");
+void recordObject(const string& sha, const string& git_dir = ".git");
+size_t rebuildObjectFilter(const string& git_dir = ".git");
+vector<string> listLooseObjects(const string& git_dir = ".git");  // sorted raw 20-byte SHAs
+
+// .gitattributes and the blob compression policy (attributes.cpp)
+string getAttribute(const filesystem::path& root, const string& relativePath, const string& attribute);
+bool looksIncompressible(string_view data);
+int blobCompressionLevel(string_view content, const filesystem::path& root, const string& relativePath);
+
+// Content-defined chunking of large files (chunking.cpp)
+vector<size_t> chunkLengths(const unsigned char* data, size_t size);
+string hashFileObject(const string& filePath, const string& git_dir, bool write);
+vector<string> hashFileObjects(const vector<string>& filePaths, const string& git_dir, bool write, IoBackend backend);
+void writeFileContent(const string& sha, ostream& out, const string& git_dir);
+string readFileContent(const string& sha, const string& git_dir);  // a blob's content, chunked or not
+vector<pair<string, size_t>> chunkListing(string_view listing);  // body of a chunked object -> (blob SHA, length)
+
+// Line diff (line_diff.cpp). An edit replaces oldCount lines at oldStart
+// (0-based) with newCount lines at newStart.
+struct LineEdit {
+    size_t oldStart, oldCount, newStart, newCount;
+};
+vector<LineEdit> diffLines(string_view oldText, string_view newText);
+bool looksBinary(string_view content);
+string unifiedDiff(string_view oldText, string_view newText, size_t context = 3);  // hunks only
+string formatFilePatch(const mygit::TreeChange& change, string_view oldText, string_view newText);
+
+// Sparse checkout cone. Directories are worktree-relative with no trailing
+// slash; a disabled cone includes everything.
+struct SparseCone {
+    bool enabled = false;
+    set<string> recursive;  // checked out with everything below them
+    set<string> parents;    // only the files directly inside are checked out
+};
+
+// Worktree, index and history (utils.cpp)
+string writeTree(const filesystem::path& root);
+string commitTree(const string& treeSha, const vector<string>& parents, const string& message,
+                  const string& git_dir = ".git");
+map<string, string> readIndex(const string& indexPath);
+void addFiles(const filesystem::path& root, const vector<string>& paths);
+vector<mygit::StatusEntry> status(const filesystem::path& root);
+vector<mygit::StatusEntry> status(const filesystem::path& root, const IndexView& index);
+vector<mygit::StatusEntry> worktreeStatus(const filesystem::path& root, const IndexView& index);  // no staged entries
+string commit(const filesystem::path& root, const string& message);
+string commit(const filesystem::path& root, const string& message, const IndexView& index);
+string getHeadSHA(const string& git_dir = ".git");
+void updateHeadSHA(const string& sha, const string& git_dir = ".git");
+string readLog(const string& git_dir = ".git");  // the log of the branch HEAD is on
+string logPath(const string& git_dir, const string& branch);
+void startBranchLog(const string& git_dir, const string& branch, const string& startSHA);
+string commitTreeSHA(const string& commitSHA, const string& git_dir = ".git");
+void extractTree(const string& treeSHA, const filesystem::path& basePath, const string& git_dir = ".git",
+                 const SparseCone* sparse = nullptr, const string& prefix = "");
+void extractCommit(const filesystem::path& root, const string& commitSHA, bool force = false);
+string checkedOutTree(const string& git_dir = ".git");  // empty when unknown
+void setCheckedOutTree(const string& git_dir, const string& treeSHA);  // empty forgets it
+string formatTree(const vector<mygit::TreeItem>& items, bool nameOnly);
+string formatStatus(const vector<mygit::StatusEntry>& entries);
+enum class DiffFormat { Raw, NameOnly, NameStatus };
+string formatTreeChanges(const vector<mygit::TreeChange>& changes, DiffFormat format);
+
+using ObjectLoader = function<shared_ptr<const string>(const string&)>;  // hex SHA -> inflated object
+
+// Tree comparison (tree_diff.cpp). An empty SHA stands for the empty tree.
+// Changes come in tree order with full paths; a file replaced by a directory
+// is a deletion plus the additions below it. Against the index, file modes
+// are unknown and only SHAs are compared.
+void diffTrees(const string& oldTreeSHA, const string& newTreeSHA, const ObjectLoader& load,
+               const function<void(const mygit::TreeChange&)>& visit);
+void diffTreeWithIndex(const string& treeSHA, const IndexView& index, const ObjectLoader& load,
+                       const function<void(const mygit::TreeChange&)>& visit);
+
+// Rename and copy detection (renames.cpp). Rewrites added files as renames of
+// deleted ones, or with copies also as copies of deleted or modified ones,
+// when at least minScore percent of their content matches. load returns the
+// contents of a batch of blobs.
+using ContentLoader = function<vector<string>(const vector<string>& blobSHAs)>;
+void detectRenames(vector<mygit::TreeChange>& changes, const ContentLoader& load, int minScore, bool copies);
+struct RenameOptions {
+    bool enabled = false;
+    bool copies = false;
+    int minScore = 50;
+};
+bool parseRenameOption(const string& flag, RenameOptions& options);  // -M[<n>] or -C[<n>]; false if neither
+
+// Commit graph with changed-path Bloom filters and generation numbers
+// (commit_graph.cpp, layout in commit_graph.h), kept in .git/commit-graph.
+// commitTree() appends each new commit; writeCommitGraph() rebuilds it for
+// every commit reachable from a ref or HEAD.
+size_t writeCommitGraph(const string& git_dir = ".git");
+string filterLog(const string& log, const vector<string>& paths, const string& git_dir = ".git");  // log -- <path>...
+
+// merge-base (merge_base.cpp): one walk ordered by generation number and date
+// paints both sides' ancestors, reading the commit graph where it has records
+vector<string> mergeBases(const string& a, const string& b, const string& git_dir = ".git");  // best first
+bool isAncestor(const string& ancestor, const string& descendant, const string& git_dir = ".git");
+
+// Depth-first tree listing with subtree prefetch (tree_walk.cpp). Items carry
+// the full path from the root tree as their name.
+struct TreeWalkOptions {
+    bool recursive = false;  // descend into every subtree (-r)
+    bool showTrees = false;  // with recursive, also list the trees themselves (-t)
+    vector<string> paths;    // only these paths, the trees leading to them and what is below
+    size_t threads = 0;      // prefetch workers; 0 inflates each tree when the walk reaches it
+};
+void walkTree(const string& treeSHA, const function<shared_ptr<const string>(const string&)>& load,
+              const TreeWalkOptions& options, const function<void(const mygit::TreeItem&)>& visit);
+
+// Reachability and garbage collection (gc.cpp)
+vector<string> reachabilityRoots(const string& git_dir = ".git");
+vector<string> referencedObjects(const string& object, vector<string>* fileEntries = nullptr);
+vector<bool> markReachable(const string& git_dir, const vector<string>& objects, const vector<string>& roots,
+                           vector<string>* missing);
+long parseExpiry(const string& age);
+mygit::GcResult collectGarbage(const string& git_dir, long expireSeconds);
+
+// Reachability bitmaps (bitmap.cpp) in .git/objects/info/bitmaps: objects
+// numbered in history order and EWAH-compressed reachable sets for every ref
+// tip and every hundredth commit. countReachableObjects() counts what gc
+// would keep, from the bitmaps plus a walk of what is newer, or with a full
+// walk when there are none.
+mygit::BitmapWriteResult writeReachabilityBitmaps(const string& git_dir = ".git");
+size_t countReachableObjects(const string& git_dir = ".git");
+
+// Object store verification (fsck.cpp)
+mygit::FsckResult fsckObjects(const string& git_dir, const function<void(size_t done, size_t total)>& progress);
+
+// Cone-mode sparse checkout (sparse.cpp)
+SparseCone readSparseCone(const string& git_dir = ".git");
+void writeSparseCone(const string& git_dir, const vector<string>& directories);
+void disableSparseCone(const string& git_dir = ".git");
+bool sparseIncludesDirectory(const SparseCone& cone, const string& directory);
+bool sparseIncludesFile(const SparseCone& cone, const string& path);
+
+// fsmonitor daemon (fsmonitor.cpp)
+bool fsmonitorStart(const filesystem::path& root);
+bool fsmonitorStop(const filesystem::path& root);
+string fsmonitorPing(const filesystem::path& root);
+bool fsmonitorQuery(const filesystem::path& root, const string& sinceToken, string& newToken,
+                    vector<string>& changedPaths);
+string readFsmonitorToken(const filesystem::path& root);
+void writeFsmonitorToken(const filesystem::path& root, const string& token);
+bool isPathDirty(const set<string>& dirtyPaths, const string& path);
+
+// Long-running server (serve.cpp)
+void serveRepository(mygit::Repository repo, const string& socketPath, size_t threads);
 #endif // MY_FUNCTIONS_H
@@ -0,0 +1,176 @@
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+#include "index_view.h"
+using namespace std;
+
+const size_t INDEX_SHA_LENGTH = 40;
+
+const char* IndexView::iterator::lineEnd() const {
+    const char* newline = static_cast<const char*>(memchr(pos_, '\n', end_ - pos_));
+    return newline ? newline : end_;
+}
+
+IndexEntry IndexView::parseLine(const char* line, const char* lineEnd) {
+    string_view text(line, lineEnd - line);
+    if (text.size() <= INDEX_SHA_LENGTH || text[text.size() - INDEX_SHA_LENGTH - 1] != ' ') {
+        return IndexEntry{text, string_view()};
+    }
+    return IndexEntry{text.substr(0, text.size() - INDEX_SHA_LENGTH - 1), text.substr(text.size() - INDEX_SHA_LENGTH)};
+}
+
+shared_ptr<const IndexView> IndexView::open(const string& indexPath) {
+    shared_ptr<IndexView> view(new IndexView());
+    int fd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return view;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        view->identity_ = to_string(st.st_ino) + ' ' + to_string(st.st_size) + ' ' + to_string(st.st_mtim.tv_sec) +
+                          '.' + to_string(st.st_mtim.tv_nsec);
+        void* data = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (data != MAP_FAILED) {
+            view->mapped_ = data;
+            view->mappedSize_ = st.st_size;
+        }
+    }
+    close(fd);
+
+    const char* data = static_cast<const char*>(view->mapped_);
+    size_t headerSize = sizeof(INDEX_HEADER) - 1;
+    if (data && view->mappedSize_ >= headerSize && memcmp(data, INDEX_HEADER, headerSize) == 0) {
+        view->begin_ = data + headerSize;
+        view->end_ = data + view->mappedSize_;
+        return view;
+    }
+
+    // Pre-v2 index: whitespace separated fields, later lines win
+    map<string, string> entries;
+    if (data) {
+        istringstream lines(string(data, view->mappedSize_));
+        string line;
+        while (getline(lines, line)) {
+            istringstream iss(line);
+            string filePath, fileSHA;
+            if (iss >> filePath >> fileSHA) {
+                entries[filePath] = fileSHA;
+            }
+        }
+        munmap(view->mapped_, view->mappedSize_);
+        view->mapped_ = nullptr;
+    }
+    IndexEntries sorted;
+    for (const auto& [path, sha] : entries) {
+        sorted.push_back({path, sha});
+    }
+    view->owned_ = formatIndex(sorted).substr(headerSize);
+    view->begin_ = view->owned_.data();
+    view->end_ = view->owned_.data() + view->owned_.size();
+    return view;
+}
+
+IndexView::~IndexView() {
+    if (mapped_) {
+        munmap(mapped_, mappedSize_);
+    }
+}
+
+IndexView::iterator IndexView::lowerBound(string_view path) const {
+    // Binary search over bytes: land anywhere, back up to the start of that
+    // line, and compare its path
+    const char* low = begin_;
+    const char* high = end_;
+    while (low < high) {
+        const char* mid = low + (high - low) / 2;
+        while (mid > low && mid[-1] != '\n') {
+            --mid;
+        }
+        const char* newline = static_cast<const char*>(memchr(mid, '\n', end_ - mid));
+        const char* lineEnd = newline ? newline : end_;
+        if (parseLine(mid, lineEnd).path < path) {
+            low = newline ? newline + 1 : end_;
+        } else {
+            high = mid;
+        }
+    }
+    return iterator(low, end_);
+}
+
+optional<string_view> IndexView::find(string_view path) const {
+    iterator it = lowerBound(path);
+    if (it != end() && (*it).path == path) {
+        return (*it).sha;
+    }
+    return nullopt;
+}
+
+map<string, string> IndexView::toMap() const {
+    map<string, string> entries;
+    for (const IndexEntry& entry : *this) {
+        entries.emplace_hint(entries.end(), string(entry.path), string(entry.sha));
+    }
+    return entries;
+}
+
+static void appendIndexLine(string& out, string_view path, string_view sha) {
+    out.append(path).push_back(' ');
+    out.append(sha).push_back('\n');
+}
+
+void sortIndexEntries(IndexEntries& entries) {
+    stable_sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) { return a.path < b.path; });
+    // Reversed, unique() keeps the first of each run, which is the last added
+    auto kept = unique(entries.rbegin(), entries.rend(), [](const IndexEntry& a, const IndexEntry& b) { return a.path == b.path; });
+    entries.erase(entries.begin(), kept.base());
+}
+
+string formatIndex(span<const IndexEntry> entries) {
+    string out = INDEX_HEADER;
+    size_t size = out.size();
+    for (const IndexEntry& entry : entries) {
+        size += entry.path.size() + entry.sha.size() + 2;
+    }
+    out.reserve(size);
+    for (const IndexEntry& entry : entries) {
+        appendIndexLine(out, entry.path, entry.sha);
+    }
+    return out;
+}
+
+string mergeIndex(const IndexView& base, span<const IndexEntry> updates) {
+    // Unchanged runs of lines between two updated paths are copied in one go
+    string out = INDEX_HEADER;
+    out.reserve(out.size() + (base.end().position() - base.begin().position()) + updates.size() * 64);
+    const char* copied = base.begin().position();
+    auto copyTo = [&](const char* until) {
+        out.append(copied, until - copied);
+        if (!out.empty() && out.back() != '\n') {
+            out.push_back('\n');  // hand-edited index without a final newline
+        }
+        copied = until;
+    };
+    for (const auto& [path, sha] : updates) {
+        auto existing = base.lowerBound(path);
+        copyTo(existing.position());
+        if (existing != base.end() && (*existing).path == path) {
+            copied = (++existing).position();
+        }
+        appendIndexLine(out, path, sha);
+    }
+    copyTo(base.end().position());
+    return out;
+}
+
+map<string, string> readIndex(const string& indexPath) {
+    return IndexView::open(indexPath)->toMap();
+}
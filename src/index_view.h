@@ -0,0 +1,111 @@
+#ifndef INDEX_VIEW_H
+#define INDEX_VIEW_H
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <vector>
+#include <optional>
+#include <iterator>
+#include <cstddef>
+
+// The index is a text file: a header line, then one "<path> <sha>\n" line per
+// tracked file, sorted by path and without duplicates. The SHA is always the
+// last 40 characters of a line, so paths may contain spaces.
+const char INDEX_HEADER[] = "# mygit index v2\n";
+
+struct IndexEntry {
+    std::string_view path;
+    std::string_view sha;
+};
+
+// Read-only view of the index, memory mapped. Lookups binary search the
+// sorted lines in place; nothing is parsed up front. Indexes written before
+// the v2 header (appended, unsorted, possibly repeated lines) are normalized
+// into memory once when opened. Views stay valid after the index is
+// replaced, because writers rename a new file over it.
+class IndexView {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = IndexEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = IndexEntry;
+
+        iterator(const char* pos, const char* end) : pos_(pos), end_(end) {}
+
+        IndexEntry operator*() const { return parseLine(pos_, lineEnd()); }
+
+        iterator& operator++() {
+            pos_ = lineEnd() + 1;
+            if (pos_ > end_) pos_ = end_;
+            return *this;
+        }
+
+        // Start of the entry's line in the index file
+        const char* position() const { return pos_; }
+
+        bool operator==(const iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+        const char* lineEnd() const;
+
+        const char* pos_;
+        const char* end_;
+    };
+
+    // An empty view when the file does not exist
+    static std::shared_ptr<const IndexView> open(const std::string& indexPath);
+
+    IndexView(const IndexView&) = delete;
+    IndexView& operator=(const IndexView&) = delete;
+    ~IndexView();
+
+    iterator begin() const { return iterator(begin_, end_); }
+    iterator end() const { return iterator(end_, end_); }
+    bool empty() const { return begin_ == end_; }
+
+    // First entry whose path is not less than path
+    iterator lowerBound(std::string_view path) const;
+    std::optional<std::string_view> find(std::string_view path) const;
+
+    std::map<std::string, std::string> toMap() const;
+
+    // Inode, size and modification time of the file the view was opened
+    // from; empty when it did not exist. Writers replace the index by
+    // renaming, so a different file always has a different identity.
+    const std::string& identity() const { return identity_; }
+
+    static IndexEntry parseLine(const char* line, const char* lineEnd);
+
+private:
+    IndexView() = default;
+
+    void* mapped_ = nullptr;
+    size_t mappedSize_ = 0;
+    std::string owned_;  // normalized copy of a pre-v2 index
+    std::string identity_;
+    const char* begin_ = nullptr;
+    const char* end_ = nullptr;
+};
+
+// Entries being collected for a new index, usually viewing strings in the
+// command's Arena (arena.h) or in an open IndexView
+using IndexEntries = std::pmr::vector<IndexEntry>;
+
+// Sort by path, keeping only the last of entries with the same path
+void sortIndexEntries(IndexEntries& entries);
+
+// Full index file content for sorted entries, or for base with sorted
+// updates merged in (updates win). Merging binary searches for each update
+// and copies the lines in between unparsed.
+std::string formatIndex(std::span<const IndexEntry> entries);
+std::string mergeIndex(const IndexView& base, std::span<const IndexEntry> updates);
+
+#endif // INDEX_VIEW_H
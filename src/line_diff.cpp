@@ -0,0 +1,514 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include "headers.h"
+using namespace std;
+
+// Line diff in four steps:
+//   1. The common prefix and suffix of the two texts are found with memcmp
+//      over whole blocks and cut back to line boundaries. Lines in them are
+//      never hashed, so a small edit to a huge file costs little more than
+//      the compare.
+//   2. The remaining lines are interned: every distinct line gets a small
+//      integer, and everything after compares integers.
+//   3. Histogram diff (as in git) splits the middle at the longest run of
+//      equal lines around its rarest common line, repeatedly.
+//   4. Ranges without a line rare enough to anchor a split go to Myers'
+//      linear-space bisection. Its work is capped in proportion to the
+//      input; past the cap, the ranges left are reported as replaced whole.
+//      The output is still a correct diff, only no longer a minimal one.
+
+namespace {
+
+const uint32_t MAX_CHAIN = 64;      // lines more frequent than this never anchor a histogram split
+const size_t MYERS_WORK_PER_LINE = 64;
+const size_t MYERS_MIN_WORK = 1 << 22;
+const size_t BINARY_SCAN = 8000;    // bytes checked for NUL, as git does
+
+// Lines including their '\n'; the last one may lack it
+vector<string_view> splitLines(string_view text) {
+    vector<string_view> lines;
+    const char* pos = text.data();
+    const char* end = text.data() + text.size();
+    while (pos < end) {
+        const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        const char* lineEnd = newline ? newline + 1 : end;
+        lines.emplace_back(pos, lineEnd - pos);
+        pos = lineEnd;
+    }
+    return lines;
+}
+
+const size_t COMPARE_BLOCK = 4096;
+
+size_t commonPrefix(string_view a, string_view b) {
+    size_t limit = min(a.size(), b.size());
+    size_t n = 0;
+    while (n + COMPARE_BLOCK <= limit && memcmp(a.data() + n, b.data() + n, COMPARE_BLOCK) == 0) {
+        n += COMPARE_BLOCK;
+    }
+    while (n < limit && a[n] == b[n]) {
+        ++n;
+    }
+    return n;
+}
+
+size_t commonSuffix(string_view a, string_view b, size_t limit) {
+    const char* aEnd = a.data() + a.size();
+    const char* bEnd = b.data() + b.size();
+    size_t n = 0;
+    while (n + COMPARE_BLOCK <= limit &&
+           memcmp(aEnd - n - COMPARE_BLOCK, bEnd - n - COMPARE_BLOCK, COMPARE_BLOCK) == 0) {
+        n += COMPARE_BLOCK;
+    }
+    while (n < limit && aEnd[-1 - static_cast<ptrdiff_t>(n)] == bEnd[-1 - static_cast<ptrdiff_t>(n)]) {
+        ++n;
+    }
+    return n;
+}
+
+// Number of lines that end at or before byte offset in text
+size_t linesBefore(const vector<string_view>& lines, string_view text, size_t offset) {
+    return partition_point(lines.begin(), lines.end(), [&](string_view line) {
+        return static_cast<size_t>(line.data() + line.size() - text.data()) <= offset;
+    }) - lines.begin();
+}
+
+// Marks which interned lines of a and b are not part of the common subsequence
+class LineMatcher {
+public:
+    LineMatcher(const vector<uint32_t>& a, const vector<uint32_t>& b, size_t distinctLines)
+        : oldChanged(a.size()), newChanged(b.size()), a_(a), b_(b),
+          count_(distinctLines), head_(distinctLines), next_(a.size()),
+          myersWork_(MYERS_MIN_WORK + MYERS_WORK_PER_LINE * (a.size() + b.size())) {}
+
+    void run() {
+        vector<Range> pending{Range{0, a_.size(), 0, b_.size()}};
+        while (!pending.empty()) {
+            Range range = pending.back();
+            pending.pop_back();
+            if (trim(range) && !histogramSplit(range, pending)) {
+                myers(range);
+            }
+        }
+    }
+
+    vector<char> oldChanged;
+    vector<char> newChanged;
+
+private:
+    struct Range {
+        size_t a0, a1, b0, b1;
+    };
+
+    // Drops equal lines at both ends; false once nothing is left to match
+    bool trim(Range& range) {
+        while (range.a0 < range.a1 && range.b0 < range.b1 && a_[range.a0] == b_[range.b0]) {
+            ++range.a0;
+            ++range.b0;
+        }
+        while (range.a0 < range.a1 && range.b0 < range.b1 && a_[range.a1 - 1] == b_[range.b1 - 1]) {
+            --range.a1;
+            --range.b1;
+        }
+        if (range.a0 == range.a1 || range.b0 == range.b1) {
+            markChanged(range);
+            return false;
+        }
+        return true;
+    }
+
+    void markChanged(const Range& range) {
+        fill(oldChanged.begin() + range.a0, oldChanged.begin() + range.a1, 1);
+        fill(newChanged.begin() + range.b0, newChanged.begin() + range.b1, 1);
+    }
+
+    // Finds the run of equal lines whose rarest line is rarest in a (the
+    // longest such run on a tie) and queues the ranges on either side of it.
+    // False when every common line is too frequent to anchor a split.
+    bool histogramSplit(const Range& range, vector<Range>& pending) {
+        // Occurrences of each line of a, in ascending order through next_
+        for (size_t i = range.a1; i-- > range.a0;) {
+            uint32_t id = a_[i];
+            next_[i] = head_[id];
+            head_[id] = i + 1;
+            ++count_[id];
+        }
+
+        Range best{0, 0, 0, 0};
+        uint32_t bestCount = MAX_CHAIN + 1;
+        bool common = false;
+        for (size_t b = range.b0; b < range.b1;) {
+            size_t bNext = b + 1;
+            uint32_t count = count_[b_[b]];
+            common = common || count > 0;
+            if (count == 0 || count > MAX_CHAIN) {
+                b = bNext;
+                continue;
+            }
+            for (size_t occurrence = head_[b_[b]]; occurrence;) {
+                size_t as = occurrence - 1, bs = b, ae = as + 1, be = b + 1;
+                uint32_t rarest = count;
+                while (as > range.a0 && bs > range.b0 && a_[as - 1] == b_[bs - 1]) {
+                    --as;
+                    --bs;
+                    rarest = min(rarest, count_[a_[as]]);
+                }
+                while (ae < range.a1 && be < range.b1 && a_[ae] == b_[be]) {
+                    rarest = min(rarest, count_[a_[ae]]);
+                    ++ae;
+                    ++be;
+                }
+                if (rarest < bestCount || (rarest == bestCount && ae - as > best.a1 - best.a0)) {
+                    best = Range{as, ae, bs, be};
+                    bestCount = rarest;
+                }
+                bNext = max(bNext, be);
+                // Later occurrences inside this run would only find it again
+                do {
+                    occurrence = next_[occurrence - 1];
+                } while (occurrence && occurrence - 1 < ae);
+            }
+            b = bNext;
+        }
+
+        for (size_t i = range.a0; i < range.a1; ++i) {
+            head_[a_[i]] = 0;
+            count_[a_[i]] = 0;
+        }
+
+        if (bestCount <= MAX_CHAIN) {
+            pending.push_back(Range{range.a0, best.a0, range.b0, best.b0});
+            pending.push_back(Range{best.a1, range.a1, best.b1, range.b1});
+            return true;
+        }
+        if (!common) {
+            markChanged(range);
+            return true;
+        }
+        return false;
+    }
+
+    void myers(const Range& top) {
+        vector<Range> pending{top};
+        while (!pending.empty()) {
+            Range range = pending.back();
+            pending.pop_back();
+            if (!trim(range)) {
+                continue;
+            }
+            size_t x, y;
+            if (!bisect(range, x, y)) {
+                markChanged(range);
+                continue;
+            }
+            pending.push_back(Range{range.a0, range.a0 + x, range.b0, range.b0 + y});
+            pending.push_back(Range{range.a0 + x, range.a1, range.b0 + y, range.b1});
+        }
+    }
+
+    // Myers' middle snake, walked from both corners at once (after Neil
+    // Fraser's diff_bisect). Sets the split point relative to the range;
+    // false when the two sides share nothing or the work cap is reached.
+    bool bisect(const Range& range, size_t& splitX, size_t& splitY) {
+        const uint32_t* a = a_.data() + range.a0;
+        const uint32_t* b = b_.data() + range.b0;
+        ptrdiff_t n = range.a1 - range.a0;
+        ptrdiff_t m = range.b1 - range.b0;
+        // Pass d costs at least 2d, so the cap also bounds the arrays
+        ptrdiff_t maxD = min<ptrdiff_t>((n + m + 1) / 2, static_cast<ptrdiff_t>(sqrt(double(myersWork_))) + 1);
+        ptrdiff_t offset = maxD;
+        ptrdiff_t length = 2 * maxD + 2;
+        vector<ptrdiff_t> forward(length, -1), backward(length, -1);
+        forward[offset + 1] = 0;
+        backward[offset + 1] = 0;
+        ptrdiff_t delta = n - m;
+        bool front = delta % 2 != 0;
+        ptrdiff_t k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+        // Every diagonal visited and every snake step counts against the cap
+        size_t work = 0;
+        auto spend = [&] {
+            myersWork_ -= min(work, myersWork_);
+        };
+        for (ptrdiff_t d = 0; d < maxD; ++d) {
+            if (work > myersWork_) {
+                myersWork_ = 0;
+                return false;
+            }
+            work += 2 * d + 2;
+            for (ptrdiff_t k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+                ptrdiff_t k1Offset = offset + k1;
+                ptrdiff_t x1 = (k1 == -d || (k1 != d && forward[k1Offset - 1] < forward[k1Offset + 1]))
+                                   ? forward[k1Offset + 1]
+                                   : forward[k1Offset - 1] + 1;
+                ptrdiff_t y1 = x1 - k1;
+                while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                    ++x1;
+                    ++y1;
+                    ++work;
+                }
+                forward[k1Offset] = x1;
+                if (x1 > n) {
+                    k1end += 2;  // ran off the right of the graph
+                } else if (y1 > m) {
+                    k1start += 2;  // ran off the bottom
+                } else if (front) {
+                    ptrdiff_t k2Offset = offset + delta - k1;
+                    if (k2Offset >= 0 && k2Offset < length && backward[k2Offset] != -1 &&
+                        x1 >= n - backward[k2Offset]) {
+                        splitX = x1;
+                        splitY = y1;
+                        spend();
+                        return true;
+                    }
+                }
+            }
+            for (ptrdiff_t k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+                ptrdiff_t k2Offset = offset + k2;
+                ptrdiff_t x2 = (k2 == -d || (k2 != d && backward[k2Offset - 1] < backward[k2Offset + 1]))
+                                   ? backward[k2Offset + 1]
+                                   : backward[k2Offset - 1] + 1;
+                ptrdiff_t y2 = x2 - k2;
+                while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                    ++x2;
+                    ++y2;
+                    ++work;
+                }
+                backward[k2Offset] = x2;
+                if (x2 > n) {
+                    k2end += 2;
+                } else if (y2 > m) {
+                    k2start += 2;
+                } else if (!front) {
+                    ptrdiff_t k1Offset = offset + delta - k2;
+                    if (k1Offset >= 0 && k1Offset < length && forward[k1Offset] != -1) {
+                        ptrdiff_t x1 = forward[k1Offset];
+                        ptrdiff_t y1 = offset + x1 - k1Offset;
+                        if (x1 >= n - x2) {
+                            splitX = x1;
+                            splitY = y1;
+                            spend();
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        spend();
+        return false;
+    }
+
+    const vector<uint32_t>& a_;
+    const vector<uint32_t>& b_;
+    vector<uint32_t> count_;  // per line id: occurrences in the current range of a
+    vector<size_t> head_;     // per line id: first occurrence + 1, 0 for none
+    vector<size_t> next_;     // per position of a: next occurrence + 1
+    size_t myersWork_;        // comparisons left before Myers gives up
+};
+
+// Gives every distinct line a dense id. Open addressing over a flat table
+// of ids keeps the millions of lookups of a large file allocation-free.
+class LineInterner {
+public:
+    explicit LineInterner(size_t lines) {
+        size_t capacity = 16;
+        while (capacity < 2 * lines) {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, 0);
+        mask_ = capacity - 1;
+    }
+
+    uint32_t intern(string_view line) {
+        size_t hash = std::hash<string_view>()(line);
+        for (size_t slot = hash & mask_;; slot = (slot + 1) & mask_) {
+            uint32_t id = slots_[slot];
+            if (id == 0) {
+                lines_.push_back(line);
+                hashes_.push_back(hash);
+                slots_[slot] = static_cast<uint32_t>(lines_.size());
+                return slots_[slot] - 1;
+            }
+            if (hashes_[id - 1] == hash && lines_[id - 1] == line) {
+                return id - 1;
+            }
+        }
+    }
+
+    size_t size() const { return lines_.size(); }
+
+private:
+    vector<uint32_t> slots_;  // id + 1, 0 for empty
+    size_t mask_;
+    vector<string_view> lines_;
+    vector<size_t> hashes_;
+};
+
+vector<LineEdit> diffSplitLines(string_view oldText, const vector<string_view>& oldLines, string_view newText,
+                                const vector<string_view>& newLines) {
+    // Common prefix and suffix, cut back to whole lines
+    size_t prefix = commonPrefix(oldText, newText);
+    if (prefix == oldText.size() && prefix == newText.size()) {
+        return {};
+    }
+    if (prefix > 0 && oldText[prefix - 1] != '\n') {
+        const void* newline = memrchr(oldText.data(), '\n', prefix);
+        prefix = newline ? static_cast<const char*>(newline) - oldText.data() + 1 : 0;
+    }
+    size_t suffix = commonSuffix(oldText, newText, min(oldText.size(), newText.size()) - prefix);
+    size_t oldSuffixStart = oldText.size() - suffix;
+    size_t newSuffixStart = newText.size() - suffix;
+    bool atLineStart = (oldSuffixStart == prefix || oldText[oldSuffixStart - 1] == '\n') &&
+                       (newSuffixStart == prefix || newText[newSuffixStart - 1] == '\n');
+    if (suffix > 0 && !atLineStart) {
+        const void* newline = memchr(oldText.data() + oldSuffixStart, '\n', suffix);
+        suffix = newline ? oldText.data() + oldText.size() - static_cast<const char*>(newline) - 1 : 0;
+    }
+    size_t first = linesBefore(oldLines, oldText, prefix);
+    size_t oldLast = linesBefore(oldLines, oldText, oldText.size() - suffix);
+    size_t newLast = linesBefore(newLines, newText, newText.size() - suffix);
+
+    // Intern the lines in between
+    LineInterner ids(oldLast + newLast - 2 * first);
+    auto intern = [&](const vector<string_view>& lines, size_t last) {
+        vector<uint32_t> sequence;
+        sequence.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            sequence.push_back(ids.intern(lines[i]));
+        }
+        return sequence;
+    };
+    vector<uint32_t> a = intern(oldLines, oldLast);
+    vector<uint32_t> b = intern(newLines, newLast);
+
+    LineMatcher matcher(a, b, ids.size());
+    matcher.run();
+
+    // Unchanged lines pair up in order, so the changed runs between them are the edits
+    vector<LineEdit> edits;
+    size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (i < a.size() && j < b.size() && !matcher.oldChanged[i] && !matcher.newChanged[j]) {
+            ++i;
+            ++j;
+            continue;
+        }
+        size_t i0 = i, j0 = j;
+        while (i < a.size() && (matcher.oldChanged[i] || j == b.size())) ++i;
+        while (j < b.size() && (matcher.newChanged[j] || i == a.size())) ++j;
+        edits.push_back(LineEdit{first + i0, i - i0, first + j0, j - j0});
+    }
+    return edits;
+}
+
+string hunkRange(size_t start, size_t count) {
+    if (count == 1) {
+        return to_string(start + 1);
+    }
+    return to_string(count == 0 ? start : start + 1) + "," + to_string(count);
+}
+
+void appendLine(string& out, char marker, string_view line) {
+    out.push_back(marker);
+    out.append(line);
+    if (line.empty() || line.back() != '\n') {
+        out.append("\n\\ No newline at end of file\n");
+    }
+}
+
+} // namespace
+
+vector<LineEdit> diffLines(string_view oldText, string_view newText) {
+    return diffSplitLines(oldText, splitLines(oldText), newText, splitLines(newText));
+}
+
+bool looksBinary(string_view content) {
+    return memchr(content.data(), '\0', min(content.size(), BINARY_SCAN)) != nullptr;
+}
+
+string unifiedDiff(string_view oldText, string_view newText, size_t context) {
+    vector<string_view> oldLines = splitLines(oldText);
+    vector<string_view> newLines = splitLines(newText);
+    vector<LineEdit> edits = diffSplitLines(oldText, oldLines, newText, newLines);
+
+    string out;
+    for (size_t i = 0; i < edits.size();) {
+        // Edits closer than twice the context share a hunk
+        size_t last = i;
+        while (last + 1 < edits.size() &&
+               edits[last + 1].oldStart - (edits[last].oldStart + edits[last].oldCount) <= 2 * context) {
+            ++last;
+        }
+        size_t oldBegin = edits[i].oldStart - min(context, edits[i].oldStart);
+        size_t newBegin = edits[i].newStart - (edits[i].oldStart - oldBegin);
+        size_t oldTail = edits[last].oldStart + edits[last].oldCount;
+        size_t trailing = min(context, oldLines.size() - oldTail);
+        size_t newTail = edits[last].newStart + edits[last].newCount;
+        out += "@@ -" + hunkRange(oldBegin, oldTail + trailing - oldBegin) + " +" +
+               hunkRange(newBegin, newTail + trailing - newBegin) + " @@\n";
+
+        size_t pos = oldBegin;
+        for (size_t e = i; e <= last; ++e) {
+            for (; pos < edits[e].oldStart; ++pos) {
+                appendLine(out, ' ', oldLines[pos]);
+            }
+            for (size_t k = 0; k < edits[e].oldCount; ++k) {
+                appendLine(out, '-', oldLines[edits[e].oldStart + k]);
+            }
+            for (size_t k = 0; k < edits[e].newCount; ++k) {
+                appendLine(out, '+', newLines[edits[e].newStart + k]);
+            }
+            pos = edits[e].oldStart + edits[e].oldCount;
+        }
+        for (; pos < oldTail + trailing; ++pos) {
+            appendLine(out, ' ', oldLines[pos]);
+        }
+        i = last + 1;
+    }
+    return out;
+}
+
+string formatFilePatch(const mygit::TreeChange& change, string_view oldText, string_view newText) {
+    char mode[16];
+    bool moved = change.kind == mygit::TreeChange::Kind::Renamed || change.kind == mygit::TreeChange::Kind::Copied;
+    const string& oldPath = moved ? change.oldPath : change.path;
+    string out = "diff --git a/" + oldPath + " b/" + change.path + "\n";
+    if (change.kind == mygit::TreeChange::Kind::Added && change.newMode) {
+        snprintf(mode, sizeof(mode), "%06o", change.newMode);
+        out += string("new file mode ") + mode + "\n";
+    } else if (change.kind == mygit::TreeChange::Kind::Deleted && change.oldMode) {
+        snprintf(mode, sizeof(mode), "%06o", change.oldMode);
+        out += string("deleted file mode ") + mode + "\n";
+    } else if (change.oldMode && change.newMode && change.oldMode != change.newMode) {
+        snprintf(mode, sizeof(mode), "%06o", change.oldMode);
+        out += string("old mode ") + mode + "\n";
+        snprintf(mode, sizeof(mode), "%06o", change.newMode);
+        out += string("new mode ") + mode + "\n";
+    }
+    if (moved) {
+        string verb = change.kind == mygit::TreeChange::Kind::Renamed ? "rename" : "copy";
+        out += "similarity index " + to_string(change.similarity) + "%\n";
+        out += verb + " from " + change.oldPath + "\n" + verb + " to " + change.path + "\n";
+        if (change.oldSha == change.newSha) {
+            return out;
+        }
+    }
+    auto abbreviation = [](const string& sha) { return sha.empty() ? string(7, '0') : sha.substr(0, 7); };
+    out += "index " + abbreviation(change.oldSha) + ".." + abbreviation(change.newSha) + "\n";
+
+    string oldName = change.kind == mygit::TreeChange::Kind::Added ? "/dev/null" : "a/" + oldPath;
+    string newName = change.kind == mygit::TreeChange::Kind::Deleted ? "/dev/null" : "b/" + change.path;
+    if (looksBinary(oldText) || looksBinary(newText)) {
+        return out + "Binary files " + oldName + " and " + newName + " differ\n";
+    }
+    string hunks = unifiedDiff(oldText, newText);
+    if (hunks.empty()) {
+        return out;  // only the mode changed
+    }
+    return out + "--- " + oldName + "\n+++ " + newName + "\n" + hunks;
+}
@@ -0,0 +1,232 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include "headers.h"
+#include "commit_graph.h"
+using namespace std;
+
+// merge-base walks history newest first: a priority queue ordered by
+// generation number, then commit date, so a commit is only taken off the
+// queue after every commit the walk reaches it through. Both sides are
+// painted in one walk; a commit carrying both colours is a merge base, and
+// the colours it passes on are marked stale so the walk stops once nothing
+// but stale commits is left.
+//
+// Commits are numbered densely (commit graph positions, then commits read
+// from the object store) and their walk state is a byte in a flat array, so
+// walking a hundred thousand commits costs no hashing when the graph covers
+// them.
+
+namespace {
+
+const uint8_t PARENT1 = 1;
+const uint8_t PARENT2 = 2;
+const uint8_t STALE = 4;
+const uint8_t RESULT = 8;
+const uint8_t SEEN = 16;
+
+class CommitWalk {
+public:
+    explicit CommitWalk(const string& git_dir) : graph_(git_dir), git_dir_(git_dir), flags_(graph_.size()) {}
+
+    uint32_t id(const string& sha) {
+        uint32_t position = graph_.find(BytesFromHexSha(sha));
+        if (position != COMMIT_GRAPH_NO_POSITION) {
+            return position;
+        }
+        auto [it, inserted] = extraIds_.try_emplace(sha, graph_.size() + extras_.size());
+        if (inserted) {
+            extras_.push_back({sha, readCommitInfo(sha, git_dir_), {}, false});
+            flags_.push_back(0);
+        }
+        return it->second;
+    }
+
+    string sha(uint32_t commit) const {
+        return commit < graph_.size() ? to_hex_string(graph_.record(commit).commit, 20)
+                                      : extras_[commit - graph_.size()].sha;
+    }
+
+    uint32_t generation(uint32_t commit) const {
+        return commit < graph_.size() ? graph_.record(commit).generation : GENERATION_INFINITY;
+    }
+
+    int64_t date(uint32_t commit) const {
+        return commit < graph_.size() ? graph_.record(commit).date : extras_[commit - graph_.size()].commit.date;
+    }
+
+    template <typename Visit>
+    void forEachParent(uint32_t commit, Visit visit) {
+        if (commit < graph_.size()) {
+            const CommitGraphRecord& record = graph_.record(commit);
+            const CommitGraphParent* parents = graph_.parents(record);
+            for (uint32_t i = 0; i < record.parentCount; ++i) {
+                uint32_t position = graph_.parentPosition(parents[i]);
+                visit(position != COMMIT_GRAPH_NO_POSITION ? position : id(to_hex_string(parents[i].commit, 20)));
+            }
+            return;
+        }
+        size_t extra = commit - graph_.size();
+        if (!extras_[extra].resolved) {
+            vector<string> shas = extras_[extra].commit.parents;
+            vector<uint32_t> parents;
+            for (const string& parent : shas) {
+                parents.push_back(id(parent));  // may grow extras_
+            }
+            extras_[extra].parents = std::move(parents);
+            extras_[extra].resolved = true;
+        }
+        for (uint32_t parent : extras_[extra].parents) {
+            visit(parent);
+        }
+    }
+
+    uint8_t& flags(uint32_t commit) { return flags_[commit]; }
+    uint8_t flags(uint32_t commit) const { return flags_[commit]; }
+    void clearFlags() { fill(flags_.begin(), flags_.end(), 0); }
+
+private:
+    struct Extra {
+        string sha;
+        CommitInfo commit;
+        vector<uint32_t> parents;  // ids, once resolved
+        bool resolved;
+    };
+
+    CommitGraph graph_;
+    string git_dir_;
+    vector<uint8_t> flags_;
+    unordered_map<string, uint32_t> extraIds_;
+    vector<Extra> extras_;
+};
+
+// Max-heap of commits by generation, then date
+class CommitQueue {
+public:
+    explicit CommitQueue(CommitWalk& walk) : walk_(walk) {}
+
+    bool empty() const { return heap_.empty(); }
+
+    void push(uint32_t id) {
+        heap_.emplace_back(walk_.generation(id), walk_.date(id), id);
+        push_heap(heap_.begin(), heap_.end());
+    }
+
+    uint32_t pop() {
+        pop_heap(heap_.begin(), heap_.end());
+        uint32_t id = get<2>(heap_.back());
+        heap_.pop_back();
+        return id;
+    }
+
+    // Queues stay a handful of commits wide, so this scan is cheap
+    bool hasNonStale() const {
+        return any_of(heap_.begin(), heap_.end(), [&](const auto& entry) { return !(walk_.flags(get<2>(entry)) & STALE); });
+    }
+
+private:
+    CommitWalk& walk_;
+    vector<tuple<uint32_t, int64_t, uint32_t>> heap_;
+};
+
+// Paints the ancestors of one with PARENT1 and of two with PARENT2, and
+// returns the commits found with both, best first
+vector<uint32_t> paintDownToCommon(CommitWalk& walk, uint32_t one, uint32_t two) {
+    CommitQueue queue(walk);
+    walk.flags(one) |= PARENT1;
+    walk.flags(two) |= PARENT2;
+    queue.push(one);
+    queue.push(two);
+
+    vector<uint32_t> results;
+    while (queue.hasNonStale()) {
+        uint32_t commit = queue.pop();
+        uint8_t flags = walk.flags(commit) & (PARENT1 | PARENT2 | STALE);
+        if (flags == (PARENT1 | PARENT2)) {
+            if (!(walk.flags(commit) & RESULT)) {
+                walk.flags(commit) |= RESULT;
+                results.push_back(commit);
+            }
+            flags |= STALE;  // its ancestors are common too, but not the best ones
+        }
+        walk.forEachParent(commit, [&](uint32_t parent) {
+            if ((walk.flags(parent) & flags) == flags) {
+                return;
+            }
+            walk.flags(parent) |= flags;
+            queue.push(parent);
+        });
+    }
+
+    // A result found early can turn stale through a later one
+    erase_if(results, [&](uint32_t commit) { return walk.flags(commit) & STALE; });
+    return results;
+}
+
+// Whether ancestor is reachable from descendant. Commits of a lower
+// generation than ancestor cannot lead to it, so the walk stops there.
+bool reaches(CommitWalk& walk, uint32_t descendant, uint32_t ancestor) {
+    uint32_t floor = walk.generation(ancestor);
+    vector<uint32_t> stack = {descendant};
+    walk.flags(descendant) |= SEEN;
+    while (!stack.empty()) {
+        uint32_t commit = stack.back();
+        stack.pop_back();
+        if (commit == ancestor) {
+            return true;
+        }
+        walk.forEachParent(commit, [&](uint32_t parent) {
+            if (!(walk.flags(parent) & SEEN) && walk.generation(parent) >= floor) {
+                walk.flags(parent) |= SEEN;
+                stack.push_back(parent);
+            }
+        });
+    }
+    return false;
+}
+
+} // namespace
+
+vector<string> mergeBases(const string& a, const string& b, const string& git_dir) {
+    CommitWalk walk(git_dir);
+    uint32_t one = walk.id(a);
+    uint32_t two = walk.id(b);
+    if (one == two) {
+        return {a};
+    }
+    vector<uint32_t> bases = paintDownToCommon(walk, one, two);
+
+    // Criss-cross merges can leave bases that are ancestors of other bases
+    if (bases.size() > 1) {
+        vector<uint32_t> best;
+        for (uint32_t base : bases) {
+            bool redundant = false;
+            for (uint32_t other : bases) {
+                walk.clearFlags();
+                if (other != base && reaches(walk, other, base)) {
+                    redundant = true;
+                    break;
+                }
+            }
+            if (!redundant) {
+                best.push_back(base);
+            }
+        }
+        bases = std::move(best);
+    }
+
+    vector<string> shas;
+    for (uint32_t base : bases) {
+        shas.push_back(walk.sha(base));
+    }
+    return shas;
+}
+
+bool isAncestor(const string& ancestor, const string& descendant, const string& git_dir) {
+    CommitWalk walk(git_dir);
+    return reaches(walk, walk.id(descendant), walk.id(ancestor));
+}
@@ -0,0 +1,227 @@
+#ifndef MYGIT_H
+#define MYGIT_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class IndexView;  // index_view.h
+
+// Public C++ API of libmygit. Every call returns its result instead of
+// printing, and reports failures by throwing std::runtime_error (or
+// std::invalid_argument for bad input).
+namespace mygit {
+
+struct Object {
+    std::string type;      // "blob", "tree" or "commit"
+    std::string content;   // body without the "<type> <size>\0" header
+};
+
+struct TreeItem {
+    unsigned int mode;     // e.g. 0100644, 040000
+    std::string type;      // object type the mode points at
+    std::string sha;       // 40-character hex id
+    std::string name;
+};
+
+struct StatusEntry {
+    // Staged*: the index against HEAD's tree; the rest: the worktree against the index
+    enum class State { Modified, Deleted, Untracked, StagedAdded, StagedModified, StagedDeleted };
+    State state;
+    std::string path;      // relative to the worktree root
+};
+
+struct TreeChange {
+    enum class Kind { Added, Deleted, Modified, Renamed, Copied };
+    Kind kind;
+    std::string path;      // full path from the root tree
+    unsigned int oldMode;  // 0 on the side the path is missing from
+    unsigned int newMode;
+    std::string oldSha;    // empty on the side the path is missing from
+    std::string newSha;
+    std::string oldPath;   // where a renamed or copied file came from
+    int similarity = 0;    // percent of content a rename or copy kept
+};
+
+// One ref of an update-ref transaction. An empty newSha deletes the ref. A
+// non-empty oldSha must match the current value, and 40 zeros mean the ref
+// must not exist yet.
+struct RefUpdate {
+    std::string name;      // full name, e.g. refs/heads/topic
+    std::string newSha;
+    std::string oldSha;
+};
+
+struct GcResult {
+    size_t reachable = 0;
+    size_t pruned = 0;
+    size_t kept = 0;       // unreachable, but inside the grace period
+};
+
+struct FsckResult {
+    size_t objects = 0;
+    size_t dangling = 0;   // neither referenced by another object nor named by a root
+    std::vector<std::string> problems;
+};
+
+struct ObjectCount {
+    size_t objects = 0;
+    uint64_t bytes = 0;    // on disk, compressed
+};
+
+struct BitmapWriteResult {
+    size_t objects = 0;    // numbered in the file
+    size_t bitmaps = 0;
+};
+
+class RepositoryCache;
+
+// Handle on one repository. It only stores paths (plus an optional shared
+// cache), so it is cheap to copy and can be kept open for the lifetime of a
+// host process.
+class Repository {
+public:
+    // Create .git under worktree (if needed) and open it
+    static Repository init(const std::filesystem::path& worktree);
+    // Open an existing repository whose worktree root is worktree
+    static Repository open(const std::filesystem::path& worktree);
+    // clone --local: a new repository at worktree sharing source's objects
+    // through hard links (copies across file systems), with its refs and
+    // HEAD checked out
+    static Repository cloneLocal(const std::filesystem::path& source, const std::filesystem::path& worktree);
+
+    const std::filesystem::path& worktree() const { return worktree_; }
+    std::filesystem::path gitDir() const { return worktree_ / ".git"; }
+
+    // Keep inflated objects (up to objectCacheBytes) and the parsed index in
+    // memory across calls. Copies of this handle share the cache, and it is
+    // safe to use from several threads.
+    void enableCache(size_t objectCacheBytes = 64 * 1024 * 1024);
+
+    // Objects
+    std::string hashObject(const std::string& type, const std::string& content) const;
+    std::string writeObject(const std::string& type, const std::string& content);
+    std::string writeBlobFromFile(const std::filesystem::path& file);
+    Object readObject(const std::string& sha) const;
+    // object-filter rebuild: rescan .git/objects into a new existence
+    // filter; returns the number of objects found
+    size_t rebuildObjectFilter();
+    std::vector<TreeItem> listTree(const std::string& sha) const;
+    // ls-tree [-r] [-t] <tree> [<path>...]: items are named by their full path.
+    // Subtrees are inflated by a small thread pool ahead of the walk.
+    std::vector<TreeItem> listTree(const std::string& sha, bool recursive, bool showTrees,
+                                   const std::vector<std::string>& paths = {}) const;
+    // diff-tree <old> <new>: the files that differ between two trees or
+    // commits. Subtrees with the same SHA on both sides are not read.
+    std::vector<TreeChange> diffTree(const std::string& oldSha, const std::string& newSha) const;
+    // The index against a tree or commit (empty for the empty tree), and the
+    // worktree against the index. Worktree changes carry the hash of the
+    // file as newSha, or an empty one for a deleted file.
+    std::vector<TreeChange> diffIndex(const std::string& treeOrCommit) const;
+    std::vector<TreeChange> diffWorktree() const;
+    // -M / -C: turn added files into renames (and with copies, copies) of
+    // the deleted (or modified) files they match by content. Exact matches
+    // are found by SHA; the rest through similarity sketches, so a commit
+    // moving tens of thousands of files does not compare every pair.
+    void detectRenames(std::vector<TreeChange>& changes, bool copies = false, int minScore = 50) const;
+    // diff: unified diff of the changes' contents. With newFromWorktree the
+    // new side is read from the worktree instead of the object store.
+    std::string patch(const std::vector<TreeChange>& changes, bool newFromWorktree = false) const;
+    // archive: write a commit's (or tree's) files to out as a tar stream,
+    // gzipped with gzip, without touching the worktree
+    void archive(const std::string& treeOrCommit, std::ostream& out, bool gzip = false) const;
+
+    // Index: worktree-relative path -> blob SHA
+    std::map<std::string, std::string> index() const;
+    void add(const std::vector<std::string>& paths);
+    std::vector<StatusEntry> status() const;
+
+    // Trees and commits
+    std::string writeTree();
+    std::string commitTree(const std::string& treeSha, const std::vector<std::string>& parents,
+                           const std::string& message);
+    std::string commit(const std::string& message);
+    std::string head() const;
+    std::string log() const;
+    // log -- <path>...: the log entries of commits that changed one of the
+    // paths (or something below them) relative to their first parent
+    std::string log(const std::vector<std::string>& paths) const;
+    // commit-graph write: rebuild the changed-path filters behind log --
+    // <path> for every commit in the log. Commits made here add theirs.
+    size_t writeCommitGraph();
+    // merge-base: the best common ancestors of two commits (several only
+    // after criss-cross merges), and whether one commit is an ancestor of
+    // another. Both walk the commit graph's generation numbers when present.
+    std::vector<std::string> mergeBases(const std::string& a, const std::string& b) const;
+    bool isAncestor(const std::string& ancestor, const std::string& descendant) const;
+    // checkout <branch> puts HEAD on the branch, checkout <commit> detaches
+    // it. Only files that differ from the tree last checked out or
+    // committed are touched; force rewrites the whole worktree.
+    void checkout(const std::string& branchOrCommit, bool force = false);
+
+    // Branches and refs. Refs are full names (refs/heads/main), branches
+    // short ones (main). Lookups binary-search packed-refs when the ref has
+    // no loose file.
+    std::string currentBranch() const;  // empty when HEAD is detached
+    std::map<std::string, std::string> branches() const;  // name -> SHA
+    void createBranch(const std::string& name, const std::string& startPoint = "HEAD");
+    void deleteBranch(const std::string& name);
+    std::map<std::string, std::string> refs(const std::string& prefix = "refs/") const;
+    // update-ref: all updates are applied in one rewrite of packed-refs, or
+    // none if any expected old value does not match
+    void updateRefs(const std::vector<RefUpdate>& updates);
+    size_t packRefs();  // pack-refs: move loose refs into packed-refs
+
+    // Cone-mode sparse checkout: only the listed directories (recursively)
+    // and the files directly inside their parents are materialized. Both
+    // calls re-check out HEAD to apply the new cone.
+    void setSparseCheckout(const std::vector<std::string>& directories);
+    void disableSparseCheckout();
+    std::vector<std::string> sparseCheckoutDirectories() const;
+
+    // gc: delete unreachable loose objects older than expiry ("now",
+    // "never", or a number with an s/m/h/d/w suffix). An empty expiry
+    // takes gc.pruneExpire from .git/config, 14d by default.
+    GcResult gc(const std::string& expiry = "");
+    // fsck: re-hash and parse every loose object on all cores and check
+    // that everything referenced exists. progress(done, total) is called
+    // about ten times a second from the calling thread.
+    FsckResult fsck(const std::function<void(size_t done, size_t total)>& progress = nullptr) const;
+    // count-objects: the loose objects and their size on disk
+    ObjectCount countObjects() const;
+    // count-objects --reachable: the objects gc would keep. Reachability
+    // bitmaps answer most of it without reading the history.
+    size_t countReachableObjects() const;
+    // bitmap write: store reachability bitmaps for the ref tips and every
+    // hundredth commit in .git/objects/info/bitmaps
+    BitmapWriteResult writeBitmaps();
+
+    // fsmonitor daemon watching the worktree with inotify. start and stop
+    // return false when it is already running or not running.
+    bool startFsmonitor();
+    bool stopFsmonitor();
+    std::string fsmonitorToken() const;  // empty when the daemon is not running
+
+    // serve: answer requests on a Unix socket with threads workers until
+    // the process is stopped, keeping objects and the index cached
+    void serve(const std::string& socketPath, size_t threads) const;
+
+private:
+    explicit Repository(std::filesystem::path worktree) : worktree_(std::move(worktree)) {}
+
+    std::shared_ptr<const std::string> readRawObject(const std::string& sha) const;
+    std::shared_ptr<const IndexView> indexSnapshot() const;
+    std::string resolveTree(const std::string& treeOrCommit) const;
+
+    std::filesystem::path worktree_;
+    std::shared_ptr<RepositoryCache> cache_;
+};
+
+} // namespace mygit
+
+#endif // MYGIT_H
@@ -0,0 +1,255 @@
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Bloom filter over every object in .git/objects, stored in
+// .git/objects/info/bloom and mapped shared, so concurrent writers set bits
+// in place with atomic ORs. A miss means the object is definitely absent and
+// no stat is needed. A hit still has to be confirmed on disk, but once it is,
+// the object is not compressed and written again.
+//
+// Losing a bit (an object written by another tool, or by a process still
+// mapping a filter that has since been rebuilt) only causes a redundant write
+// of identical content, so the filter never has to be exact.
+
+const char OBJECT_FILTER_MAGIC[4] = {'M', 'G', 'O', 'F'};
+const uint32_t OBJECT_FILTER_VERSION = 1;
+const uint32_t OBJECT_FILTER_HASHES = 7;
+const uint32_t OBJECT_FILTER_MIN_LOG2_BITS = 20;  // 128 KiB
+const uint64_t OBJECT_FILTER_BITS_PER_OBJECT = 16;  // about 0.07% false positives when built
+const uint64_t OBJECT_FILTER_MAX_FILL = 10;         // rebuild before dropping under 10 bits per object
+
+struct ObjectFilterHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t hashes;
+    uint32_t log2Bits;
+    uint64_t count;  // objects added, updated atomically
+    uint64_t reserved;
+};
+
+class ObjectFilterMapping {
+public:
+    ObjectFilterMapping(void* data, size_t size) : data_(data), size_(size) {}
+    ~ObjectFilterMapping() { munmap(data_, size_); }
+
+    ObjectFilterHeader* header() const { return static_cast<ObjectFilterHeader*>(data_); }
+    uint64_t* words() const { return reinterpret_cast<uint64_t*>(header() + 1); }
+    uint64_t capacity() const { return (1ULL << header()->log2Bits) / OBJECT_FILTER_MAX_FILL; }
+
+private:
+    void* data_;
+    size_t size_;
+};
+
+static string objectFilterPath(const string& git_dir) {
+    return git_dir + "/objects/info/bloom";
+}
+
+// Bit positions by double hashing. SHA-1 output is already uniform, so the
+// raw bytes are used directly.
+template <typename Visit>
+static void forEachBit(const unsigned char* rawSha, uint32_t log2Bits, Visit visit) {
+    uint64_t h1, h2;
+    memcpy(&h1, rawSha, 8);
+    memcpy(&h2, rawSha + 8, 8);
+    h2 |= 1;
+    uint64_t mask = (1ULL << log2Bits) - 1;
+    for (uint32_t i = 0; i < OBJECT_FILTER_HASHES; ++i) {
+        visit((h1 + i * h2) & mask);
+    }
+}
+
+static bool isHexName(const string& name, size_t length) {
+    return name.size() == length && all_of(name.begin(), name.end(), [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    });
+}
+
+static shared_ptr<ObjectFilterMapping> mapObjectFilter(const string& path) {
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ObjectFilterHeader)) {
+        data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto mapping = make_shared<ObjectFilterMapping>(data, st.st_size);
+    const ObjectFilterHeader* header = mapping->header();
+    if (memcmp(header->magic, OBJECT_FILTER_MAGIC, 4) != 0 || header->version != OBJECT_FILTER_VERSION ||
+        header->hashes != OBJECT_FILTER_HASHES || header->log2Bits < 6 || header->log2Bits > 40 ||
+        static_cast<size_t>(st.st_size) != sizeof(ObjectFilterHeader) + (1ULL << header->log2Bits) / 8) {
+        return nullptr;
+    }
+    return mapping;
+}
+
+vector<string> listLooseObjects(const string& git_dir) {
+    // One pass over the 256 fan-out directories, split between threads
+    fs::path objectsDir = fs::path(git_dir) / "objects";
+    size_t threadCount = clamp<size_t>(thread::hardware_concurrency(), 4, 16);
+    atomic<int> nextDirectory{0};
+    vector<vector<string>> found(threadCount);
+    vector<thread> workers;
+    for (size_t t = 0; t < threadCount; ++t) {
+        workers.emplace_back([&, t] {
+            for (int dir; (dir = nextDirectory++) < 256;) {
+                char prefix[3];
+                snprintf(prefix, sizeof(prefix), "%02x", dir);
+                error_code ec;
+                for (fs::directory_iterator it(objectsDir / prefix, ec), end; !ec && it != end; it.increment(ec)) {
+                    string name = it->path().filename().string();
+                    if (isHexName(name, 38)) {
+                        found[t].push_back(BytesFromHexSha(prefix + name));
+                    }
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    vector<string> objects;
+    for (auto& shas : found) {
+        objects.insert(objects.end(), make_move_iterator(shas.begin()), make_move_iterator(shas.end()));
+    }
+    sort(objects.begin(), objects.end());
+    return objects;
+}
+
+size_t rebuildObjectFilter(const string& git_dir) {
+    fs::path objectsDir = fs::path(git_dir) / "objects";
+    vector<string> objects = listLooseObjects(git_dir);
+    size_t count = objects.size();
+    uint32_t log2Bits = OBJECT_FILTER_MIN_LOG2_BITS;
+    while ((1ULL << log2Bits) < count * OBJECT_FILTER_BITS_PER_OBJECT) {
+        ++log2Bits;
+    }
+
+    string filter(sizeof(ObjectFilterHeader) + (1ULL << log2Bits) / 8, '\0');
+    ObjectFilterHeader* header = reinterpret_cast<ObjectFilterHeader*>(filter.data());
+    memcpy(header->magic, OBJECT_FILTER_MAGIC, 4);
+    header->version = OBJECT_FILTER_VERSION;
+    header->hashes = OBJECT_FILTER_HASHES;
+    header->log2Bits = log2Bits;
+    header->count = count;
+    uint64_t* words = reinterpret_cast<uint64_t*>(header + 1);
+    for (const auto& sha : objects) {
+        forEachBit(reinterpret_cast<const unsigned char*>(sha.data()), log2Bits,
+                   [&](uint64_t bit) { words[bit / 64] |= 1ULL << (bit % 64); });
+    }
+
+    // Write a fresh file and swap it in, so readers never see a partial filter
+    fs::create_directories(objectsDir / "info");
+    string path = objectFilterPath(git_dir);
+    string tempPath = path + ".tmp." + to_string(getpid());
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Could not create " + tempPath);
+    }
+    bool written = write(fd, filter.data(), filter.size()) == static_cast<ssize_t>(filter.size());
+    close(fd);
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        throw runtime_error("Could not write " + path);
+    }
+    return count;
+}
+
+// Mappings are shared by every thread of the process; a rebuild replaces the
+// entry while callers still holding the old one finish with it.
+static mutex objectFiltersMutex;
+static map<string, shared_ptr<ObjectFilterMapping>> objectFilters;
+
+static shared_ptr<ObjectFilterMapping> objectFilter(const string& git_dir, bool rebuild = false) {
+    lock_guard<mutex> lock(objectFiltersMutex);
+    auto it = objectFilters.find(git_dir);
+    if (it != objectFilters.end() && !rebuild) {
+        return it->second;
+    }
+    string path = objectFilterPath(git_dir);
+    shared_ptr<ObjectFilterMapping> mapping = rebuild ? nullptr : mapObjectFilter(path);
+    if (!mapping && fs::is_directory(git_dir + "/objects")) {
+        try {
+            rebuildObjectFilter(git_dir);
+            mapping = mapObjectFilter(path);
+        } catch (const exception&) {
+            // Read-only object store: every lookup falls back to stat
+        }
+    }
+    objectFilters[git_dir] = mapping;
+    return mapping;
+}
+
+// False only when the object is certainly not in the store
+bool objectMayExist(const string& sha, const string& git_dir) {
+    shared_ptr<ObjectFilterMapping> filter = objectFilter(git_dir);
+    if (!filter) {
+        return true;
+    }
+    string raw = BytesFromHexSha(sha);
+    const uint64_t* words = filter->words();
+    bool present = true;
+    forEachBit(reinterpret_cast<const unsigned char*>(raw.data()), filter->header()->log2Bits, [&](uint64_t bit) {
+        present = present && (__atomic_load_n(&words[bit / 64], __ATOMIC_RELAXED) & (1ULL << (bit % 64)));
+    });
+    return present;
+}
+
+bool objectExists(const string& sha, const string& git_dir) {
+    struct stat st;
+    return objectMayExist(sha, git_dir) && stat(getFilePathFromSHA(sha, git_dir).c_str(), &st) == 0;
+}
+
+bool freshenObject(const string& sha, const string& git_dir) {
+    if (!objectMayExist(sha, git_dir)) {
+        return false;
+    }
+    string path = getFilePathFromSHA(sha, git_dir);
+    if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == 0) {
+        return true;
+    }
+    // A read-only object store still counts as having the object
+    struct stat st;
+    return errno != ENOENT && stat(path.c_str(), &st) == 0;
+}
+
+void recordObject(const string& sha, const string& git_dir) {
+    shared_ptr<ObjectFilterMapping> filter = objectFilter(git_dir);
+    if (!filter) {
+        return;
+    }
+    string raw = BytesFromHexSha(sha);
+    uint64_t* words = filter->words();
+    forEachBit(reinterpret_cast<const unsigned char*>(raw.data()), filter->header()->log2Bits, [&](uint64_t bit) {
+        __atomic_fetch_or(&words[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+    });
+    // The writer that fills the filter past its capacity rebuilds it twice as large
+    if (__atomic_add_fetch(&filter->header()->count, 1, __ATOMIC_RELAXED) == filter->capacity() + 1) {
+        objectFilter(git_dir, true);
+    }
+}
@@ -0,0 +1,521 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// A ref lives either in its own file under .git/refs (loose) or as a line of
+// .git/packed-refs; a loose file takes precedence. packed-refs is always
+// written sorted by name, so looking a ref up is a binary search over the
+// mapped file rather than a scan, and bulk updates rewrite it once instead
+// of creating a file per ref. Every write holds <ref>.lock for each ref it
+// changes, taken in name order, and then packed-refs.lock if it rewrites
+// packed-refs; the locks are held until the last file is in place.
+
+const string PACKED_REFS_HEADER = "# pack-refs with: peeled fully-peeled sorted \n";
+const string NO_REF = string(40, '0');  // as the expected old value: the ref must not exist yet
+
+static bool isHexSha(string_view value) {
+    return value.size() == 40 && all_of(value.begin(), value.end(), [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    });
+}
+
+static bool durableRefs(const string& git_dir) {
+    return durabilityMode(git_dir) != Durability::Off;
+}
+
+static string firstLine(const string& path) {
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+namespace {
+
+// packed-refs mapped read-only. Lines are "<sha> <name>", each possibly
+// followed by "^<sha>" (what an annotated tag peels to).
+class PackedRefs {
+public:
+    explicit PackedRefs(const string& git_dir) {
+        int fd = open((git_dir + "/packed-refs").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<const char*>(data);
+                size_ = st.st_size;
+            }
+        }
+        close(fd);
+        string_view all(data_, size_);
+        if (all.starts_with("#")) {
+            size_t end = all.find('\n');
+            string_view header = all.substr(0, end);
+            sorted_ = header.find(" sorted ") != string_view::npos || header.ends_with(" sorted");
+            begin_ = end == string_view::npos ? size_ : end + 1;
+        }
+    }
+    ~PackedRefs() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+    PackedRefs(const PackedRefs&) = delete;
+    PackedRefs& operator=(const PackedRefs&) = delete;
+
+    string find(string_view name) const {
+        if (!sorted_) {
+            string found;
+            forEach([&](string_view refName, string_view sha, string_view) {
+                if (refName == name) found = string(sha);
+            });
+            return found;
+        }
+        size_t low = begin_, high = size_;
+        while (low < high) {
+            size_t start = recordStart(low, low + (high - low) / 2);
+            Record record = parseRecord(start);
+            int order = record.name.compare(name);
+            if (order == 0) {
+                return string(record.sha);
+            }
+            if (order < 0) {
+                low = record.end;
+            } else {
+                high = start;
+            }
+        }
+        return "";
+    }
+
+    // visit(name, sha, peeled) in file order; peeled is empty without a "^" line
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        forEachFrom(begin_, "", visit);
+    }
+
+    // The records whose names start with prefix, in name order
+    template <typename Visit>
+    void forEachWithPrefix(string_view prefix, Visit visit) const {
+        if (!sorted_) {
+            forEach([&](string_view name, string_view sha, string_view peeled) {
+                if (name.starts_with(prefix)) visit(name, sha, peeled);
+            });
+            return;
+        }
+        size_t low = begin_, high = size_;
+        while (low < high) {
+            size_t start = recordStart(low, low + (high - low) / 2);
+            Record record = parseRecord(start);
+            if (record.name < prefix) {
+                low = record.end;
+            } else {
+                high = start;
+            }
+        }
+        forEachFrom(low, prefix, visit);
+    }
+
+private:
+    size_t lineEnd(size_t offset) const {
+        const void* newline = memchr(data_ + offset, '\n', size_ - offset);
+        return newline ? static_cast<const char*>(newline) - data_ : size_;
+    }
+
+    // Start of the record holding offset, at or after low
+    size_t recordStart(size_t low, size_t offset) const {
+        while (offset > low && data_[offset - 1] != '\n') {
+            --offset;
+        }
+        // A peel line belongs to the record before it
+        if (data_[offset] == '^' && offset > low) {
+            --offset;
+            while (offset > low && data_[offset - 1] != '\n') {
+                --offset;
+            }
+        }
+        return offset;
+    }
+
+    struct Record {
+        string_view name;  // empty for lines that are not a ref
+        string_view sha;
+        string_view peeled;
+        size_t end;        // start of the next record
+    };
+
+    Record parseRecord(size_t offset) const {
+        size_t end = lineEnd(offset);
+        string_view line(data_ + offset, end - offset);
+        Record record{string_view(), string_view(), string_view(), min(end + 1, size_)};
+        if (record.end < size_ && data_[record.end] == '^') {
+            size_t peelEnd = lineEnd(record.end);
+            record.peeled = string_view(data_ + record.end + 1, peelEnd - record.end - 1);
+            record.end = min(peelEnd + 1, size_);
+        }
+        if (line.size() >= 42 && line[40] == ' ' && isHexSha(line.substr(0, 40))) {
+            record.name = line.substr(41);
+            record.sha = line.substr(0, 40);
+        }
+        return record;
+    }
+
+    // Records from offset on, stopping at the first name without prefix
+    template <typename Visit>
+    void forEachFrom(size_t offset, string_view prefix, Visit visit) const {
+        while (offset < size_) {
+            Record record = parseRecord(offset);
+            if (!record.name.empty()) {
+                if (!record.name.starts_with(prefix)) {
+                    break;
+                }
+                visit(record.name, record.sha, record.peeled);
+            }
+            offset = record.end;
+        }
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t begin_ = 0;
+    bool sorted_ = false;
+};
+
+struct PackedRecord {
+    string sha;
+    string peeled;
+};
+
+map<string, PackedRecord> readPackedRefs(const string& git_dir) {
+    map<string, PackedRecord> refs;
+    PackedRefs(git_dir).forEach([&](string_view name, string_view sha, string_view peeled) {
+        refs[string(name)] = PackedRecord{string(sha), string(peeled)};
+    });
+    return refs;
+}
+
+// Called with packed-refs.lock held
+void writePackedRefs(LockFile& lock, const map<string, PackedRecord>& refs) {
+    string content = PACKED_REFS_HEADER;
+    for (const auto& [name, record] : refs) {
+        content.append(record.sha).append(" ").append(name).push_back('\n');
+        if (!record.peeled.empty()) {
+            content.append("^").append(record.peeled).push_back('\n');
+        }
+    }
+    lock.commit(content);
+}
+
+// Loose ref files below git_dir/prefix, with their SHAs
+void scanLooseRefs(const string& git_dir, const string& prefix, map<string, string>& refs) {
+    fs::path base = fs::path(git_dir);
+    string directory = prefix.ends_with('/') ? prefix : prefix.substr(0, prefix.rfind('/') + 1);
+    error_code ec;
+    for (fs::recursive_directory_iterator it(base / directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file() || it->path().extension() == ".lock") {
+            continue;
+        }
+        string name = it->path().lexically_relative(base).generic_string();
+        if (name.starts_with(prefix)) {
+            string sha = readRef(git_dir, name);
+            if (!sha.empty()) {
+                refs[name] = sha;
+            }
+        }
+    }
+}
+
+// Directories left empty would block a ref of the same name; refs/heads
+// and the like stay
+void removeEmptyParents(const string& path) {
+    for (fs::path parent = fs::path(path).parent_path();
+         parent.parent_path().filename() != "refs" && rmdir(parent.c_str()) == 0; parent = parent.parent_path()) {
+    }
+}
+
+// Removes a loose ref file if it still holds expected (any value when empty)
+void removeLooseRef(const string& git_dir, const string& name, const string& expected = "") {
+    string path = git_dir + "/" + name;
+    if (!fs::is_regular_file(path)) {
+        return;
+    }
+    LockFile lock(path);
+    if (expected.empty() || firstLine(path) == expected) {
+        unlink(path.c_str());
+    }
+    removeEmptyParents(path);
+}
+
+// <ref>.lock for every ref of a transaction, in name order, so it excludes
+// single-ref writes and other transactions over the same refs from its
+// checks to its last write. The lock files are only created, not kept
+// open: a transaction may lock tens of thousands of refs. Directories
+// created only to hold a lock file are removed again with it.
+class RefLocks {
+public:
+    RefLocks(const string& git_dir, const set<string>& names) {
+        for (const string& name : names) {
+            string path = git_dir + "/" + name;
+            error_code ec;
+            fs::create_directories(fs::path(path).parent_path(), ec);
+            int fd = ec ? -1 : ::open((path + ".lock").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                string reason = ec ? "a ref is in the way" : strerror(errno);
+                removeEmptyParents(path);
+                release();
+                throw runtime_error("Unable to create '" + path + ".lock': " + reason +
+                                    ". Another process may be updating it; if not, remove the file.");
+            }
+            close(fd);
+            paths_.push_back(path);
+        }
+    }
+    ~RefLocks() { release(); }
+    RefLocks(const RefLocks&) = delete;
+    RefLocks& operator=(const RefLocks&) = delete;
+
+private:
+    void release() {
+        for (const string& path : paths_) {
+            unlink((path + ".lock").c_str());
+            removeEmptyParents(path);
+        }
+        paths_.clear();
+    }
+
+    vector<string> paths_;
+};
+
+// Throws unless the ref holds expected: anything when empty, nothing when NO_REF
+void checkExpected(const string& git_dir, const string& name, const string& expected) {
+    if (expected.empty()) {
+        return;
+    }
+    string current = readRef(git_dir, name);
+    if (current != (expected == NO_REF ? "" : expected)) {
+        throw runtime_error("Ref " + name + " is at " + (current.empty() ? "nothing" : current) + ", not " +
+                            (expected == NO_REF ? "nothing" : expected));
+    }
+}
+
+} // namespace
+
+// Roughly git check-ref-format: no "..", "@{", control or special
+// characters, empty components, components starting with '.', or ".lock"
+bool isValidRefName(const string& name) {
+    if (!name.starts_with("refs/") || name.ends_with("/") || name.ends_with(".lock") || name.ends_with(".") ||
+        name.find("..") != string::npos || name.find("@{") != string::npos || name.find("//") != string::npos ||
+        name.find("/.") != string::npos) {
+        return false;
+    }
+    return none_of(name.begin(), name.end(), [](unsigned char c) {
+        return c < 0x20 || c == 0x7f || c == ' ' || c == '~' || c == '^' || c == ':' || c == '?' || c == '*' ||
+               c == '[' || c == '\\';
+    });
+}
+
+string readRef(const string& git_dir, const string& name) {
+    string target = name;
+    for (int depth = 0; depth < 5; ++depth) {
+        string path = git_dir + "/" + target;
+        if (!fs::is_regular_file(path)) {
+            return PackedRefs(git_dir).find(target);
+        }
+        string line = firstLine(path);
+        if (line.starts_with("ref: ")) {
+            target = line.substr(5);  // symbolic, such as refs/remotes/origin/HEAD
+            continue;
+        }
+        return isHexSha(line) ? line : "";
+    }
+    return "";
+}
+
+map<string, string> listRefs(const string& git_dir, const string& prefix) {
+    map<string, string> refs;
+    PackedRefs(git_dir).forEachWithPrefix(prefix, [&](string_view name, string_view sha, string_view) {
+        refs.emplace(string(name), string(sha));
+    });
+    scanLooseRefs(git_dir, prefix, refs);
+    return refs;
+}
+
+void writeRef(const string& git_dir, const string& name, const string& sha, const string& expected) {
+    if (!isValidRefName(name)) {
+        throw invalid_argument("Invalid ref name: " + name);
+    }
+    // A ref cannot also be a directory of refs
+    PackedRefs packed(git_dir);
+    for (size_t slash = name.find('/', 5); slash != string::npos; slash = name.find('/', slash + 1)) {
+        if (!packed.find(string_view(name).substr(0, slash)).empty()) {
+            throw runtime_error("Cannot create " + name + ": " + name.substr(0, slash) + " exists");
+        }
+    }
+    bool below = false;
+    packed.forEachWithPrefix(name + "/", [&](string_view, string_view, string_view) { below = true; });
+    string path = git_dir + "/" + name;
+    error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    if (below || ec || fs::is_directory(path)) {
+        throw runtime_error("Cannot create " + name + ": a ref is in the way");
+    }
+    LockFile lock(path, durableRefs(git_dir));
+    checkExpected(git_dir, name, expected);
+    syncObjects(git_dir);  // what the ref names must be on disk first
+    lock.commit(sha + "\n");
+}
+
+// The packed value goes first, so the ref never shows an older packed
+// value behind a removed loose file
+void deleteRef(const string& git_dir, const string& name) {
+    RefLocks refLock(git_dir, {name});
+    if (!PackedRefs(git_dir).find(name).empty()) {
+        LockFile lock(git_dir + "/packed-refs", durableRefs(git_dir));
+        map<string, PackedRecord> packed = readPackedRefs(git_dir);
+        packed.erase(name);
+        writePackedRefs(lock, packed);
+    }
+    unlink((git_dir + "/" + name).c_str());
+}
+
+// Several updates are checked against the current values first and then
+// written to packed-refs in one rewrite; loose files that would shadow the
+// new values are removed afterwards. Nothing is written if any check fails.
+// Every ref's lock is held throughout, so no other writer can change one
+// between its check and the writes.
+void updateRefs(const string& git_dir, const vector<mygit::RefUpdate>& updates, bool initial) {
+    if (updates.size() == 1 && !updates[0].newSha.empty()) {
+        // A single ref only needs its own lock, not a rewrite of packed-refs
+        if (!isHexSha(updates[0].newSha)) {
+            throw invalid_argument("Invalid SHA for " + updates[0].name + ": " + updates[0].newSha);
+        }
+        writeRef(git_dir, updates[0].name, updates[0].newSha, updates[0].oldSha);
+        return;
+    }
+    set<string> updated;
+    for (const auto& update : updates) {
+        if (!isValidRefName(update.name)) {
+            throw invalid_argument("Invalid ref name: " + update.name);
+        }
+        if (!update.newSha.empty() && !isHexSha(update.newSha)) {
+            throw invalid_argument("Invalid SHA for " + update.name + ": " + update.newSha);
+        }
+        if (!updated.insert(update.name).second) {
+            throw invalid_argument("Ref updated twice: " + update.name);
+        }
+    }
+    RefLocks refLocks(git_dir, initial ? set<string>() : updated);
+    LockFile lock(git_dir + "/packed-refs", durableRefs(git_dir));
+    map<string, PackedRecord> packed = readPackedRefs(git_dir);
+    for (const auto& update : updates) {
+        checkExpected(git_dir, update.name, update.oldSha);
+    }
+
+    map<string, string> loose;
+    scanLooseRefs(git_dir, "refs/", loose);
+    for (const auto& update : updates) {
+        if (update.newSha.empty()) {
+            packed.erase(update.name);
+        } else {
+            packed[update.name] = PackedRecord{update.newSha, ""};
+        }
+    }
+    // A ref cannot also be a directory of refs
+    auto exists = [&](const string& name) { return packed.count(name) || (loose.count(name) && !updated.count(name)); };
+    for (const auto& update : updates) {
+        if (update.newSha.empty()) {
+            continue;
+        }
+        for (size_t slash = update.name.find('/', 5); slash != string::npos; slash = update.name.find('/', slash + 1)) {
+            if (exists(update.name.substr(0, slash))) {
+                throw runtime_error("Cannot create " + update.name + ": " + update.name.substr(0, slash) + " exists");
+            }
+        }
+        string below = update.name + "/";
+        auto next = packed.lower_bound(below);
+        auto nextLoose = loose.lower_bound(below);
+        if ((next != packed.end() && next->first.starts_with(below)) ||
+            (nextLoose != loose.end() && nextLoose->first.starts_with(below))) {
+            throw runtime_error("Cannot create " + update.name + ": refs exist below it");
+        }
+    }
+
+    syncObjects(git_dir);
+    writePackedRefs(lock, packed);
+    for (const auto& update : updates) {
+        if (loose.count(update.name)) {
+            unlink((git_dir + "/" + update.name).c_str());
+        }
+    }
+}
+
+// Moves every loose ref into packed-refs. A loose ref that changes or is
+// locked while this runs keeps its file, which then shadows the packed
+// value.
+size_t packRefs(const string& git_dir) {
+    LockFile lock(git_dir + "/packed-refs", durableRefs(git_dir));
+    map<string, PackedRecord> packed = readPackedRefs(git_dir);
+    map<string, string> loose;
+    scanLooseRefs(git_dir, "refs/", loose);
+    for (const auto& [name, sha] : loose) {
+        packed[name] = PackedRecord{sha, ""};
+    }
+    writePackedRefs(lock, packed);
+    for (const auto& [name, sha] : loose) {
+        try {
+            removeLooseRef(git_dir, name, sha);
+        } catch (const runtime_error&) {
+            // a writer holds <ref>.lock and is about to replace the file
+        }
+    }
+    return loose.size();
+}
+
+string headBranch(const string& git_dir) {
+    string head = firstLine(git_dir + "/HEAD");
+    return head.starts_with("ref: refs/heads/") ? head.substr(16) : "";
+}
+
+void setHead(const string& git_dir, const string& target) {
+    if (!isHexSha(target) && !isValidRefName(target)) {
+        throw invalid_argument("Invalid HEAD target: " + target);
+    }
+    LockFile(git_dir + "/HEAD", durableRefs(git_dir)).commit(isHexSha(target) ? target + "\n" : "ref: " + target + "\n");
+}
+
+// A full SHA, HEAD, a full ref name, or a branch or tag name
+string resolveRevision(const string& git_dir, const string& revision) {
+    if (isHexSha(revision)) {
+        return revision;
+    }
+    string sha = revision == "HEAD"             ? getHeadSHA(git_dir)
+                 : revision.starts_with("refs/") ? readRef(git_dir, revision)
+                                                 : "";
+    for (const char* prefix : {"refs/heads/", "refs/tags/"}) {
+        if (sha.empty() && revision != "HEAD" && !revision.starts_with("refs/")) {
+            sha = readRef(git_dir, prefix + revision);
+        }
+    }
+    if (sha.empty()) {
+        throw invalid_argument("Unknown revision: " + revision);
+    }
+    return sha;
+}
@@ -0,0 +1,359 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include "headers.h"
+#include "tree_view.h"
+using namespace std;
+
+// Renames are found in two passes. Deleted and added files with the same
+// blob SHA pair up first without reading anything. The files left over are
+// split into chunks (a line, or 64 bytes of a longer one) and summarised by a
+// MinHash sketch of their chunk hashes. Sketches are cut into bands, and only
+// a source and a destination that share a band somewhere are scored, so the
+// cost follows the number of files rather than their product. The score is
+// git's: the bytes of matching chunks over the size of the larger file.
+
+namespace {
+
+constexpr size_t SKETCH_SIZE = 48;
+constexpr size_t BAND_ROWS = 2;      // 24 bands: pairs at 30% chunk overlap still meet with 90% odds
+constexpr size_t MAX_BUCKET = 64;    // bands shared by more files say nothing about which pairs belong together
+constexpr size_t MAX_CHUNK = 64;
+constexpr size_t LOAD_BATCH = 256;
+const string EMPTY_BLOB = "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391";
+
+using Kind = mygit::TreeChange::Kind;
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+struct Fingerprint {
+    size_t size = 0;
+    vector<pair<uint64_t, uint32_t>> chunks;  // (hash, length), sorted
+    array<uint64_t, SKETCH_SIZE> sketch;
+};
+
+Fingerprint fingerprint(string_view content) {
+    Fingerprint print;
+    print.size = content.size();
+    for (size_t start = 0; start < content.size();) {
+        size_t end = start;
+        while (end < content.size() && end - start < MAX_CHUNK && content[end++] != '\n') {
+        }
+        string_view chunk = content.substr(start, end - start);
+        print.chunks.emplace_back(std::hash<string_view>()(chunk), static_cast<uint32_t>(chunk.size()));
+        start = end;
+    }
+    sort(print.chunks.begin(), print.chunks.end());
+    return print;
+}
+
+// Bytes of chunks found in both files, each occurrence matched once
+size_t commonBytes(const Fingerprint& a, const Fingerprint& b) {
+    size_t common = 0;
+    auto i = a.chunks.begin(), j = b.chunks.begin();
+    while (i != a.chunks.end() && j != b.chunks.end()) {
+        if (i->first < j->first) {
+            ++i;
+        } else if (j->first < i->first) {
+            ++j;
+        } else {
+            common += min(i->second, j->second);
+            ++i;
+            ++j;
+        }
+    }
+    return common;
+}
+
+// MinHash over the distinct chunks that few files share; boilerplate such as
+// blank lines or a licence header would otherwise put every file in one band
+void computeSketches(vector<Fingerprint>& prints) {
+    vector<uint64_t> all;
+    for (const Fingerprint& print : prints) {
+        for (size_t i = 0; i < print.chunks.size(); ++i) {
+            if (i == 0 || print.chunks[i].first != print.chunks[i - 1].first) {
+                all.push_back(print.chunks[i].first);
+            }
+        }
+    }
+    sort(all.begin(), all.end());
+    unordered_set<uint64_t> common;
+    for (size_t i = 0, j; i < all.size(); i = j) {
+        for (j = i + 1; j < all.size() && all[j] == all[i]; ++j) {
+        }
+        if (j - i > MAX_BUCKET) {
+            common.insert(all[i]);
+        }
+    }
+
+    vector<uint64_t> distinct;
+    for (Fingerprint& print : prints) {
+        distinct.clear();
+        for (size_t i = 0; i < print.chunks.size(); ++i) {
+            uint64_t hash = print.chunks[i].first;
+            if ((i == 0 || hash != print.chunks[i - 1].first) && !common.count(hash)) {
+                distinct.push_back(hash);
+            }
+        }
+        if (distinct.empty()) {
+            for (const auto& chunk : print.chunks) {
+                distinct.push_back(chunk.first);
+            }
+        }
+        // One permutation hashing: each chunk lands in one slot, and empty
+        // slots borrow from the next filled one so similar files still agree
+        print.sketch.fill(UINT64_MAX);
+        array<bool, SKETCH_SIZE> filled{};
+        for (uint64_t hash : distinct) {
+            uint64_t value = mix(hash);
+            size_t slot = static_cast<size_t>((static_cast<unsigned __int128>(value) * SKETCH_SIZE) >> 64);
+            print.sketch[slot] = min(print.sketch[slot], value);
+            filled[slot] = true;
+        }
+        for (size_t k = 0; k < SKETCH_SIZE; ++k) {
+            for (size_t step = 1; !filled[k] && step < SKETCH_SIZE; ++step) {
+                if (filled[(k + step) % SKETCH_SIZE]) {
+                    print.sketch[k] = mix(print.sketch[(k + step) % SKETCH_SIZE] + step);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+string_view baseName(const string& path) {
+    size_t slash = path.rfind('/');
+    return string_view(path).substr(slash == string::npos ? 0 : slash + 1);
+}
+
+bool isRegularFile(unsigned int mode) {
+    return mode == 0 || (mode & FILE_MODE_MASK) == REGULAR_FILE_MODE;
+}
+
+struct Match {
+    int score;
+    bool sameName;
+    size_t source, destination;  // indexes into the changes
+};
+
+} // namespace
+
+void detectRenames(vector<mygit::TreeChange>& changes, const ContentLoader& load, int minScore, bool copies) {
+    auto sourceSha = [&](size_t i) -> const string& { return changes[i].oldSha; };
+    auto usable = [](const string& sha, unsigned int mode) {
+        return !sha.empty() && sha != EMPTY_BLOB && (mode & FILE_MODE_MASK) != GITLINK_MODE;
+    };
+
+    vector<size_t> sources, destinations;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        const mygit::TreeChange& change = changes[i];
+        if (change.kind == Kind::Added && usable(change.newSha, change.newMode)) {
+            destinations.push_back(i);
+        } else if ((change.kind == Kind::Deleted || (copies && change.kind == Kind::Modified)) &&
+                   usable(change.oldSha, change.oldMode)) {
+            sources.push_back(i);
+        }
+    }
+    if (sources.empty() || destinations.empty()) {
+        return;
+    }
+
+    vector<bool> renamedAway(changes.size());  // deleted sources already used by a rename
+    vector<bool> matched(changes.size());      // destinations already paired
+    auto assign = [&](size_t source, size_t destination, int score) {
+        mygit::TreeChange& change = changes[destination];
+        bool rename = changes[source].kind == Kind::Deleted && !renamedAway[source];
+        if (!rename && !copies) {
+            return false;
+        }
+        renamedAway[source] = renamedAway[source] || rename;
+        matched[destination] = true;
+        change.kind = rename ? Kind::Renamed : Kind::Copied;
+        change.oldPath = changes[source].path;
+        change.oldMode = changes[source].oldMode;
+        change.oldSha = changes[source].oldSha;
+        change.similarity = score;
+        return true;
+    };
+
+    // Exact renames, preferring a source with the same file name
+    map<string, vector<size_t>> sourcesBySha;
+    for (size_t source : sources) {
+        sourcesBySha[sourceSha(source)].push_back(source);
+    }
+    for (size_t destination : destinations) {
+        auto it = sourcesBySha.find(changes[destination].newSha);
+        if (it == sourcesBySha.end()) {
+            continue;
+        }
+        size_t best = it->second.front();
+        for (size_t source : it->second) {
+            bool available = changes[source].kind == Kind::Deleted && !renamedAway[source];
+            bool bestAvailable = changes[best].kind == Kind::Deleted && !renamedAway[best];
+            if (available && (!bestAvailable || (baseName(changes[source].path) == baseName(changes[destination].path) &&
+                                                 baseName(changes[best].path) != baseName(changes[destination].path)))) {
+                best = source;
+            }
+        }
+        assign(best, destination, 100);
+    }
+
+    // Only regular files are matched by content
+    erase_if(sources, [&](size_t i) {
+        return (!copies && renamedAway[i]) || !isRegularFile(changes[i].oldMode);
+    });
+    erase_if(destinations, [&](size_t i) { return matched[i] || !isRegularFile(changes[i].newMode); });
+
+    if (!sources.empty() && !destinations.empty() && minScore <= 100) {
+        // One fingerprint per distinct blob, loaded in batches so only the
+        // chunk hashes stay in memory
+        map<string, size_t> blobIndex;
+        vector<string> blobs;
+        auto addBlob = [&](const string& sha) {
+            auto [it, inserted] = blobIndex.emplace(sha, blobs.size());
+            if (inserted) {
+                blobs.push_back(sha);
+            }
+            return it->second;
+        };
+        vector<size_t> sourceBlob, destinationBlob;
+        for (size_t source : sources) {
+            sourceBlob.push_back(addBlob(sourceSha(source)));
+        }
+        for (size_t destination : destinations) {
+            destinationBlob.push_back(addBlob(changes[destination].newSha));
+        }
+        vector<Fingerprint> prints;
+        prints.reserve(blobs.size());
+        for (size_t start = 0; start < blobs.size(); start += LOAD_BATCH) {
+            vector<string> batch(blobs.begin() + start, blobs.begin() + min(blobs.size(), start + LOAD_BATCH));
+            for (const string& content : load(batch)) {
+                prints.push_back(fingerprint(content));
+            }
+        }
+        computeSketches(prints);
+
+        // (band key, member) where members below sources.size() are sources
+        vector<std::pair<uint64_t, uint32_t>> bands;
+        bands.reserve((sources.size() + destinations.size()) * (SKETCH_SIZE / BAND_ROWS));
+        auto addBands = [&](size_t blob, uint32_t member) {
+            const auto& sketch = prints[blob].sketch;
+            for (size_t band = 0; band < SKETCH_SIZE / BAND_ROWS; ++band) {
+                uint64_t key = mix(band);
+                for (size_t row = 0; row < BAND_ROWS; ++row) {
+                    key = mix(key ^ sketch[band * BAND_ROWS + row]);
+                }
+                bands.emplace_back(key, member);
+            }
+        };
+        for (size_t i = 0; i < sources.size(); ++i) {
+            addBands(sourceBlob[i], static_cast<uint32_t>(i));
+        }
+        for (size_t i = 0; i < destinations.size(); ++i) {
+            addBands(destinationBlob[i], static_cast<uint32_t>(sources.size() + i));
+        }
+        sort(bands.begin(), bands.end());
+
+        unordered_set<uint64_t> candidates;
+        vector<Match> matches;
+        for (size_t i = 0, j; i < bands.size(); i = j) {
+            for (j = i + 1; j < bands.size() && bands[j].first == bands[i].first; ++j) {
+            }
+            if (j - i > MAX_BUCKET) {
+                continue;
+            }
+            // Members are sorted, sources first
+            size_t firstDestination = i;
+            while (firstDestination < j && bands[firstDestination].second < sources.size()) {
+                ++firstDestination;
+            }
+            for (size_t s = i; s < firstDestination; ++s) {
+                for (size_t d = firstDestination; d < j; ++d) {
+                    size_t source = bands[s].second;
+                    size_t destination = bands[d].second - sources.size();
+                    if (!candidates.insert(uint64_t(source) << 32 | destination).second) {
+                        continue;
+                    }
+                    const Fingerprint& a = prints[sourceBlob[source]];
+                    const Fingerprint& b = prints[destinationBlob[destination]];
+                    size_t larger = max(a.size, b.size);
+                    // Too different in size to reach minScore whatever they share
+                    if (min(a.size, b.size) * 100 < larger * size_t(minScore)) {
+                        continue;
+                    }
+                    size_t common = commonBytes(a, b);
+                    if (common * 100 < larger * size_t(minScore)) {
+                        continue;
+                    }
+                    const string& sourcePath = changes[sources[source]].path;
+                    const string& destinationPath = changes[destinations[destination]].path;
+                    matches.push_back(Match{static_cast<int>(min<size_t>(common * 100 / larger, 99)),
+                                            baseName(sourcePath) == baseName(destinationPath), sources[source],
+                                            destinations[destination]});
+                }
+            }
+        }
+
+        sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+            if (a.score != b.score) return a.score > b.score;
+            if (a.sameName != b.sameName) return a.sameName;
+            if (a.destination != b.destination) return a.destination < b.destination;
+            return a.source < b.source;
+        });
+        for (const Match& match : matches) {
+            if (!matched[match.destination]) {
+                assign(match.source, match.destination, match.score);
+            }
+        }
+    }
+
+    // A renamed file is no longer reported as deleted
+    size_t kept = 0;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (!(renamedAway[i] && changes[i].kind == Kind::Deleted)) {
+            changes[kept++] = std::move(changes[i]);
+        }
+    }
+    changes.resize(kept);
+}
+
+// git's syntax: -M90% is 90%, while bare digits are a fraction, so -M9 and
+// -M90 are both 90%
+bool parseRenameOption(const string& flag, RenameOptions& options) {
+    if (flag.size() < 2 || flag[0] != '-' || (flag[1] != 'M' && flag[1] != 'C')) {
+        return false;
+    }
+    string digits = flag.substr(2);
+    bool percent = !digits.empty() && digits.back() == '%';
+    if (percent) {
+        digits.pop_back();
+    }
+    if (!all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }) ||
+        (percent && digits.empty())) {
+        throw invalid_argument("Invalid similarity in " + flag);
+    }
+    options.enabled = true;
+    options.copies = options.copies || flag[1] == 'C';
+    if (!digits.empty()) {
+        if (percent) {
+            options.minScore = stoi(digits.substr(0, 4));
+        } else {
+            options.minScore = stoi((digits + "00").substr(0, 2));
+        }
+        if (options.minScore > 100) {
+            throw invalid_argument("Invalid similarity in " + flag);
+        }
+    }
+    return true;
+}
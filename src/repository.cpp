@@ -0,0 +1,478 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <thread>
+#include <algorithm>
+#include "headers.h"
+#include "tree_view.h"
+#include "index_view.h"
+#include "commit_graph.h"
+#include <sys/stat.h>
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace mygit {
+
+// Objects are immutable, so an inflated object never goes stale. The parsed
+// index view is reused until the file is replaced or its size or
+// modification time changes.
+class RepositoryCache {
+public:
+    explicit RepositoryCache(size_t maxBytes) : maxBytes_(maxBytes) {}
+
+    shared_ptr<const string> getObject(const string& sha) {
+        lock_guard<mutex> lock(mutex_);
+        auto it = objects_.find(sha);
+        if (it == objects_.end()) {
+            return nullptr;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second.second);
+        return it->second.first;
+    }
+
+    void putObject(const string& sha, shared_ptr<const string> raw) {
+        lock_guard<mutex> lock(mutex_);
+        if (raw->size() > maxBytes_ || objects_.count(sha)) {
+            return;
+        }
+        lru_.push_front(sha);
+        bytes_ += raw->size();
+        objects_[sha] = {std::move(raw), lru_.begin()};
+        while (bytes_ > maxBytes_) {
+            auto victim = objects_.find(lru_.back());
+            bytes_ -= victim->second.first->size();
+            objects_.erase(victim);
+            lru_.pop_back();
+        }
+    }
+
+    shared_ptr<const IndexView> getIndex(const fs::path& indexPath) {
+        // Writers rename a new index into place, so the inode changes too
+        struct stat st;
+        bool exists = ::stat(indexPath.c_str(), &st) == 0;
+
+        lock_guard<mutex> lock(mutex_);
+        if (index_ && exists && st.st_ino == indexInode_ && st.st_size == indexSize_ &&
+            st.st_mtim.tv_sec == indexTime_.tv_sec && st.st_mtim.tv_nsec == indexTime_.tv_nsec) {
+            return index_;
+        }
+        index_ = IndexView::open(indexPath.string());
+        indexInode_ = exists ? st.st_ino : 0;
+        indexSize_ = exists ? st.st_size : 0;
+        indexTime_ = exists ? st.st_mtim : timespec{};
+        return index_;
+    }
+
+    void invalidateIndex() {
+        lock_guard<mutex> lock(mutex_);
+        index_.reset();
+    }
+
+private:
+    mutex mutex_;
+    size_t maxBytes_;
+    size_t bytes_ = 0;
+    list<string> lru_;
+    unordered_map<string, pair<shared_ptr<const string>, list<string>::iterator>> objects_;
+
+    shared_ptr<const IndexView> index_;
+    ino_t indexInode_ = 0;
+    off_t indexSize_ = 0;
+    timespec indexTime_{};
+};
+
+Repository Repository::init(const fs::path& worktree) {
+    fs::create_directories(worktree);
+    fs::path gitDir = worktree / ".git";
+    fs::create_directory(gitDir);
+    fs::create_directory(gitDir / "objects");
+    fs::create_directory(gitDir / "refs");
+
+    ofstream headFile(gitDir / "HEAD");
+    if (!headFile.is_open()) {
+        throw runtime_error("Failed to create .git/HEAD file.");
+    }
+    headFile << "ref: refs/heads/main\n";
+    headFile.close();
+
+    return open(worktree);
+}
+
+Repository Repository::cloneLocal(const fs::path& source, const fs::path& worktree) {
+    ::cloneLocal(source, worktree);
+    return open(worktree);
+}
+
+Repository Repository::open(const fs::path& worktree) {
+    if (!fs::is_directory(worktree / ".git")) {
+        throw runtime_error("Not a git repository: " + worktree.string());
+    }
+    return Repository(fs::canonical(worktree));
+}
+
+void Repository::enableCache(size_t objectCacheBytes) {
+    cache_ = make_shared<RepositoryCache>(objectCacheBytes);
+}
+
+shared_ptr<const string> Repository::readRawObject(const string& sha) const {
+    if (cache_) {
+        if (auto raw = cache_->getObject(sha)) {
+            return raw;
+        }
+    }
+    auto raw = make_shared<const string>(::readObject(sha, gitDir().string()));
+    if (cache_) {
+        cache_->putObject(sha, raw);
+    }
+    return raw;
+}
+
+shared_ptr<const IndexView> Repository::indexSnapshot() const {
+    if (cache_) {
+        return cache_->getIndex(gitDir() / "index");
+    }
+    return IndexView::open((gitDir() / "index").string());
+}
+
+string Repository::hashObject(const string& type, const string& content) const {
+    return calculateSHA1(type + " " + to_string(content.size()) + '\0' + content);
+}
+
+string Repository::writeObject(const string& type, const string& content) {
+    string sha = ::writeObject(type, content, gitDir().string());
+    syncObjects(gitDir().string());
+    return sha;
+}
+
+string Repository::writeBlobFromFile(const fs::path& file) {
+    return writeObject("blob", readFile((file.is_absolute() ? file : worktree_ / file).string()));
+}
+
+Object Repository::readObject(const string& sha) const {
+    auto rawObject = readRawObject(sha);
+    const string& raw = *rawObject;
+    size_t nul = raw.find('\0');
+    size_t space = raw.find(' ');
+    if (nul == string::npos || space == string::npos || space > nul) {
+        throw runtime_error("Malformed object header: " + sha);
+    }
+    return Object{raw.substr(0, space), raw.substr(nul + 1)};
+}
+
+size_t Repository::rebuildObjectFilter() {
+    return ::rebuildObjectFilter(gitDir().string());
+}
+
+vector<TreeItem> Repository::listTree(const string& sha) const {
+    auto raw = readRawObject(sha);
+    vector<TreeItem> items;
+    for (const TreeEntry& entry : TreeView::fromObject(*raw)) {
+        items.push_back({entry.mode, objectTypeForMode(entry.mode), entry.id.hex(), string(entry.name)});
+    }
+    return items;
+}
+
+vector<TreeItem> Repository::listTree(const string& sha, bool recursive, bool showTrees,
+                                     const vector<string>& paths) const {
+    TreeWalkOptions options;
+    options.recursive = recursive;
+    options.showTrees = showTrees;
+    options.paths = paths;
+    // Prefetching overlaps reads, so it pays off even on a single core
+    options.threads = clamp<size_t>(thread::hardware_concurrency(), 4, 8);
+
+    vector<TreeItem> items;
+    walkTree(sha, [this](const string& treeSha) { return readRawObject(treeSha); }, options,
+             [&](const TreeItem& item) { items.push_back(item); });
+    return items;
+}
+
+string Repository::resolveTree(const string& treeOrCommit) const {
+    if (treeOrCommit.empty()) {
+        return treeOrCommit;
+    }
+    string sha = resolveRevision(gitDir().string(), treeOrCommit);
+    string type = readObject(sha).type;
+    if (type == "commit") {
+        return commitTreeSHA(sha, gitDir().string());
+    }
+    if (type != "tree") {
+        throw invalid_argument(treeOrCommit + " is a " + type + ", not a tree or commit");
+    }
+    return sha;
+}
+
+vector<TreeChange> Repository::diffTree(const string& oldSha, const string& newSha) const {
+    vector<TreeChange> changes;
+    diffTrees(resolveTree(oldSha), resolveTree(newSha), [this](const string& treeSha) { return readRawObject(treeSha); },
+              [&](const TreeChange& change) { changes.push_back(change); });
+    return changes;
+}
+
+vector<TreeChange> Repository::diffIndex(const string& treeOrCommit) const {
+    vector<TreeChange> changes;
+    diffTreeWithIndex(resolveTree(treeOrCommit), *indexSnapshot(),
+                      [this](const string& treeSha) { return readRawObject(treeSha); },
+                      [&](const TreeChange& change) { changes.push_back(change); });
+    return changes;
+}
+
+vector<TreeChange> Repository::diffWorktree() const {
+    auto index = indexSnapshot();
+    vector<TreeChange> changes;
+    for (const StatusEntry& entry : worktreeStatus(worktree_, *index)) {
+        if (entry.state == StatusEntry::State::Untracked) {
+            continue;
+        }
+        bool deleted = entry.state == StatusEntry::State::Deleted;
+        changes.push_back(TreeChange{deleted ? TreeChange::Kind::Deleted : TreeChange::Kind::Modified, entry.path, 0, 0,
+                                     string(index->find(entry.path).value_or("")),
+                                     deleted ? "" : hashFileObject((worktree_ / entry.path).string(),
+                                                                   gitDir().string(), false),
+                                     "", 0});
+    }
+    return changes;
+}
+
+void Repository::detectRenames(vector<TreeChange>& changes, bool copies, int minScore) const {
+    string git_dir = gitDir().string();
+    IoBackend backend = ioBackend(git_dir);
+    ::detectRenames(changes, [&](const vector<string>& shas) {
+        vector<string> contents = readObjects(shas, git_dir, backend);
+        for (size_t i = 0; i < shas.size(); ++i) {
+            size_t nul = contents[i].find('\0');
+            if (contents[i].starts_with("blob ") && nul != string::npos) {
+                contents[i].erase(0, nul + 1);
+            } else {
+                contents[i] = readFileContent(shas[i], git_dir);  // chunked
+            }
+        }
+        return contents;
+    }, minScore, copies);
+}
+
+string Repository::patch(const vector<TreeChange>& changes, bool newFromWorktree) const {
+    auto content = [this](const string& sha) {
+        return sha.empty() ? string() : readFileContent(sha, gitDir().string());
+    };
+    string out;
+    for (const TreeChange& change : changes) {
+        string oldText = content(change.oldSha);
+        string newText = !newFromWorktree ? content(change.newSha)
+                         : change.newSha.empty() ? string()
+                                                 : readFile((worktree_ / change.path).string());
+        out += formatFilePatch(change, oldText, newText);
+    }
+    return out;
+}
+
+void Repository::archive(const string& treeOrCommit, ostream& out, bool gzip) const {
+    string git_dir = gitDir().string();
+    string sha = resolveRevision(git_dir, treeOrCommit);
+    if (readObjectType(sha, git_dir) == "commit") {
+        CommitInfo commit = readCommitInfo(sha, git_dir);
+        writeArchive(commit.tree, sha, commit.date, out, gzip, git_dir);
+    } else {
+        writeArchive(resolveTree(sha), "", time(nullptr), out, gzip, git_dir);
+    }
+}
+
+map<string, string> Repository::index() const {
+    return indexSnapshot()->toMap();
+}
+
+void Repository::add(const vector<string>& paths) {
+    addFiles(worktree_, paths);
+    if (cache_) {
+        cache_->invalidateIndex();
+    }
+}
+
+vector<StatusEntry> Repository::status() const {
+    return ::status(worktree_, *indexSnapshot());
+}
+
+string Repository::writeTree() {
+    string sha = ::writeTree(worktree_);
+    syncObjects(gitDir().string());
+    return sha;
+}
+
+string Repository::commitTree(const string& treeSha, const vector<string>& parents, const string& message) {
+    return ::commitTree(treeSha, parents, message, gitDir().string());
+}
+
+string Repository::commit(const string& message) {
+    if (!fs::exists(gitDir() / "index")) {
+        throw runtime_error("Could not open index file");
+    }
+    return ::commit(worktree_, message, *indexSnapshot());
+}
+
+string Repository::head() const {
+    return getHeadSHA(gitDir().string());
+}
+
+string Repository::log() const {
+    return readLog(gitDir().string());
+}
+
+string Repository::log(const vector<string>& paths) const {
+    return filterLog(readLog(gitDir().string()), paths, gitDir().string());
+}
+
+size_t Repository::writeCommitGraph() {
+    return ::writeCommitGraph(gitDir().string());
+}
+
+vector<string> Repository::mergeBases(const string& a, const string& b) const {
+    string git_dir = gitDir().string();
+    return ::mergeBases(resolveRevision(git_dir, a), resolveRevision(git_dir, b), git_dir);
+}
+
+bool Repository::isAncestor(const string& ancestor, const string& descendant) const {
+    string git_dir = gitDir().string();
+    return ::isAncestor(resolveRevision(git_dir, ancestor), resolveRevision(git_dir, descendant), git_dir);
+}
+
+void Repository::checkout(const string& branchOrCommit, bool force) {
+    string git_dir = gitDir().string();
+    string branchRef = "refs/heads/" + branchOrCommit;
+    bool branch = isValidRefName(branchRef) && !readRef(git_dir, branchRef).empty();
+    string commitSha = branch ? readRef(git_dir, branchRef) : resolveRevision(git_dir, branchOrCommit);
+    extractCommit(worktree_, commitSha, force);
+    if (!branch) {
+        startBranchLog(git_dir, "", commitSha);  // logs/HEAD, the detached HEAD's log
+    }
+    setHead(git_dir, branch ? branchRef : commitSha);
+    if (cache_) {
+        cache_->invalidateIndex();
+    }
+}
+
+string Repository::currentBranch() const {
+    return headBranch(gitDir().string());
+}
+
+map<string, string> Repository::branches() const {
+    map<string, string> branches;
+    for (auto& [name, sha] : listRefs(gitDir().string(), "refs/heads/")) {
+        branches.emplace(name.substr(11), sha);
+    }
+    return branches;
+}
+
+void Repository::createBranch(const string& name, const string& startPoint) {
+    string git_dir = gitDir().string();
+    string ref = "refs/heads/" + name;
+    if (name.starts_with("-") || !isValidRefName(ref)) {
+        throw invalid_argument("Invalid branch name: " + name);
+    }
+    if (!readRef(git_dir, ref).empty()) {
+        throw runtime_error("A branch named " + name + " already exists");
+    }
+    string sha = resolveRevision(git_dir, startPoint);
+    if (readObject(sha).type != "commit") {
+        throw invalid_argument(startPoint + " is not a commit");
+    }
+    writeRef(git_dir, ref, sha);
+    startBranchLog(git_dir, name, sha);
+}
+
+void Repository::deleteBranch(const string& name) {
+    string git_dir = gitDir().string();
+    if (name == currentBranch()) {
+        throw runtime_error("Cannot delete branch " + name + ": HEAD is on it");
+    }
+    string ref = "refs/heads/" + name;
+    if (!isValidRefName(ref) || readRef(git_dir, ref).empty()) {
+        throw invalid_argument("No branch named " + name);
+    }
+    deleteRef(git_dir, ref);
+    fs::remove(logPath(git_dir, name));
+}
+
+map<string, string> Repository::refs(const string& prefix) const {
+    return listRefs(gitDir().string(), prefix);
+}
+
+void Repository::updateRefs(const vector<RefUpdate>& updates) {
+    ::updateRefs(gitDir().string(), updates);
+}
+
+size_t Repository::packRefs() {
+    return ::packRefs(gitDir().string());
+}
+
+void Repository::setSparseCheckout(const vector<string>& directories) {
+    writeSparseCone(gitDir().string(), directories);
+    if (!head().empty()) {
+        extractCommit(worktree_, head(), true);  // files outside the old cone were never checked out
+    }
+}
+
+void Repository::disableSparseCheckout() {
+    disableSparseCone(gitDir().string());
+    if (!head().empty()) {
+        extractCommit(worktree_, head(), true);  // files outside the old cone were never checked out
+    }
+}
+
+vector<string> Repository::sparseCheckoutDirectories() const {
+    SparseCone cone = readSparseCone(gitDir().string());
+    return vector<string>(cone.recursive.begin(), cone.recursive.end());
+}
+
+GcResult Repository::gc(const string& expiry) {
+    string git_dir = gitDir().string();
+    return collectGarbage(git_dir, parseExpiry(expiry.empty() ? getConfigValue(git_dir, "gc.pruneExpire", "14d") : expiry));
+}
+
+FsckResult Repository::fsck(const function<void(size_t, size_t)>& progress) const {
+    return fsckObjects(gitDir().string(), progress);
+}
+
+ObjectCount Repository::countObjects() const {
+    string git_dir = gitDir().string();
+    ObjectCount count;
+    for (const string& raw : listLooseObjects(git_dir)) {
+        struct stat st;
+        string sha = to_hex_string(reinterpret_cast<const unsigned char*>(raw.data()), raw.size());
+        if (::stat(getFilePathFromSHA(sha, git_dir).c_str(), &st) == 0) {
+            ++count.objects;
+            count.bytes += st.st_size;
+        }
+    }
+    return count;
+}
+
+size_t Repository::countReachableObjects() const {
+    return ::countReachableObjects(gitDir().string());
+}
+
+BitmapWriteResult Repository::writeBitmaps() {
+    return writeReachabilityBitmaps(gitDir().string());
+}
+
+bool Repository::startFsmonitor() {
+    return fsmonitorStart(worktree_);
+}
+
+bool Repository::stopFsmonitor() {
+    return fsmonitorStop(worktree_);
+}
+
+string Repository::fsmonitorToken() const {
+    return fsmonitorPing(worktree_);
+}
+
+void Repository::serve(const string& socketPath, size_t threads) const {
+    serveRepository(*this, socketPath, threads);
+}
+
+} // namespace mygit
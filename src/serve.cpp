@@ -0,0 +1,274 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Wire protocol: each request is one line of tab-separated fields, e.g.
+// "cat-file\t-p\t<sha>\n". Each reply is "ok <length>\n" or "error <length>\n"
+// followed by exactly <length> bytes of payload. A connection may carry any
+// number of requests.
+
+static atomic<bool> stopRequested{false};
+
+static void handleStopSignal(int) {
+    stopRequested = true;
+}
+
+static vector<string> splitFields(const string& line) {
+    vector<string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab - start));
+        if (tab == string::npos) break;
+        start = tab + 1;
+    }
+    return fields;
+}
+
+// Run one request. Readers share the lock; anything that writes objects, the
+// index or refs holds it exclusively.
+static string runRequest(mygit::Repository& repo, shared_mutex& repoLock, const vector<string>& args) {
+    const string& command = args[0];
+
+    if (command == "cat-file" && args.size() == 3) {
+        shared_lock<shared_mutex> lock(repoLock);
+        mygit::Object object = repo.readObject(args[2]);
+        if (args[1] == "-t") return object.type + "\n";
+        if (args[1] == "-s") return to_string(object.content.size()) + "\n";
+        if (args[1] == "-p") {
+            return object.type == "tree" ? formatTree(repo.listTree(args[2]), false) : object.content;
+        }
+    } else if (command == "ls-tree" && (args.size() == 2 || (args.size() == 3 && args[1] == "--name-only"))) {
+        shared_lock<shared_mutex> lock(repoLock);
+        return formatTree(repo.listTree(args.back()), args.size() == 3);
+    } else if (command == "hash-object" && (args.size() == 2 || (args.size() == 3 && args[1] == "-w"))) {
+        fs::path file = args.back();
+        if (args.size() == 3) {
+            unique_lock<shared_mutex> lock(repoLock);
+            return repo.writeBlobFromFile(file) + "\n";
+        }
+        shared_lock<shared_mutex> lock(repoLock);
+        return repo.hashObject("blob", readFile((file.is_absolute() ? file : repo.worktree() / file).string())) + "\n";
+    } else if (command == "diff-tree" && args.size() == 3) {
+        shared_lock<shared_mutex> lock(repoLock);
+        return formatTreeChanges(repo.diffTree(args[1], args[2]), DiffFormat::Raw);
+    } else if (command == "status" && args.size() == 1) {
+        shared_lock<shared_mutex> lock(repoLock);
+        return formatStatus(repo.status());
+    } else if (command == "add" && args.size() >= 2) {
+        unique_lock<shared_mutex> lock(repoLock);
+        repo.add(vector<string>(args.begin() + 1, args.end()));
+        return "Files added to index.\n";
+    } else if (command == "commit" && args.size() == 3 && args[1] == "-m") {
+        unique_lock<shared_mutex> lock(repoLock);
+        return repo.commit(args[2]) + "\n";
+    }
+    throw invalid_argument("Unsupported request: " + command);
+}
+
+static bool writeAll(int fd, const string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// A client connection, owned by the polling thread. It is left out of the
+// poll set while a worker runs one of its requests, so replies keep request
+// order and a client sending faster than it is served cannot grow the buffer.
+struct Connection {
+    string buffer;
+    bool busy = false;
+    bool closed = false;  // the peer hung up or a reply could not be sent
+};
+
+void serveRepository(mygit::Repository repo, const string& socketPath, size_t threads) {
+    // Everything that benefits from staying warm lives in the shared cache
+    repo.enableCache();
+    shared_mutex repoLock;
+
+    sockaddr_un addr{};
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        throw invalid_argument("Socket path is too long: " + socketPath);
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        throw runtime_error("Failed to create socket.");
+    }
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 64) < 0) {
+        close(listenFd);
+        throw runtime_error("Failed to listen on " + socketPath + ": " + strerror(errno));
+    }
+
+    stopRequested = false;
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+
+    // Workers report finished requests through this pipe to wake up poll()
+    int wakeFds[2];
+    if (pipe2(wakeFds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+        throw runtime_error(string("Failed to create pipe: ") + strerror(errno));
+    }
+
+    // Fixed pool of workers, each running one request at a time from any connection
+    mutex queueMutex;
+    condition_variable queueReady;
+    deque<pair<int, string>> pending;    // client fd, request line
+    vector<pair<int, bool>> finished;    // client fd, whether the reply was sent
+    bool closing = false;
+    vector<thread> workers;
+    for (size_t i = 0; i < max<size_t>(threads, 1); ++i) {
+        workers.emplace_back([&] {
+            while (true) {
+                pair<int, string> request;
+                {
+                    unique_lock<mutex> lock(queueMutex);
+                    queueReady.wait(lock, [&] { return closing || !pending.empty(); });
+                    if (pending.empty()) return;
+                    request = std::move(pending.front());
+                    pending.pop_front();
+                }
+                string status = "ok";
+                string payload;
+                try {
+                    payload = runRequest(repo, repoLock, splitFields(request.second));
+                } catch (const exception& e) {
+                    status = "error";
+                    payload = string(e.what()) + "\n";
+                }
+                bool sent = writeAll(request.first, status + " " + to_string(payload.size()) + "\n" + payload);
+                {
+                    lock_guard<mutex> lock(queueMutex);
+                    finished.emplace_back(request.first, sent);
+                }
+                char wake = 0;
+                (void)!write(wakeFds[1], &wake, 1);
+            }
+        });
+    }
+
+    cerr << "Serving " << repo.worktree().string() << " on " << socketPath << " with "
+         << workers.size() << " threads\n";
+
+    unordered_map<int, Connection> connections;
+
+    // Hand the connection's next complete line to the workers, or close it
+    // once it has hung up and nothing is left to run
+    auto dispatch = [&](int clientFd) {
+        Connection& connection = connections.at(clientFd);
+        if (connection.busy) return;
+        size_t newline;
+        while ((newline = connection.buffer.find('\n')) != string::npos) {
+            string line = connection.buffer.substr(0, newline);
+            connection.buffer.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            connection.busy = true;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                pending.emplace_back(clientFd, std::move(line));
+            }
+            queueReady.notify_one();
+            return;
+        }
+        if (connection.closed) {
+            close(clientFd);
+            connections.erase(clientFd);
+        }
+    };
+
+    vector<pollfd> polled;
+    char chunk[4096];
+    while (!stopRequested) {
+        polled.assign({{listenFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}});
+        for (const auto& [clientFd, connection] : connections) {
+            if (!connection.busy && !connection.closed) {
+                polled.push_back({clientFd, POLLIN, 0});
+            }
+        }
+        // Wake up regularly to notice a stop request
+        if (poll(polled.data(), polled.size(), 200) <= 0) continue;
+
+        if (polled[1].revents) {
+            while (read(wakeFds[0], chunk, sizeof(chunk)) > 0) {
+            }
+            vector<pair<int, bool>> done;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                done.swap(finished);
+            }
+            for (const auto& [clientFd, sent] : done) {
+                Connection& connection = connections.at(clientFd);
+                connection.busy = false;
+                if (!sent) {
+                    connection.closed = true;
+                    connection.buffer.clear();
+                }
+                dispatch(clientFd);
+            }
+        }
+        for (size_t i = 2; i < polled.size(); ++i) {
+            if (!polled[i].revents) continue;
+            int clientFd = polled[i].fd;
+            ssize_t n = recv(clientFd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0) {
+                connections.at(clientFd).buffer.append(chunk, n);
+            } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+                connections.at(clientFd).closed = true;
+            }
+            dispatch(clientFd);
+        }
+        if (polled[0].revents & POLLIN) {
+            int clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (clientFd >= 0) {
+                connections.emplace(clientFd, Connection{});
+            }
+        }
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    {
+        lock_guard<mutex> lock(queueMutex);
+        closing = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const auto& [clientFd, connection] : connections) {
+        close(clientFd);
+    }
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+}
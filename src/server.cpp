@@ -1,15 +1,10 @@
 #include <iostream>
 #include <filesystem>
-#include <fstream>
 #include <string>
-#include <zlib.h>
-#include <cstring>
-#include <openssl/sha.h>
 #include <sstream>
-#include <iomanip>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <thread>
 #include <vector>
+#include <unistd.h>
 #include "headers.h"
 using namespace std;
 
@@ -28,34 +23,47 @@ int main(int argc, char *argv[])
         cerr << "No command provided.\n";
         return EXIT_FAILURE;
     }
-    
+
     string command = argv[1];
-    
+
     if (command == "init") {
         try {
-            filesystem::create_directory(".git");
-            filesystem::create_directory(".git/objects");
-            filesystem::create_directory(".git/refs");
-    
-            ofstream headFile(".git/HEAD");
-            if (headFile.is_open()) {
-                headFile << "ref: refs/heads/main\n";
-                headFile.close();
-            } else {
-                cerr << "Failed to create .git/HEAD file.\n";
-                return EXIT_FAILURE;
-            }
-    
+            mygit::Repository::init(filesystem::current_path());
             cout << "Initialized git directory\n";
-        } catch (const filesystem::filesystem_error& e) {
+        } catch (const exception& e) {
             cerr << e.what() << '\n';
             return EXIT_FAILURE;
         }
-    } else if(command == "cat-file"){
-        try{
-            if (argc < 4 &&(string(argv[2]) != "-p" || string(argv[2]) != "-t" || string(argv[2]) != "-s")) {
-            cerr << "Missing parameter: -p <hash>\n";
+        return EXIT_SUCCESS;
+    }
+
+    if (command == "clone") {
+        // clone [--local] <source> <destination>: only local sources exist
+        vector<string> args(argv + 2, argv + argc);
+        if (!args.empty() && args[0] == "--local") {
+            args.erase(args.begin());
+        }
+        if (args.size() != 2) {
+            cerr << "Usage: clone --local <source> <destination>\n";
             return EXIT_FAILURE;
+        }
+        try {
+            mygit::Repository::cloneLocal(args[0], args[1]);
+            cout << "Cloned into " << args[1] << "\n";
+        } catch (const exception& e) {
+            cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    try {
+        mygit::Repository repo = mygit::Repository::open(filesystem::current_path());
+
+        if(command == "cat-file"){
+            if (argc < 4 || (string(argv[2]) != "-p" && string(argv[2]) != "-t" && string(argv[2]) != "-s")) {
+                cerr << "Missing parameter: -p <hash>\n";
+                return EXIT_FAILURE;
             }
 
             string hash = argv[3];
@@ -64,184 +72,396 @@ int main(int argc, char *argv[])
                 return 1;
             }
             string commandFlag = argv[2];
-            string filePath = getFilePathFromSHA(hash);
-            decompressGitObjectChunkwise(filePath,hash,commandFlag);
-        } catch(const exception& ex){
-            cerr << "Error: " << ex.what() << endl;
-            return 1;
-        }
-    } else if(command == "hash-object"){
-        try
-        {
-            if (argc < 4 || string(argv[2]) != "-w") {
-            cerr << "Missing parameter: -w\n";
-            return EXIT_FAILURE;
+            mygit::Object object = repo.readObject(hash);
+            if (commandFlag == "-t") {
+                cout << object.type << endl;
+            } else if (commandFlag == "-s") {
+                cout << object.content.size() << endl;
+            } else if (object.type == "tree") {
+                string tree = formatTree(repo.listTree(hash), false);
+                cout.write(tree.data(), tree.size());
+            } else {
+                cout.write(object.content.data(), object.content.size());
             }
-            string filename = argv[3];
-            string content = readFile(filename);
-            string blobHeader = "blob " +to_string(content.size()) + '\0';
-            string blobContent = blobHeader + content;
-            string sha1 = calculateSHA1(blobContent);
-            string compressedContent = compressContent(blobContent);
-            
-            storeCompressedFile(sha1, compressedContent);
-            cout << sha1 << endl;
-        }
-        catch(const exception& e)
-        {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-        
-    } else if(command == "ls-tree"){
-        try{
-           if (argc < 3) {
-                cerr << "Missing parameters\n";
+        } else if(command == "hash-object"){
+            if (argc < 4 || string(argv[2]) != "-w") {
+                cerr << "Missing parameter: -w\n";
                 return EXIT_FAILURE;
-            } 
-            if (argc == 4 && string(argv[2]) != "--name-only") {
-                cerr << "Missing parameter: --name-only <hash>\n";
+            }
+            cout << repo.writeBlobFromFile(argv[3]) << endl;
+        } else if(command == "ls-tree"){
+            bool nameOnly = false, recursive = false, showTrees = false;
+            int argi = 2;
+            for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+                string flag = argv[argi];
+                if (flag == "--name-only") {
+                    nameOnly = true;
+                } else if (flag == "-r") {
+                    recursive = true;
+                } else if (flag == "-t") {
+                    showTrees = true;
+                } else {
+                    cerr << "Unknown option " << flag << '\n';
+                    return EXIT_FAILURE;
+                }
+            }
+            if (argi >= argc) {
+                cerr << "Usage: ls-tree [-r] [-t] [--name-only] <hash> [<path>...]\n";
                 return EXIT_FAILURE;
             }
 
-            if(argc == 3){
-                string hash = argv[2];
-                if (hash.size() != 40) {
-                    cerr << "Invalid Git blob hash length.\n";
-                    return 1;
+            string hash = argv[argi];
+            if (hash.size() != 40) {
+                cerr << "Invalid Git blob hash length.\n";
+                return 1;
+            }
+            vector<string> paths(argv + argi + 1, argv + argc);
+            string tree = (recursive || showTrees || !paths.empty())
+                              ? formatTree(repo.listTree(hash, recursive, showTrees, paths), nameOnly)
+                              : formatTree(repo.listTree(hash), nameOnly);
+            cout.write(tree.data(), tree.size());
+        } else if (command == "diff-tree") {
+            DiffFormat format = DiffFormat::Raw;
+            RenameOptions renames;
+            int argi = 2;
+            for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+                string flag = argv[argi];
+                if (flag == "--name-only") {
+                    format = DiffFormat::NameOnly;
+                } else if (flag == "--name-status") {
+                    format = DiffFormat::NameStatus;
+                } else if (!parseRenameOption(flag, renames)) {
+                    cerr << "Unknown option " << flag << '\n';
+                    return EXIT_FAILURE;
                 }
-                read_and_decompress_git_object(hash,false);
-            } else {
-                string hash = argv[3];
-                if (hash.size() != 40) {
-                    cerr << "Invalid Git blob hash length.\n";
-                    return 1;
+            }
+            if (argc - argi != 2) {
+                cerr << "Usage: diff-tree [--name-only|--name-status] [-M[<n>]|-C[<n>]] <tree-or-commit> "
+                        "<tree-or-commit>\n";
+                return EXIT_FAILURE;
+            }
+            vector<mygit::TreeChange> changes = repo.diffTree(argv[argi], argv[argi + 1]);
+            if (renames.enabled) {
+                repo.detectRenames(changes, renames.copies, renames.minScore);
+            }
+            string output = formatTreeChanges(changes, format);
+            cout.write(output.data(), output.size());
+        } else if (command == "diff") {
+            RenameOptions renames;
+            bool cached = false;
+            int argi = 2;
+            for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+                string flag = argv[argi];
+                if (flag == "--cached") {
+                    cached = true;
+                } else if (!parseRenameOption(flag, renames)) {
+                    cerr << "Unknown option " << flag << '\n';
+                    return EXIT_FAILURE;
                 }
-                read_and_decompress_git_object(hash,true);
-                
             }
-        }
-        catch(const exception& e)
-        {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if(command == "write-tree"){
-        try{
-            if (argc < 2)
-            {
-                cerr << "Invalid command.\n";
+            vector<mygit::TreeChange> changes;
+            int operands = argc - argi;
+            if (!cached && operands == 0) {
+                changes = repo.diffWorktree();
+            } else if (cached && operands <= 1) {
+                changes = repo.diffIndex(operands == 1 ? argv[argi] : repo.head());
+            } else if (!cached && operands == 2) {
+                changes = repo.diffTree(argv[argi], argv[argi + 1]);
+            } else {
+                cerr << "Usage: diff [-M[<n>]|-C[<n>]] [--cached [<commit>] | <old> <new>]\n";
                 return EXIT_FAILURE;
             }
-            filesystem::path cwd = filesystem::current_path();
-
-
-            return writeTree(cwd);
-        }
-        catch(const exception& e)
-        {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if(command == "commit-tree"){
-        try{
-            if (argc != 7 && argc != 5)
+            if (renames.enabled) {
+                repo.detectRenames(changes, renames.copies, renames.minScore);
+            }
+            string patch = repo.patch(changes, !cached && operands == 0);
+            cout.write(patch.data(), patch.size());
+        } else if(command == "write-tree"){
+            cout << repo.writeTree() << endl;
+        } else if(command == "commit-tree"){
+            // commit-tree <tree> [-p <parent>]... -m <message>
+            if (argc < 5 || argc % 2 == 0)
             {
                 cerr << "Invalid command.\n";
                 return EXIT_FAILURE;
             }
 
-        string sha = argv[2];
-        string flag1 = "";
-        string sha_parent = "";
-        string flag2 = "";
-        string message = "";
-        if(argc == 7){
-            flag1 =  argv[3];
-            sha_parent = argv[4];
-            flag2 =  argv[5];
-            message = argv[6];
-            if(flag2 != "-m"){
-                cerr << "Missing parameter: -m\n";
-                return EXIT_FAILURE;
-            }
-        }else if(argc == 5){
-            flag2 =  argv[3];
-            message = argv[4];
-            if (flag2 != "-m") {
+            string sha = argv[2];
+            vector<string> parents;
+            for (int i = 3; i < argc - 2; i += 2) {
+                if (string(argv[i]) != "-p") {
+                    cerr << "Unknown parameter: " << argv[i] << "\n";
+                    return EXIT_FAILURE;
+                }
+                parents.push_back(argv[i + 1]);
+            }
+            if (string(argv[argc - 2]) != "-m") {
                 cerr << "Missing or incorrect parameter: expected '-m'\n";
                 return EXIT_FAILURE;
             }
-        }
-        commitTree(flag1, sha_parent, flag2, message, sha);
-        return 0;
-        }
-        catch(const exception& e){
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if(argc > 1 && std::string(argv[1]) == "add"){
-        try {
+            string message = argv[argc - 1];
+            cout << repo.commitTree(sha, parents, message) << "\n";
+        } else if(command == "add"){
             if (argc < 3) {
-            cerr << "Missing parameters for add command.\n";
-            return EXIT_FAILURE;
+                cerr << "Missing parameters for add command.\n";
+                return EXIT_FAILURE;
             }
 
             std::vector<std::string> paths;
             for (int i = 2; i < argc; ++i) {
                 paths.push_back(argv[i]);
             }
-            addFiles(paths);
-        }
-        catch (const exception& e) {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if(argc > 1 && std::string(argv[1]) == "commit"){
-        try {
+            repo.add(paths);
+            cout << "Files added to index." << endl;
+        } else if(command == "commit"){
             std::string message;
             if (argc == 2) {
-            message = "Default commit message";
+                message = "Default commit message";
             } else if (argc == 4 && std::string(argv[2]) == "-m") {
                 message = argv[3];
             } else {
-            cerr << "Invalid parameters for commit command.\n";
-            return EXIT_FAILURE;
+                cerr << "Invalid parameters for commit command.\n";
+                return EXIT_FAILURE;
+            }
+            cout << repo.commit(message) << "\n";
+        } else if(command == "log"){
+            if (argc > 2 && string(argv[2]) != "--") {
+                cerr << "Usage: log [-- <path>...]\n";
+                return EXIT_FAILURE;
+            }
+            string log = argc > 3 ? repo.log(vector<string>(argv + 3, argv + argc)) : repo.log();
+            cout.write(log.data(), log.size());
+        } else if (command == "commit-graph") {
+            if (argc != 3 || string(argv[2]) != "write") {
+                cerr << "Usage: commit-graph write\n";
+                return EXIT_FAILURE;
+            }
+            cout << "Wrote commit graph for " << repo.writeCommitGraph() << " commits\n";
+        } else if (command == "archive") {
+            // archive [--format=tar|tar.gz] <tree-ish>
+            bool gzip = false;
+            string treeish;
+            for (int i = 2; i < argc; ++i) {
+                string arg = argv[i];
+                if (arg == "--format=tar" || arg == "--format=tar.gz" || arg == "--format=tgz") {
+                    gzip = arg != "--format=tar";
+                } else if (!arg.starts_with("-") && treeish.empty()) {
+                    treeish = arg;
+                } else {
+                    treeish.clear();
+                    break;
+                }
+            }
+            if (treeish.empty()) {
+                cerr << "Usage: archive [--format=tar|tar.gz] <tree-ish>\n";
+                return EXIT_FAILURE;
+            }
+            cout << nounitbuf;
+            repo.archive(treeish, cout, gzip);
+        } else if (command == "merge-base") {
+            vector<string> args(argv + 2, argv + argc);
+            bool all = !args.empty() && args[0] == "--all";
+            bool isAncestor = !args.empty() && args[0] == "--is-ancestor";
+            if (all || isAncestor) {
+                args.erase(args.begin());
+            }
+            if (args.size() != 2) {
+                cerr << "Usage: merge-base [--all] <commit> <commit> | --is-ancestor <commit> <commit>\n";
+                return EXIT_FAILURE;
+            }
+            if (isAncestor) {
+                return repo.isAncestor(args[0], args[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+            vector<string> bases = repo.mergeBases(args[0], args[1]);
+            for (size_t i = 0; i < bases.size() && (all || i == 0); ++i) {
+                cout << bases[i] << '\n';
+            }
+            if (bases.empty()) {
+                return EXIT_FAILURE;
+            }
+        } else if (command == "checkout") {
+            bool force = argc == 4 && std::string(argv[2]) == "-f";
+            if (argc != 3 && !force) {
+                std::cerr << "Usage: checkout [-f] <branch|sha>\n";
+                return EXIT_FAILURE;
+            }
+            try {
+                repo.checkout(argv[argc - 1], force);
+            } catch (const std::exception& e) {
+                std::cerr << "Error during checkout: " << e.what() << '\n';
+                return EXIT_FAILURE;
+            }
+        } else if (command == "branch") {
+            if (argc == 2) {
+                string current = repo.currentBranch();
+                for (const auto& [name, sha] : repo.branches()) {
+                    cout << (name == current ? "* " : "  ") << name << '\n';
+                }
+            } else if (string(argv[2]) == "-d" && argc == 4) {
+                repo.deleteBranch(argv[3]);
+            } else if (argv[2][0] != '-' && argc <= 4) {
+                repo.createBranch(argv[2], argc == 4 ? argv[3] : "HEAD");
+            } else {
+                cerr << "Usage: branch [<name> [<start>] | -d <name>]\n";
+                return EXIT_FAILURE;
+            }
+        } else if (command == "show-ref") {
+            string output;
+            for (const auto& [name, sha] : repo.refs(argc == 3 ? argv[2] : "refs/")) {
+                output.append(sha).append(" ").append(name).push_back('\n');
+            }
+            cout.write(output.data(), output.size());
+        } else if (command == "update-ref") {
+            vector<mygit::RefUpdate> updates;
+            if (argc == 3 && string(argv[2]) == "--stdin") {
+                // update <ref> <new> [<old>] | create <ref> <new> | delete <ref> [<old>]
+                string line;
+                while (getline(cin, line)) {
+                    istringstream fields(line);
+                    string action, name, newSha, oldSha;
+                    fields >> action >> name;
+                    if (action == "update" || action == "create") {
+                        fields >> newSha;
+                    }
+                    fields >> oldSha;
+                    if (action == "create") {
+                        oldSha = string(40, '0');
+                    } else if (action != "update" && action != "delete") {
+                        cerr << "Unknown update-ref command: " << line << '\n';
+                        return EXIT_FAILURE;
+                    }
+                    updates.push_back(mygit::RefUpdate{name, newSha, oldSha});
+                }
+            } else if (argc == 4 && string(argv[2]) == "-d") {
+                updates.push_back(mygit::RefUpdate{argv[3], "", ""});
+            } else if (argc == 4 || argc == 5) {
+                updates.push_back(mygit::RefUpdate{argv[2], argv[3], argc == 5 ? argv[4] : ""});
+            } else {
+                cerr << "Usage: update-ref <ref> <new> [<old>] | -d <ref> | --stdin\n";
+                return EXIT_FAILURE;
+            }
+            repo.updateRefs(updates);
+        } else if (command == "pack-refs") {
+            cout << "Packed " << repo.packRefs() << " refs" << endl;
+        } else if (command == "sparse-checkout") {
+            string action = argc >= 3 ? argv[2] : "";
+            if (action == "set" && argc >= 4) {
+                repo.setSparseCheckout(vector<string>(argv + 3, argv + argc));
+            } else if (action == "disable" && argc == 3) {
+                repo.disableSparseCheckout();
+            } else if (action == "list" && argc == 3) {
+                for (const auto& directory : repo.sparseCheckoutDirectories()) {
+                    cout << directory << '\n';
+                }
+            } else {
+                cerr << "Usage: sparse-checkout <set <dir>...|disable|list>\n";
+                return EXIT_FAILURE;
+            }
+        } else if (command == "status") {
+            cout << formatStatus(repo.status());
+        } else if (command == "serve") {
+            if (argc != 4 && argc != 6) {
+                cerr << "Usage: serve --socket <path> [--threads <n>]\n";
+                return EXIT_FAILURE;
+            }
+            string socketPath;
+            size_t threads = max(2u, std::thread::hardware_concurrency());
+            for (int i = 2; i + 1 < argc; i += 2) {
+                if (string(argv[i]) == "--socket") {
+                    socketPath = argv[i + 1];
+                } else if (string(argv[i]) == "--threads") {
+                    threads = stoul(argv[i + 1]);
+                } else {
+                    cerr << "Unknown option " << argv[i] << '\n';
+                    return EXIT_FAILURE;
+                }
+            }
+            if (socketPath.empty()) {
+                cerr << "Missing parameter: --socket <path>\n";
+                return EXIT_FAILURE;
+            }
+            repo.serve(socketPath, threads);
+        } else if (command == "gc") {
+            string expiry;
+            if (argc == 3 && string(argv[2]).rfind("--prune=", 0) == 0 && string(argv[2]).size() > 8) {
+                expiry = string(argv[2]).substr(8);
+            } else if (argc != 2) {
+                cerr << "Usage: gc [--prune=<age>|now|never]\n";
+                return EXIT_FAILURE;
+            }
+            mygit::GcResult result = repo.gc(expiry);
+            cout << "Pruned " << result.pruned << " unreachable objects, kept " << result.reachable
+                 << " reachable and " << result.kept << " recent unreachable objects" << endl;
+        } else if (command == "bitmap") {
+            if (argc != 3 || string(argv[2]) != "write") {
+                cerr << "Usage: bitmap write\n";
+                return EXIT_FAILURE;
+            }
+            mygit::BitmapWriteResult result = repo.writeBitmaps();
+            cout << "Wrote " << result.bitmaps << " bitmaps for " << result.objects << " objects" << endl;
+        } else if (command == "count-objects") {
+            if (argc == 3 && string(argv[2]) == "--reachable") {
+                cout << repo.countReachableObjects() << " reachable objects" << endl;
+            } else if (argc == 2) {
+                mygit::ObjectCount count = repo.countObjects();
+                cout << count.objects << " objects, " << count.bytes / 1024 << " kilobytes" << endl;
+            } else {
+                cerr << "Usage: count-objects [--reachable]\n";
+                return EXIT_FAILURE;
+            }
+        } else if (command == "fsck") {
+            bool showProgress = isatty(STDERR_FILENO);
+            if (argc == 3 && string(argv[2]) == "--no-progress") {
+                showProgress = false;
+            } else if (argc != 2) {
+                cerr << "Usage: fsck [--no-progress]\n";
+                return EXIT_FAILURE;
+            }
+            function<void(size_t, size_t)> progress = [](size_t done, size_t total) {
+                cerr << "\rChecking objects: " << (total ? done * 100 / total : 100) << "% (" << done << "/" << total << ")";
+                if (done == total) cerr << '\n';
+            };
+            mygit::FsckResult result = repo.fsck(showProgress ? progress : nullptr);
+            for (const auto& problem : result.problems) {
+                cout << problem << '\n';
+            }
+            cout << "Checked " << result.objects << " objects: " << result.problems.size() << " problems, "
+                 << result.dangling << " dangling" << endl;
+            if (!result.problems.empty()) {
+                return EXIT_FAILURE;
+            }
+        } else if (command == "object-filter") {
+            if (argc != 3 || string(argv[2]) != "rebuild") {
+                cerr << "Usage: object-filter rebuild\n";
+                return EXIT_FAILURE;
+            }
+            cout << "Indexed " << repo.rebuildObjectFilter() << " objects" << endl;
+        } else if (command == "fsmonitor") {
+            string action = argc == 3 ? argv[2] : "";
+            if (action == "start") {
+                cout << (repo.startFsmonitor() ? "fsmonitor started" : "fsmonitor is already running") << endl;
+            } else if (action == "stop") {
+                cout << (repo.stopFsmonitor() ? "fsmonitor stopped" : "fsmonitor is not running") << endl;
+            } else if (action == "status") {
+                string token = repo.fsmonitorToken();
+                if (token.empty()) {
+                    cout << "fsmonitor is not running" << endl;
+                } else {
+                    cout << "fsmonitor is running, token " << token << endl;
+                }
+            } else {
+                cerr << "Usage: fsmonitor <start|stop|status>\n";
+                return EXIT_FAILURE;
             }
-
-            std::string indexPath = ".git/index";
-            commit(indexPath, message);
-        }
-        catch (const exception& e) {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if(argc > 1 && std::string(argv[1]) == "log"){
-        try {
-           printLogs();
-        }
-        catch (const exception& e) {
-            cerr << e.what() << '\n';
-            return 1;
-        }
-    } else if (command == "checkout") {
-        if (argc != 3) {
-            std::cerr << "Usage: checkout <sha>\n";
-            return EXIT_FAILURE;
         }
-
-        std::string sha = argv[2];
-        try {
-            extractCommit(sha);
-        } catch (const std::exception& e) {
-            std::cerr << "Error during checkout: " << e.what() << '\n';
+        else{
+            cerr << "Unknown command " << command << '\n';
             return EXIT_FAILURE;
         }
-    } 
-    else{
-        cerr << "Unknown command " << command << '\n';
-        return EXIT_FAILURE;
+    } catch (const exception& e) {
+        cerr << e.what() << '\n';
+        return 1;
     }
-    
+
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,138 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include "headers.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Cone-mode sparse checkout. .git/info/sparse-checkout uses git's cone
+// format, e.g. after `sparse-checkout set a/b`:
+//
+//     /*
+//     !/*/
+//     /a/
+//     !/a/*/
+//     /a/b/
+//
+// A directory listed without a matching "!/<dir>/*/" line is checked out
+// recursively. Directories that are negated that way, and all ancestors of
+// the recursive ones, only keep the files directly inside them. Files at
+// the top level are always checked out.
+
+static string sparseCheckoutPath(const string& git_dir) {
+    return git_dir + "/info/sparse-checkout";
+}
+
+static string trimSlashes(const string& path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == string::npos) {
+        return "";
+    }
+    return path.substr(start, path.find_last_not_of('/') - start + 1);
+}
+
+SparseCone readSparseCone(const string& git_dir) {
+    SparseCone cone;
+    ifstream file(sparseCheckoutPath(git_dir));
+    if (!file) {
+        return cone;
+    }
+    cone.enabled = true;
+
+    set<string> listed;
+    set<string> parentsOnly;
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#' || line == "/*" || line == "!/*/") {
+            continue;
+        }
+        if (line[0] == '!') {
+            // "!/<dir>/*/" leaves out the subdirectories of <dir>
+            if (line.size() > 4 && line.compare(line.size() - 3, 3, "/*/") == 0) {
+                parentsOnly.insert(trimSlashes(line.substr(1, line.size() - 4)));
+            }
+            continue;
+        }
+        string directory = trimSlashes(line);
+        if (!directory.empty()) {
+            listed.insert(directory);
+        }
+    }
+
+    for (const auto& directory : listed) {
+        if (parentsOnly.count(directory)) {
+            cone.parents.insert(directory);
+        } else {
+            cone.recursive.insert(directory);
+        }
+    }
+    for (const auto& directory : cone.recursive) {
+        for (fs::path parent = fs::path(directory).parent_path(); !parent.empty(); parent = parent.parent_path()) {
+            cone.parents.insert(parent.generic_string());
+        }
+    }
+    return cone;
+}
+
+void writeSparseCone(const string& git_dir, const vector<string>& directories) {
+    set<string> recursive;
+    for (const auto& directory : directories) {
+        string trimmed = trimSlashes(fs::path(directory).lexically_normal().generic_string());
+        if (trimmed.empty() || trimmed == ".") {
+            throw invalid_argument("Sparse checkout directories must be below the worktree root: " + directory);
+        }
+        recursive.insert(trimmed);
+    }
+    set<string> parents;
+    for (const auto& directory : recursive) {
+        for (fs::path parent = fs::path(directory).parent_path(); !parent.empty(); parent = parent.parent_path()) {
+            parents.insert(parent.generic_string());
+        }
+    }
+
+    fs::create_directories(git_dir + "/info");
+    ofstream file(sparseCheckoutPath(git_dir), ios::trunc);
+    if (!file) {
+        throw runtime_error("Could not write " + sparseCheckoutPath(git_dir));
+    }
+    file << "/*\n!/*/\n";
+    // Sorted output puts every parent right before the directories below it
+    set<string> all(parents);
+    all.insert(recursive.begin(), recursive.end());
+    for (const auto& directory : all) {
+        file << "/" << directory << "/\n";
+        if (!recursive.count(directory)) {
+            file << "!/" << directory << "/*/\n";
+        }
+    }
+}
+
+void disableSparseCone(const string& git_dir) {
+    fs::remove(sparseCheckoutPath(git_dir));
+}
+
+static bool underRecursive(const SparseCone& cone, const string& directory) {
+    for (fs::path dir = directory; !dir.empty(); dir = dir.parent_path()) {
+        if (cone.recursive.count(dir.generic_string())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether anything below the worktree-relative directory can be checked out;
+// "" is the root. Subtrees that fail this are never inflated.
+bool sparseIncludesDirectory(const SparseCone& cone, const string& directory) {
+    return !cone.enabled || directory.empty() || cone.parents.count(directory) || underRecursive(cone, directory);
+}
+
+bool sparseIncludesFile(const SparseCone& cone, const string& path) {
+    if (!cone.enabled) {
+        return true;
+    }
+    string directory = fs::path(path).parent_path().generic_string();
+    return directory.empty() || cone.parents.count(directory) || underRecursive(cone, directory);
+}
@@ -0,0 +1,190 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include "headers.h"
+#include "tree_view.h"
+#include "index_view.h"
+using namespace std;
+
+// Both sides of a comparison are listed one directory at a time and merged by
+// name. Directories whose tree SHAs match are skipped without being read, so
+// comparing two commits only reads the trees along the paths that changed.
+// The index records no tree SHAs, so against the index every directory that
+// holds a file is listed.
+
+namespace {
+
+struct DiffNode {
+    string_view name;
+    unsigned int mode;  // 0 when unknown (files of the index)
+    ObjectId id;
+    bool hasId;         // false for directories of the index
+};
+
+// The entries of one directory, and the buffer their names point into
+struct Listing {
+    shared_ptr<const string> buffer;
+    vector<DiffNode> nodes;
+};
+
+// Lists the directory node at path ("" for the root, otherwise ending in '/')
+using Lister = function<Listing(const DiffNode& directory, const string& path)>;
+using ChangeVisitor = function<void(const mygit::TreeChange&)>;
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+ObjectId parseObjectId(string_view hex) {
+    ObjectId id;
+    for (size_t i = 0; hex.size() == 2 * sizeof(id.bytes) && i < sizeof(id.bytes); ++i) {
+        int high = hexDigit(hex[2 * i]);
+        int low = hexDigit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            break;
+        }
+        id.bytes[i] = static_cast<unsigned char>(high << 4 | low);
+        if (i + 1 == sizeof(id.bytes)) {
+            return id;
+        }
+    }
+    throw runtime_error("Invalid object id: " + string(hex));
+}
+
+DiffNode rootNode(const string& treeSHA) {
+    return DiffNode{"", TREE_MODE, treeSHA.empty() ? ObjectId{} : parseObjectId(treeSHA), true};
+}
+
+Lister treeLister(const ObjectLoader& load) {
+    return [&load](const DiffNode& directory, const string&) {
+        Listing listing;
+        listing.buffer = load(directory.id.hex());
+        for (const TreeEntry& entry : TreeView::fromObject(*listing.buffer)) {
+            listing.nodes.push_back(DiffNode{entry.name, entry.mode, entry.id, true});
+        }
+        return listing;
+    };
+}
+
+Lister indexLister(const IndexView& index) {
+    return [&index](const DiffNode&, const string& path) {
+        Listing listing;
+        for (auto it = index.lowerBound(path); it != index.end() && (*it).path.starts_with(path);) {
+            IndexEntry entry = *it;
+            string_view rest = entry.path.substr(path.size());
+            size_t slash = rest.find('/');
+            if (slash == string_view::npos) {
+                if (!entry.sha.empty()) {
+                    listing.nodes.push_back(DiffNode{rest, 0, parseObjectId(entry.sha), true});
+                }
+                ++it;
+                continue;
+            }
+            // Everything below this directory sorts before <path><name>0, '0' being '/' + 1
+            string_view name = rest.substr(0, slash);
+            listing.nodes.push_back(DiffNode{name, TREE_MODE, ObjectId{}, false});
+            it = index.lowerBound(path + string(name) + '0');
+        }
+        return listing;
+    };
+}
+
+mygit::TreeChange makeChange(mygit::TreeChange::Kind kind, const string& path, const DiffNode* oldNode,
+                             const DiffNode* newNode) {
+    return mygit::TreeChange{kind, path, oldNode ? oldNode->mode : 0, newNode ? newNode->mode : 0,
+                             oldNode ? oldNode->id.hex() : "", newNode ? newNode->id.hex() : "", "", 0};
+}
+
+void diffDirectory(const Lister& oldLister, const DiffNode* oldDirectory, const Lister& newLister,
+                   const DiffNode* newDirectory, const string& path, const ChangeVisitor& visit);
+
+// One name present on either side or both
+void diffEntry(const Lister& oldLister, const DiffNode* oldNode, const Lister& newLister, const DiffNode* newNode,
+               const string& path, const ChangeVisitor& visit) {
+    bool oldTree = oldNode && isTreeMode(oldNode->mode);
+    bool newTree = newNode && isTreeMode(newNode->mode);
+    if (oldTree && newTree) {
+        if (!(oldNode->hasId && newNode->hasId && oldNode->id == newNode->id)) {
+            diffDirectory(oldLister, oldNode, newLister, newNode, path + "/", visit);
+        }
+        return;
+    }
+    if (oldNode && newNode && !oldTree && !newTree) {
+        bool sameMode = oldNode->mode == newNode->mode || !oldNode->mode || !newNode->mode;
+        if (!(oldNode->id == newNode->id && sameMode)) {
+            visit(makeChange(mygit::TreeChange::Kind::Modified, path, oldNode, newNode));
+        }
+        return;
+    }
+
+    // On one side only, or a file replaced by a directory or the other way round
+    if (oldNode) {
+        if (oldTree) {
+            diffDirectory(oldLister, oldNode, newLister, nullptr, path + "/", visit);
+        } else {
+            visit(makeChange(mygit::TreeChange::Kind::Deleted, path, oldNode, nullptr));
+        }
+    }
+    if (newNode) {
+        if (newTree) {
+            diffDirectory(oldLister, nullptr, newLister, newNode, path + "/", visit);
+        } else {
+            visit(makeChange(mygit::TreeChange::Kind::Added, path, nullptr, newNode));
+        }
+    }
+}
+
+void diffDirectory(const Lister& oldLister, const DiffNode* oldDirectory, const Lister& newLister,
+                   const DiffNode* newDirectory, const string& path, const ChangeVisitor& visit) {
+    // Trees written here are in plain name order and git's put '/' after
+    // directory names; sort if needed so both sides merge the same way
+    auto list = [&](const Lister& lister, const DiffNode* directory) {
+        Listing listing;
+        if (directory && !(directory->hasId && directory->id == ObjectId{})) {
+            listing = lister(*directory, path);
+        }
+        auto byName = [](const DiffNode& a, const DiffNode& b) { return a.name < b.name; };
+        if (!is_sorted(listing.nodes.begin(), listing.nodes.end(), byName)) {
+            sort(listing.nodes.begin(), listing.nodes.end(), byName);
+        }
+        return listing;
+    };
+    Listing oldListing = list(oldLister, oldDirectory);
+    Listing newListing = list(newLister, newDirectory);
+    const vector<DiffNode>& oldNodes = oldListing.nodes;
+    const vector<DiffNode>& newNodes = newListing.nodes;
+
+    size_t i = 0, j = 0;
+    while (i < oldNodes.size() || j < newNodes.size()) {
+        int order = i == oldNodes.size() ? 1 : j == newNodes.size() ? -1 : oldNodes[i].name.compare(newNodes[j].name);
+        const DiffNode* oldNode = order <= 0 ? &oldNodes[i++] : nullptr;
+        const DiffNode* newNode = order >= 0 ? &newNodes[j++] : nullptr;
+        diffEntry(oldLister, oldNode, newLister, newNode, path + string((oldNode ? oldNode : newNode)->name), visit);
+    }
+}
+
+} // namespace
+
+void diffTrees(const string& oldTreeSHA, const string& newTreeSHA, const ObjectLoader& load,
+               const function<void(const mygit::TreeChange&)>& visit) {
+    if (oldTreeSHA == newTreeSHA) {
+        return;
+    }
+    Lister lister = treeLister(load);
+    DiffNode oldRoot = rootNode(oldTreeSHA);
+    DiffNode newRoot = rootNode(newTreeSHA);
+    diffDirectory(lister, &oldRoot, lister, &newRoot, "", visit);
+}
+
+void diffTreeWithIndex(const string& treeSHA, const IndexView& index, const ObjectLoader& load,
+                       const function<void(const mygit::TreeChange&)>& visit) {
+    DiffNode treeRoot = rootNode(treeSHA);
+    DiffNode indexRoot{"", TREE_MODE, ObjectId{}, false};
+    diffDirectory(treeLister(load), &treeRoot, indexLister(index), &indexRoot, "", visit);
+}
@@ -0,0 +1,175 @@
+#ifndef TREE_VIEW_H
+#define TREE_VIEW_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <iterator>
+
+// Raw 20-byte SHA-1 as it is stored inside tree entries
+struct ObjectId {
+    unsigned char bytes[20];
+
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string out(40, '0');
+        for (int i = 0; i < 20; ++i) {
+            out[2 * i] = digits[bytes[i] >> 4];
+            out[2 * i + 1] = digits[bytes[i] & 0x0f];
+        }
+        return out;
+    }
+
+    std::string_view raw() const {
+        return std::string_view(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    }
+
+    bool operator==(const ObjectId& other) const {
+        return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+    }
+};
+
+const unsigned int TREE_MODE = 040000;
+const unsigned int FILE_MODE_MASK = 0170000;
+const unsigned int REGULAR_FILE_MODE = 0100000;
+const unsigned int SYMLINK_MODE = 0120000;
+const unsigned int GITLINK_MODE = 0160000;
+
+inline bool isTreeMode(unsigned int mode) { return (mode & FILE_MODE_MASK) == TREE_MODE; }
+inline bool isBlobMode(unsigned int mode) {
+    return (mode & FILE_MODE_MASK) == REGULAR_FILE_MODE || (mode & FILE_MODE_MASK) == SYMLINK_MODE;
+}
+
+inline const char* objectTypeForMode(unsigned int mode) {
+    if (isTreeMode(mode)) return "tree";
+    if ((mode & FILE_MODE_MASK) == GITLINK_MODE) return "commit";
+    return "blob";
+}
+
+// One entry of a tree. The name and id point into the buffer the TreeView was
+// built on, so they are only valid while that buffer is alive.
+struct TreeEntry {
+    unsigned int mode;
+    std::string_view name;
+    const ObjectId& id;
+};
+
+// Zero-copy iteration over the entries of an inflated tree object. Every entry
+// is bounds checked; malformed input throws instead of reading past the end.
+class TreeView {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = TreeEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = TreeEntry;
+
+        iterator(std::string_view body, size_t pos) : body_(body), pos_(pos) { parse(); }
+
+        TreeEntry operator*() const { return TreeEntry{mode_, name_, *id_}; }
+
+        iterator& operator++() {
+            pos_ = next_;
+            parse();
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+        void parse() {
+            if (pos_ >= body_.size()) {
+                pos_ = body_.size();
+                return;
+            }
+
+            size_t space = body_.find(' ', pos_);
+            if (space == std::string_view::npos || space == pos_ || space - pos_ > 7) {
+                fail("bad mode");
+            }
+            mode_ = parseMode(body_.substr(pos_, space - pos_));
+
+            size_t nul = body_.find('\0', space + 1);
+            if (nul == std::string_view::npos || nul == space + 1) {
+                fail("bad name");
+            }
+            name_ = body_.substr(space + 1, nul - space - 1);
+
+            if (body_.size() - (nul + 1) < sizeof(ObjectId)) {
+                fail("truncated object id");
+            }
+            id_ = reinterpret_cast<const ObjectId*>(body_.data() + nul + 1);
+            next_ = nul + 1 + sizeof(ObjectId);
+        }
+
+        unsigned int parseMode(std::string_view digits) const {
+            unsigned int value = 0;
+            bool octal = true;
+            for (char c : digits) {
+                if (c < '0' || c > '9') fail("bad mode");
+                if (c > '7') octal = false;
+                value = value * 8 + (c - '0');
+            }
+            if (octal && isCanonicalMode(value)) {
+                return value;
+            }
+            // Older builds wrote regular files as "100" + the decimal permission
+            // bits ("100420" for 0644, "100493" for 0755); keep reading those
+            // trees. Those digits are often valid octal too, so only a mode git
+            // would not write is taken for one.
+            if (digits.size() > 3 && digits.size() <= 6 && digits.substr(0, 3) == "100") {
+                unsigned int perms = 0;
+                for (char c : digits.substr(3)) perms = perms * 10 + (c - '0');
+                if (perms <= 0777) {
+                    return REGULAR_FILE_MODE | perms;
+                }
+            }
+            if (octal) {
+                return value;  // e.g. 100664 from old versions of git
+            }
+            fail("bad mode");
+        }
+
+        static bool isCanonicalMode(unsigned int mode) {
+            return mode == TREE_MODE || mode == 0100644 || mode == 0100755 || mode == SYMLINK_MODE ||
+                   mode == GITLINK_MODE;
+        }
+
+        [[noreturn]] void fail(const char* what) const {
+            throw std::runtime_error(std::string("Malformed tree entry (") + what + ") at offset " +
+                                     std::to_string(pos_));
+        }
+
+        std::string_view body_;
+        size_t pos_;
+        size_t next_ = 0;
+        unsigned int mode_ = 0;
+        std::string_view name_;
+        const ObjectId* id_ = nullptr;
+    };
+
+    // body holds the entries only, without the "tree <size>\0" header
+    explicit TreeView(std::string_view body) : body_(body) {}
+
+    // Build a view over a full inflated object, checking and skipping its header
+    static TreeView fromObject(std::string_view object) {
+        size_t nul = object.find('\0');
+        if (nul == std::string_view::npos || object.substr(0, 5) != "tree ") {
+            throw std::runtime_error("Object is not a tree.");
+        }
+        return TreeView(object.substr(nul + 1));
+    }
+
+    iterator begin() const { return iterator(body_, 0); }
+    iterator end() const { return iterator(body_, body_.size()); }
+
+private:
+    std::string_view body_;
+};
+
+#endif // TREE_VIEW_H
@@ -0,0 +1,219 @@
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include "headers.h"
+#include "tree_view.h"
+using namespace std;
+
+// Subtrees are inflated by a small pool ahead of the walk. Jobs are keyed by
+// their position in depth-first order (the entry index at every level), so
+// the tree the walk needs next is always the first one a free worker takes,
+// and output order never depends on which worker finishes first.
+//
+// Workers only start a job while fewer than MAX_AHEAD_PER_THREAD trees per
+// worker are loading or waiting to be walked, so memory stays bounded by the
+// pool however wide the tree is. A tree the walk reaches before any worker
+// started it is loaded by the walk itself.
+class TreePrefetcher {
+public:
+    using Loader = function<shared_ptr<const string>(const string&)>;
+
+    static constexpr size_t MAX_AHEAD_PER_THREAD = 4;
+
+    struct Job {
+        vector<uint32_t> order;
+        string sha;
+        enum class State { Queued, Loading, Done } state = State::Queued;
+        shared_ptr<const string> tree;
+        exception_ptr error;
+    };
+    using Result = shared_ptr<Job>;
+
+    TreePrefetcher(const Loader& load, size_t threads) : load_(load), maxAhead_(threads * MAX_AHEAD_PER_THREAD) {
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~TreePrefetcher() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    Result request(const vector<uint32_t>& order, const string& sha) {
+        auto job = make_shared<Job>();
+        job->order = order;
+        job->sha = sha;
+        if (workers_.empty()) {
+            return job;  // loaded by get()
+        }
+        {
+            lock_guard<mutex> lock(mutex_);
+            jobs_.push(job);
+        }
+        ready_.notify_one();
+        return job;
+    }
+
+    shared_ptr<const string> get(const Result& job) {
+        unique_lock<mutex> lock(mutex_);
+        if (job->state == Job::State::Queued) {
+            job->state = Job::State::Loading;  // workers skip it from now on
+            lock.unlock();
+            return load_(job->sha);
+        }
+        done_.wait(lock, [&] { return job->state == Job::State::Done; });
+        --ahead_;
+        ready_.notify_one();
+        if (job->error) {
+            rethrow_exception(job->error);
+        }
+        return std::move(job->tree);
+    }
+
+private:
+    struct Later {
+        bool operator()(const Result& a, const Result& b) const { return a->order > b->order; }
+    };
+
+    void run() {
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            ready_.wait(lock, [this] { return stopping_ || (!jobs_.empty() && ahead_ < maxAhead_); });
+            if (stopping_) return;
+            Result job = jobs_.top();
+            jobs_.pop();
+            if (job->state != Job::State::Queued) {
+                continue;
+            }
+            job->state = Job::State::Loading;
+            ++ahead_;
+            lock.unlock();
+            try {
+                job->tree = load_(job->sha);
+            } catch (...) {
+                job->error = current_exception();
+            }
+            lock.lock();
+            job->state = Job::State::Done;
+            done_.notify_all();
+        }
+    }
+
+    Loader load_;
+    size_t maxAhead_;
+    size_t ahead_ = 0;  // started by a worker and not yet taken by the walk
+    mutex mutex_;
+    condition_variable ready_;
+    condition_variable done_;
+    priority_queue<Result, vector<Result>, Later> jobs_;
+    bool stopping_ = false;
+    vector<thread> workers_;
+};
+
+namespace {
+
+enum class PathMatch { None, Ancestor, Match };
+
+struct TreeWalker {
+    const TreeWalkOptions& options;
+    const function<void(const mygit::TreeItem&)>& visit;
+    TreePrefetcher prefetcher;
+    vector<string> paths;
+
+    // Match: the path or something above it was requested. Ancestor: a
+    // requested path lies below it, so the walk has to go through it.
+    PathMatch match(const string& path) const {
+        if (paths.empty()) {
+            return PathMatch::Match;
+        }
+        PathMatch result = PathMatch::None;
+        for (const auto& requested : paths) {
+            if (path == requested || (path.size() > requested.size() && path[requested.size()] == '/' &&
+                                      path.compare(0, requested.size(), requested) == 0)) {
+                return PathMatch::Match;
+            }
+            if (requested.size() > path.size() && requested[path.size()] == '/' &&
+                requested.compare(0, path.size(), path) == 0) {
+                result = PathMatch::Ancestor;
+            }
+        }
+        return result;
+    }
+
+    bool descends(PathMatch match) const {
+        return match == PathMatch::Ancestor || (match == PathMatch::Match && options.recursive);
+    }
+
+    void walk(const string& raw, const string& prefix, vector<uint32_t>& order) {
+        TreeView view = TreeView::fromObject(raw);
+
+        // Queue every subtree this level descends into before emitting anything
+        vector<TreePrefetcher::Result> subtrees;
+        uint32_t index = 0;
+        for (const TreeEntry& entry : view) {
+            if (isTreeMode(entry.mode) && descends(match(prefix + string(entry.name)))) {
+                order.push_back(index);
+                subtrees.push_back(prefetcher.request(order, entry.id.hex()));
+                order.pop_back();
+            }
+            ++index;
+        }
+
+        size_t nextSubtree = 0;
+        index = 0;
+        for (const TreeEntry& entry : view) {
+            string path = prefix + string(entry.name);
+            PathMatch pathMatch = match(path);
+            mygit::TreeItem item{entry.mode, objectTypeForMode(entry.mode), entry.id.hex(), path};
+            if (isTreeMode(entry.mode)) {
+                // Like git: without -r a matching tree is shown, with -r only under -t
+                if ((pathMatch == PathMatch::Match && !options.recursive) ||
+                    (pathMatch != PathMatch::None && options.showTrees)) {
+                    visit(item);
+                }
+                if (descends(pathMatch)) {
+                    shared_ptr<const string> subtree = prefetcher.get(subtrees[nextSubtree++]);
+                    order.push_back(index);
+                    walk(*subtree, path + "/", order);
+                    order.pop_back();
+                }
+            } else if (pathMatch == PathMatch::Match) {
+                visit(item);
+            }
+            ++index;
+        }
+    }
+};
+
+} // namespace
+
+void walkTree(const string& treeSHA, const TreePrefetcher::Loader& load, const TreeWalkOptions& options,
+              const function<void(const mygit::TreeItem&)>& visit) {
+    TreeWalker walker{options, visit, TreePrefetcher(load, options.recursive ? options.threads : 0), {}};
+    for (const auto& path : options.paths) {
+        string trimmed = path;
+        while (!trimmed.empty() && trimmed.back() == '/') trimmed.pop_back();
+        if (trimmed.empty() || trimmed == ".") {
+            walker.paths.clear();  // the whole tree was asked for
+            break;
+        }
+        walker.paths.push_back(trimmed);
+    }
+
+    vector<uint32_t> order;
+    shared_ptr<const string> root = load(treeSHA);
+    walker.walk(*root, "", order);
+}
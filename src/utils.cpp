@@ -4,6 +4,7 @@
 #include <string>
 #include <zlib.h>
 #include <cstring>
+#include <cerrno>
 #include <openssl/sha.h>
 #include <sstream>
 #include <iomanip>
@@ -13,117 +14,33 @@
 #include <ctime>
 #include <chrono>
 #include <map>
+#include <algorithm>
+#include <mutex>
+#include <span>
+#include <memory_resource>
 #include "headers.h"
+#include "commit_graph.h"
+#include "tree_view.h"
+#include "index_view.h"
+#include "arena.h"
 using namespace std;
 namespace fs = std::filesystem;
 
-const int CHUNK_SIZE = 16384;  // Input and output buffer size
-
-
-void decompressGitObjectChunkwise(const string& filepath, string hash, string commandFlag) {
-    ifstream file(filepath, ios::binary);
-    if (!file.is_open()) {
-        throw runtime_error("Unable to open file: " + filepath);
-    }
-
-    // Initialize zlib stream
-    z_stream zs;
-    memset(&zs, 0, sizeof(zs));
-    if (inflateInit(&zs) != Z_OK) {
-        throw runtime_error("Failed to initialize zlib for decompression");
-    }
-
-    unsigned char inputBuffer[CHUNK_SIZE];  // Buffer to read compressed data
-    unsigned char outputBuffer[CHUNK_SIZE]; // Buffer to hold decompressed data
-
-    int ret;
-    bool foundNullChar = false;  // Persistent flag across chunks
-    bool flag = false;           // Indicates if we've encountered the first '\0'
-    vector<string> header;       // Vector to store parsed header fields
-    string msg = "";             // Temporary string to accumulate header fields
-
-    do {
-        // Read a chunk of compressed data into inputBuffer
-        file.read(reinterpret_cast<char*>(inputBuffer), CHUNK_SIZE);
-        streamsize bytesRead = file.gcount();  // Get number of bytes read
-        if (bytesRead == 0) break;  // EOF reached
-
-        zs.avail_in = bytesRead;      // Input bytes available for decompression
-        zs.next_in = inputBuffer;     // Pointer to input buffer
-
-        // Decompress chunk
-        do {
-            zs.avail_out = CHUNK_SIZE;     // Space available in output buffer
-            zs.next_out = outputBuffer;    // Pointer to output buffer
-
-            ret = inflate(&zs, Z_NO_FLUSH);
-            if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-                inflateEnd(&zs);
-                throw runtime_error("Decompression error occurred");
-            }
-
-            int bytesDecompressed = CHUNK_SIZE - zs.avail_out;  // Bytes decompressed
-
-            // Process the decompressed data
-            for (int i = 0; i < bytesDecompressed; ++i) {
-                if (flag) {
-                    // We've encountered the '\0', process the content based on flags
-                    if (commandFlag == "-s") {
-                        // Print the 3rd part of the header (size information)
-                        cout << header[1] << endl;
-                        return;
-                    } else if (commandFlag == "-t") {
-                        // Print the 1st part of the header (type information)
-                        cout << header[0] << endl;
-                        return;
-                    } else if (commandFlag == "-p") {
-                        // Print the object content (for trees, recursively decompress)
-                        if (header[0] == "tree") {
-                            read_and_decompress_git_object(hash, false);
-                            return;
-                        } else {
-                            // Output the decompressed content
-                            cout.write(reinterpret_cast<char*>(&outputBuffer[i]), bytesDecompressed - i);
-                        }
-                        return;
-                    }
-                } else if (outputBuffer[i] == '\0') {
-                    // First occurrence of '\0', start processing content
-                    if (!msg.empty()) {
-                        header.push_back(msg);  // Push the final header field
-                    }
-                    flag = true;
-                } else {
-                    // Accumulate header before '\0'
-                    if (outputBuffer[i] == ' ') {
-                        header.push_back(msg);
-                        msg.clear();  // Reset msg after each space (for next field)
-                    } else {
-                        msg += outputBuffer[i];  // Accumulate characters
-                    }
-                }
-            }
-
-        } while (zs.avail_out == 0);  // Continue if output buffer was filled
-
-    } while (ret != Z_STREAM_END);  // Continue until end of stream is reached
-
-    inflateEnd(&zs);
-
-    if (ret != Z_STREAM_END) {
-        throw runtime_error("Decompression incomplete. Stream ended unexpectedly.");
-    }
-}
-
-string getFilePathFromSHA(const string& sha) {
+string getFilePathFromSHA(const string& sha, const string& git_dir) {
     if (sha.length() != 40) {
         throw invalid_argument("Invalid SHA format. SHA must be 40 characters long.");
     }
-    
-    string directory = sha.substr(0, 2);       // First 2 characters
-    string filename = sha.substr(2, 38);       // Next 38 characters
-    
-    return filesystem::path(".git") / "objects" / directory / filename;
+
+    // <git_dir>/objects/<first 2 characters>/<next 38>, built in one allocation
+    string path;
+    path.reserve(git_dir.size() + 50);
+    path.append(git_dir);
+    if (!path.empty() && path.back() != '/') {
+        path.push_back('/');
+    }
+    path.append("objects/").append(sha, 0, 2).push_back('/');
+    path.append(sha, 2, 38);
+    return path;
 }
 
 string readFile(const string &filename) {
@@ -140,173 +57,93 @@ string readFile(const string &filename) {
 string calculateSHA1(const string &input) {
     unsigned char hash[SHA_DIGEST_LENGTH];
     SHA1(reinterpret_cast<const unsigned char *>(input.c_str()), input.size(), hash);
-
-    ostringstream result;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-        result << hex << setw(2) << setfill('0') << (int)hash[i];
-    }
-    return result.str();
+    return to_hex_string(hash, SHA_DIGEST_LENGTH);
 }
 
 
-string compressContent(const string &content) {
-    uLongf compressedSize = compressBound(content.size());
-    string compressedData(compressedSize, '\0');
-
-    int result = compress(reinterpret_cast<Bytef *>(&compressedData[0]), &compressedSize,
-                          reinterpret_cast<const Bytef *>(content.c_str()), content.size());
+// An object file is created with O_EXCL, or under its temporary name
+// (durability.cpp), and never opened for writing once it exists
+static FileWrite objectFileWrite(const string& objectPath, string_view compressedContent, Durability durability) {
+    return FileWrite{objectWritePath(objectPath, durability), compressedContent, 0, durability == Durability::Off};
+}
 
-    if (result != Z_OK) {
-        throw runtime_error("Failed to compress content.");
+// Publishes a finished object write. False when it failed; a file that
+// already existed holds the same object and counts as written.
+static bool objectWriteDone(const FileWrite& write, const string& sha1, const string& git_dir, Durability durability) {
+    if (write.exclusive && write.error == EEXIST) {
+        recordObject(sha1, git_dir);  // the object filter missed it
+        return true;
     }
-
-    compressedData.resize(compressedSize); // Resize to the actual compressed size
-    return compressedData;
+    if (write.error) {
+        // Never leave a truncated object behind under its final name
+        remove(write.path.c_str());
+        return false;
+    }
+    objectWritten(getFilePathFromSHA(sha1, git_dir), git_dir, durability);
+    recordObject(sha1, git_dir);
+    return true;
 }
 
-void storeCompressedFile(const string &sha1, const string &compressedContent) {
-    string directory = ".git/objects/" + sha1.substr(0, 2);
-    string filename = sha1.substr(2);
+void storeCompressedFile(const string &sha1, const string &compressedContent, const string &git_dir) {
+    string directory = git_dir + "/objects/" + sha1.substr(0, 2);
 
     // Create the directory if it doesn't exist
     mkdir(directory.c_str(), 0777);
 
-    // Create the file
-    string filepath = directory + "/" + filename;
-    ofstream outfile(filepath, ios::binary);
-    outfile.write(compressedContent.c_str(), compressedContent.size());
-    outfile.close();
-}
-
-string to_hex_string(const unsigned char *data, size_t length) {
-    ostringstream result;
-    for (size_t i = 0; i < length; ++i) {
-        result << hex << setw(2) << setfill('0') << (int)data[i];
+    Durability durability = durabilityMode(git_dir);
+    vector<FileWrite> writes{objectFileWrite(directory + "/" + sha1.substr(2), compressedContent, durability)};
+    writeFiles(writes, IoBackend::Threads);  // one file: written on this thread
+    if (!objectWriteDone(writes[0], sha1, git_dir, durability)) {
+        throw runtime_error("Failed to write object " + sha1);
     }
-    return result.str();
 }
 
-// Function to read a compressed Git object from .git/objects and decompress it using Zlib
-bool read_and_decompress_git_object(const string &sha1_hash,bool flag, const string &git_dir) {
-    // Construct the path to the object file based on the SHA-1 hash
-    string dir_name = sha1_hash.substr(0, 2);  // First 2 characters are the directory
-    string file_name = sha1_hash.substr(2);    // Remaining part is the file name
-    string object_path = git_dir + "/objects/" + dir_name + "/" + file_name;
-
-    // Open the object file in binary mode
-    ifstream file(object_path, ios::binary);
-    if (!file.is_open()) {
-        throw runtime_error("Error: Unable to open Git object file.");
-    }
-
-    // Read the compressed file data
-    vector<unsigned char> compressed_data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    file.close();
-
-    // Prepare to decompress the data using Zlib
-    z_stream infstream;
-    infstream.zalloc = Z_NULL;
-    infstream.zfree = Z_NULL;
-    infstream.opaque = Z_NULL;
-    infstream.avail_in = compressed_data.size(); // Size of input data
-    infstream.next_in = compressed_data.data();  // Input data
-
-    // Decompressed output buffer (a large buffer to hold the decompressed data)
-    vector<unsigned char> decompressed_data(1024 * 1024); // 1 MB buffer
-
-    infstream.avail_out = decompressed_data.size();
-    infstream.next_out = decompressed_data.data();
-
-    // Initialize the Zlib decompression
-    if (inflateInit(&infstream) != Z_OK) {
-        throw runtime_error("Error: Failed to initialize zlib.");
-    }
-
-    // Decompress the data
-    int result = inflate(&infstream, Z_FINISH);
-    if (result != Z_STREAM_END) {
-        inflateEnd(&infstream);
-        throw runtime_error("Error: Failed to decompress Git object.");
+// storeCompressedFile for many (sha, compressed content) pairs at once
+void storeCompressedFiles(const vector<pair<string, string>>& objects, const string& git_dir, IoBackend backend) {
+    Durability durability = durabilityMode(git_dir);
+    set<string> directories;
+    vector<FileWrite> writes;
+    writes.reserve(objects.size());
+    for (const auto& [sha1, compressedContent] : objects) {
+        string directory = git_dir + "/objects/" + sha1.substr(0, 2);
+        if (directories.insert(directory).second) {
+            mkdir(directory.c_str(), 0777);
+        }
+        writes.push_back(objectFileWrite(directory + "/" + sha1.substr(2), compressedContent, durability));
     }
+    writeFiles(writes, backend);
 
-    // Clean up Zlib
-    inflateEnd(&infstream);
-
-    // Resize decompressed_data to the actual size of decompressed content
-    decompressed_data.resize(infstream.total_out);
-
-    string header;
-    for (size_t i = 0; i < decompressed_data.size() && decompressed_data[i] != '\0'; i++) {
-        header += static_cast<char>(decompressed_data[i]);
+    string failed;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        if (!objectWriteDone(writes[i], objects[i].first, git_dir, durability)) {
+            failed = objects[i].first;
+        }
     }
-
-    // The header contains the object type followed by a space and the size
-    if (header.find("blob") == 0) {
-        // If the object is a blob, call decompressGitObjectChunkwise
-        decompressGitObjectChunkwise(object_path, sha1_hash, "-p");
-    } else if (header.find("commit") == 0) {
-        // If the object is a commit, call decompressGitObjectChunkwise
-        decompressGitObjectChunkwise(object_path, sha1_hash, "-p");
-    } else if (header.find("tree") == 0) {
-        // If the object is a tree, call parse_tree_object
-        parse_tree_object(decompressed_data, flag);
-    } else {
-        throw runtime_error("Error: Unknown Git object type.");
+    if (!failed.empty()) {
+        throw runtime_error("Failed to write object " + failed);
     }
-
-    return true;
 }
 
-// Function to parse a decompressed Git tree object
-void parse_tree_object(vector<unsigned char> &data, bool option) {
-    size_t i = 0;
-
-    // Skip the header ("tree <size>")
-    
-    while (data[i] != 0) {
-        i++;
+// Hash, compress and store "<type> <size>\0<content>"; returns the hex SHA
+string writeObject(const string &type, const string &content, const string &git_dir) {
+    string object = type + " " + to_string(content.size()) + '\0' + content;
+    string sha1 = calculateSHA1(object);
+    if (freshenObject(sha1, git_dir)) {
+        return sha1;
     }
-    i++; // Skip the null byte after the header
-
-    // Parse the tree entries
-
-    while (i < data.size()) {
-        // Extract the file mode (up to the first space)
-        string mode;
-        while (data[i] != ' ') {
-            mode += data[i];
-            i++;
-        }
-        if(mode[0] == '4') mode = '0' + mode;
-        i++; // Skip the space
-
-        // Extract the filename (up to the null byte)
-        string filename;
-        while (data[i] != '\0') {
-            filename += data[i];
-            i++;
-        }
-        i++; // Skip the null byte
-
-        // Extract the SHA-1 hash (next 20 bytes)
-        string sha1 = to_hex_string(&data[i], 20);
-        i += 20;
+    int level = type == "blob" ? blobCompressionLevel(content, {}, "") : Z_DEFAULT_COMPRESSION;
+    storeCompressedFile(sha1, compressContent(object, level), git_dir);
+    return sha1;
+}
 
-        if(option){
-            cout<<filename<<endl;
-            continue;
-        }
-        // Print the extracted entry
-        string objectType;
-        if(mode.substr(0,3) == "040"){
-            objectType = "tree";
-        }else if(mode.substr(0,3) == "100" || mode.substr(0,3) == "120"){
-            objectType = "blob";
-        }else if(mode.substr(0,3) == "160"){
-            objectType = "commit";
-        }
-        cout << mode << " " <<objectType<<" "<< sha1 << "   " << filename << endl;
+string to_hex_string(const unsigned char *data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    string result(2 * length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+        result[2 * i] = digits[data[i] >> 4];
+        result[2 * i + 1] = digits[data[i] & 0xf];
     }
+    return result;
 }
 
 string HexadecimalSha(const string& sha)
@@ -319,13 +156,28 @@ string HexadecimalSha(const string& sha)
     return sha_hexadecimal.str();
 }
 
+string BytesFromHexSha(const string& hex)
+{
+    auto digit = [&hex](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        throw invalid_argument("Invalid hex SHA: " + hex);
+    };
+    string bytes(hex.size() / 2, '\0');
+    for (size_t i = 0; i < bytes.size(); ++i)
+    {
+        bytes[i] = static_cast<char>(digit(hex[2 * i]) << 4 | digit(hex[2 * i + 1]));
+    }
+    return bytes;
+}
+
 string CreateBlobString(const string& filename)
 {
-    ifstream file(filename);
+    ifstream file(filename, ios::binary);
     if (!file.is_open())
     {
-        cerr << filename << " not found.\n";
-        throw runtime_error("");
+        throw runtime_error(filename + " not found.");
     }
     vector<char> raw_file =
         vector<char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
@@ -342,72 +194,123 @@ string ComputeShaHash(const string& data)
     return hash;  // Return the 20-byte binary hash
 }
 
-string _WriteTree(const filesystem::path& path)
+// Tree entries only distinguish executable and non-executable files, like git
+static unsigned int fileMode(const filesystem::directory_entry& entry)
 {
-    if (filesystem::is_empty(path))
-    {
-        return string("");
+    auto perms = filesystem::status(entry).permissions();
+    bool executable = (perms & filesystem::perms::owner_exec) != filesystem::perms::none;
+    return executable ? 0100755 : 0100644;
+}
+
+static ObjectId idFromHex(string_view hex)
+{
+    auto digit = [&hex](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        throw invalid_argument("Invalid hex SHA: " + string(hex));
+    };
+    if (hex.size() != 40) {
+        throw invalid_argument("Invalid hex SHA: " + string(hex));
+    }
+    ObjectId id;
+    for (size_t i = 0; i < sizeof(id.bytes); ++i) {
+        id.bytes[i] = static_cast<unsigned char>(digit(hex[2 * i]) << 4 | digit(hex[2 * i + 1]));
+    }
+    return id;
+}
+
+// An entry of a tree being written. The name lives in the command's arena.
+struct NewTreeEntry {
+    unsigned int mode;
+    string_view name;
+    ObjectId id;
+};
+using NewTreeEntries = std::pmr::vector<NewTreeEntry>;
+
+// Sorts the entries by name and stores them as a tree object, built in one
+// buffer of the exact size, unless that tree already exists
+static ObjectId storeTree(span<NewTreeEntry> entries, const string& git_dir)
+{
+    sort(entries.begin(), entries.end(), [](const NewTreeEntry& a, const NewTreeEntry& b) { return a.name < b.name; });
+    char mode[16];
+    size_t bodySize = 0;
+    for (const NewTreeEntry& entry : entries) {
+        bodySize += snprintf(mode, sizeof(mode), "%o", entry.mode) + entry.name.size() + 2 + sizeof(entry.id.bytes);
+    }
+    string tree = "tree " + to_string(bodySize) + '\0';
+    tree.reserve(tree.size() + bodySize);
+    for (const NewTreeEntry& entry : entries) {
+        tree.append(mode, snprintf(mode, sizeof(mode), "%o", entry.mode)).push_back(' ');
+        tree.append(entry.name).push_back('\0');
+        tree.append(entry.id.raw());
+    }
+
+    ObjectId id;
+    SHA1(reinterpret_cast<const unsigned char*>(tree.data()), tree.size(), id.bytes);
+    string sha = id.hex();
+    if (!freshenObject(sha, git_dir)) {
+        storeCompressedFile(sha, compressContent(tree), git_dir);
     }
-    vector<filesystem::directory_entry> entries;
+    return id;
+}
+
+// Entries of the directories being written are stacked in one vector, the
+// innermost directory's last; each directory drops its own once stored.
+// Subdirectories with nothing to store are left out, like git does.
+static void writeDiskTree(const filesystem::path& path, const string& git_dir, Arena& arena, NewTreeEntries& entries)
+{
     for (const auto& entry : filesystem::directory_iterator(path))
     {
-        if (entry.path().filename() == ".git" || entry.path().filename() == "build" || entry.path().filename() == "vcpkg" || entry.path().filename() == ".git" || entry.path().filename() == "CMakeLists.txt" || entry.path().filename() == ".DS_Store")
+        const string& native = entry.path().native();
+        string_view name = string_view(native).substr(native.rfind('/') + 1);
+        if (name == ".git" || name == "build" || name == "vcpkg" || name == "CMakeLists.txt" || name == ".DS_Store")
         {
             continue;
         }
-        entries.push_back(entry);
-    }
-    sort(entries.begin(), entries.end(), [](const auto& entry1, const auto& entry2) {
-        return entry1.path().filename().string() < entry2.path().filename().string();
-    });
-    ostringstream tree_body;
-    for (const auto& entry : entries)
-    {
-        // cout << entry.path() << "file=" << entry.is_regular_file() << '\n';
         if (entry.is_directory())
         {
-            string mode = "40000";
-            string name = entry.path().filename().string();
-            string sha_bytes = _WriteTree(entry.path());
-            tree_body << mode + " " + name + '\0' + sha_bytes;
+            size_t start = entries.size();
+            writeDiskTree(entry.path(), git_dir, arena, entries);
+            if (entries.size() > start) {
+                ObjectId id = storeTree(span(entries).subspan(start), git_dir);
+                entries.resize(start);
+                entries.push_back({TREE_MODE, arena.copy(name), id});
+            }
         }
         else if (entry.is_regular_file())
         {
-            auto perms = filesystem::status(entry).permissions();
-            unsigned int perm_value = static_cast<unsigned int>(perms) & 0777;  // Mask for the permission bits
-            string mode = "100" + to_string(perm_value); 
-            string name = entry.path().filename().string();
-            string blob = CreateBlobString(entry.path().string());
-            string sha_bytes = ComputeShaHash(blob);
-            tree_body << mode + " " + name + '\0' + sha_bytes;
-            string sha = HexadecimalSha(sha_bytes);
-            string compressedContent = compressContent(blob);
-            
-            storeCompressedFile(sha, compressedContent);
+            ObjectId id = idFromHex(hashFileObject(native, git_dir, true));
+            entries.push_back({fileMode(entry), arena.copy(name), id});
         }
     }
-    string tree = "tree " + to_string(tree_body.str().size()) + '\0' + tree_body.str();
-    string sha_bytes = ComputeShaHash(tree);
-    string sha = HexadecimalSha(sha_bytes);
-    string compressedContent = compressContent(tree);
-            
-    storeCompressedFile(sha, compressedContent);
-    
-    return sha_bytes;
 }
 
-int writeTree(string path){
-    string sha_bytes = _WriteTree(path);
-    string sha = HexadecimalSha(sha_bytes);
-    cout << sha <<endl;
-    return EXIT_SUCCESS;
+string writeTree(const filesystem::path& root){
+    Arena arena;
+    NewTreeEntries entries(&arena);
+    writeDiskTree(root, (root / ".git").string(), arena, entries);
+    return storeTree(entries, (root / ".git").string()).hex();
 }
 
 
 pair<string, string> getUserInfo() {
     const char* homeDir = getenv("HOME");
-    string path = string(homeDir) + "/.gitconfig";
-    string gitConfigContent = readFile(path);
+    string path = string(homeDir ? homeDir : "") + "/.gitconfig";
+
+    // Long-running processes commit many times; only reparse when the file changes
+    static mutex cacheMutex;
+    static fs::file_time_type cachedTime;
+    static pair<string, string> cachedInfo;
+    static bool cached = false;
+    error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    lock_guard<mutex> lock(cacheMutex);
+    if (cached && !ec && modified == cachedTime) {
+        return cachedInfo;
+    }
+
+    string gitConfigContent = ec ? "" : readFile(path);
     string userName, userEmail;
 
     istringstream stream(gitConfigContent);
@@ -423,7 +326,59 @@ pair<string, string> getUserInfo() {
 
 
 
-    return {userName, userEmail};
+    cachedInfo = {userName, userEmail};
+    cachedTime = modified;
+    cached = !ec;
+    return cachedInfo;
+}
+
+// Repository settings from <git_dir>/config, keyed "section.key":
+//   [chunking]
+//       threshold = 64m
+map<string, string> readConfig(const string& path) {
+    map<string, string> values;
+    ifstream file(path);
+    string line, section;
+    while (getline(file, line)) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first == string::npos || line[first] == '#' || line[first] == ';') {
+            continue;
+        }
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+        if (line.front() == '[' && line.back() == ']') {
+            section = line.substr(1, line.size() - 2);
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            continue;
+        }
+        string key = line.substr(0, line.find_last_not_of(" \t", equals - 1) + 1);
+        size_t valueStart = line.find_first_not_of(" \t", equals + 1);
+        string value = valueStart == string::npos ? "" : line.substr(valueStart);
+        values[section.empty() ? key : section + "." + key] = value;
+    }
+    return values;
+}
+
+string getConfigValue(const string& git_dir, const string& key, const string& defaultValue) {
+    // Looked up once per file by add and commit, so parse each config file once
+    static mutex cacheMutex;
+    static map<string, pair<fs::file_time_type, map<string, string>>> cache;
+    string path = git_dir + "/config";
+    error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    if (ec) {
+        return defaultValue;
+    }
+
+    lock_guard<mutex> lock(cacheMutex);
+    auto cached = cache.find(path);
+    if (cached == cache.end() || cached->second.first != modified) {
+        cached = cache.insert_or_assign(path, make_pair(modified, readConfig(path))).first;
+    }
+    auto it = cached->second.second.find(key);
+    return it == cached->second.second.end() ? defaultValue : it->second;
 }
 
 string getTimeStamp() {
@@ -455,67 +410,66 @@ string getTimeStamp() {
     return timestampStream.str();
 }
 
-void updateHeadSHA(std::string& sha) {
-    std::string headDir = ".git/refs/heads";
-    std::string headFile = headDir + "/main";
-
-    if (!fs::exists(headDir)) {
-        fs::create_directories(headDir);
-    }
-
-    std::ofstream outFile(headFile, std::ios::trunc);
-    if (!outFile) {
-        throw std::runtime_error("Could not open file: " + headFile);
+// Moves the branch HEAD is on, or HEAD itself when it is detached
+void updateHeadSHA(const std::string& sha, const std::string& git_dir) {
+    std::string branch = headBranch(git_dir);
+    if (branch.empty()) {
+        syncObjects(git_dir);
+        setHead(git_dir, sha);
+        return;
     }
+    writeRef(git_dir, "refs/heads/" + branch, sha);
+}
 
-    outFile << sha;
-    outFile.close();
+// Each branch keeps its own log; a detached HEAD logs to logs/HEAD
+string logPath(const string& git_dir, const string& branch) {
+    return branch.empty() ? git_dir + "/logs/HEAD" : git_dir + "/logs/refs/heads/" + branch;
 }
 
-void commitTree(const string& flag1, const string& sha_parent, const string& flag2,
-               const string& message, const string& sha)
+string commitTree(const string& treeSha, const vector<string>& parents, const string& message,
+                  const string& git_dir)
 {
     auto [userName, email] = getUserInfo();
 
     // Fetch current timestamp
     string unixTimestamp = getTimeStamp();
-    cout<<"timestamp: "<<unixTimestamp<<endl;
     // Build the commit content
     ostringstream commitContent;
-    commitContent << "tree " << sha << "\n";
+    commitContent << "tree " << treeSha << "\n";
 
-    // Add parent if it exists
-    if (!sha_parent.empty()) {
-        commitContent << "parent " << sha_parent << "\n";
+    // Add parents if they exist
+    for (const auto& parent : parents) {
+        if (!parent.empty()) {
+            commitContent << "parent " << parent << "\n";
+        }
     }
 
     commitContent << "author " << userName << " <" << email << "> " << unixTimestamp << "\n";
     commitContent << "committer " << userName << " <" << email << "> " << unixTimestamp << "\n";
     commitContent << "\n" << message << "\n";
 
-    // Create commit body
-    string commitHeader = "commit " + to_string(commitContent.str().size()) + '\0';
-    string commitBody = commitHeader + commitContent.str();
-
-    // Get the commit SHA and hex representation
-    string sha_bytes = ComputeShaHash(commitBody);
-    string commit_sha = HexadecimalSha(sha_bytes);
-    string compressedContent = compressContent(commitBody);
-            
-    storeCompressedFile(commit_sha, compressedContent);
+    string commit_sha = writeObject("commit", commitContent.str(), git_dir);
 
-    cout << commit_sha << "\n";  
+    updateHeadSHA(commit_sha, git_dir);
 
-    updateHeadSHA(commit_sha);
+    CommitInfo graphed{treeSha, {}, stoll(unixTimestamp)};
+    for (const auto& parent : parents) {
+        if (!parent.empty()) {
+            graphed.parents.push_back(parent);
+        }
+    }
+    try {
+        recordCommit(commit_sha, graphed, git_dir);
+    } catch (const exception&) {
+        // Only speeds up `log -- <path>` and merge-base, which read the commits it lacks
+    }
 
     // Log commit details
-    string logDir = ".git/logs/refs/heads";
-    string logFile = logDir + "/main";
+    string branch = headBranch(git_dir);
+    string logFile = logPath(git_dir, branch);
 
     // Create the directory if it does not exist
-    if (!fs::exists(logDir)) {
-        fs::create_directories(logDir);
-    }
+    fs::create_directories(fs::path(logFile).parent_path());
 
     // Open the log file for appending (this will create the file if it does not exist)
     // Read existing log entries
@@ -530,7 +484,7 @@ void commitTree(const string& flag1, const string& sha_parent, const string& fla
     }
 
     // Write the new log entry at the top
-    logStream << "commit " << commit_sha << " (HEAD -> main)\n"
+    logStream << "commit " << commit_sha << (branch.empty() ? "\n" : " (HEAD -> " + branch + ")\n")
               << "Author: " << userName << " <" << email << ">\n"
               << "Date:   " << unixTimestamp << "\n\n"
               << "    " << message << "\n\n";
@@ -539,20 +493,40 @@ void commitTree(const string& flag1, const string& sha_parent, const string& fla
     logStream << existingLogs;
 
     logStream.close();
+    return commit_sha;
 }
 
-void printLogs() {
-    string logFile = ".git/logs/refs/heads/main";
-    ifstream file(logFile);
-    if (!file.is_open()) {
+string readLog(const string& git_dir) {
+    string logFile = logPath(git_dir, headBranch(git_dir));
+    if (!fs::exists(logFile)) {
         throw runtime_error("Unable to open log file: " + logFile);
     }
+    return readFile(logFile);
+}
 
-    string line;
-    while (getline(file, line)) {
-        cout << line << endl;
+// A new branch's log starts with the entries of the current one from its
+// start commit on (empty when the start commit is not in that log). The
+// copied entries are labelled with the new branch, or left bare for a
+// detached HEAD's log (empty branch).
+void startBranchLog(const string& git_dir, const string& branch, const string& startSHA) {
+    string currentLog = logPath(git_dir, headBranch(git_dir));
+    string log = fs::exists(currentLog) ? readFile(currentLog) : "";
+    size_t start = log.starts_with("commit " + startSHA) ? 0 : log.find("\ncommit " + startSHA);
+    log = start == string::npos ? "" : log.substr(start == 0 ? 0 : start + 1);
+
+    string label = branch.empty() ? "" : " (HEAD -> " + branch + ")";
+    string relabeled;
+    istringstream lines(log);
+    for (string line; getline(lines, line);) {
+        if (line.starts_with("commit ") && line.size() >= 47) {
+            line.resize(47);  // "commit " and the SHA
+            line += label;
+        }
+        relabeled += line + "\n";
     }
-    file.close();
+    string logFile = logPath(git_dir, branch);
+    fs::create_directories(fs::path(logFile).parent_path());
+    LockFile(logFile).commit(relabeled);
 }
 
 
@@ -676,221 +650,489 @@ void printLogs() {
 
 namespace fs = std::filesystem;
 
-void addFiles(std::vector<std::string>& paths) {
-    std::map<std::string, std::string> fileMap;
+bool isIgnoredWorktreeFile(std::string_view name) {
+    return name == "CMakeLists.txt" || name == ".DS_Store";
+}
+
+bool isIgnoredWorktreeFile(const fs::path& path) {
+    return isIgnoredWorktreeFile(std::string_view(path.filename().native()));
+}
+
+// Index keys are paths relative to the worktree root
+std::string worktreeKey(const fs::path& root, const fs::path& path) {
+    fs::path absolute = path.is_absolute() ? path : root / path;
+    return absolute.lexically_normal().lexically_relative(root).generic_string();
+}
 
-    auto processFile = [&](const fs::path& filePath) {
-        std::string relativePath = fs::relative(filePath).string();
-        std::string blobContent = CreateBlobString(relativePath);  // Assume this function creates blob content from file
-        std::string sha1 = calculateSHA1(blobContent);  // Assume this calculates SHA1 of the file content
-        std::string compressedContent = compressContent(blobContent);  // Assume this compresses the file content
-        storeCompressedFile(sha1, compressedContent);  // Assume this stores the compressed file using its SHA1 hash
-        fileMap[relativePath] = sha1;
+void addFiles(const fs::path& root, const std::vector<std::string>& paths) {
+    std::string git_dir = (root / ".git").string();
+    std::string indexPath = git_dir + "/index";
+    // Held from before the index is read until the new one is in place
+    LockFile indexLock(indexPath, durabilityMode(git_dir) != Durability::Off);
+    std::shared_ptr<const IndexView> index = IndexView::open(indexPath);
+    bool addAll = std::any_of(paths.begin(), paths.end(), [&](const std::string& path) {
+        return worktreeKey(root, path) == ".";
+    });
+
+    // Paths outside a sparse checkout cone are neither hashed nor dropped
+    SparseCone sparse = readSparseCone(git_dir);
+
+    // Every path and entry below lives in the arena until the index is
+    // written. Entries carried over from the old index view its mapping.
+    Arena arena;
+    IndexEntries kept(&arena);  // old entries `add .` keeps
+    std::pmr::vector<std::string_view> deletedPaths(&arena);
+    // Files to hash, collected first so they are read and stored in batches
+    std::pmr::vector<std::string_view> filesToHash(&arena);
+    auto processFile = [&](const std::string& relativePath) {
+        if (sparseIncludesFile(sparse, relativePath)) {
+            filesToHash.push_back(arena.copy(relativePath));
+        }
     };
 
     auto iterateFiles = [&](const fs::path& dirPath) {
+        // Keys are built from the directory's key and the entry's path below
+        // it, in one buffer, instead of normalizing every path
+        std::string dirKey = worktreeKey(root, dirPath);
+        std::string key = dirKey == "." ? "" : dirKey + "/";
+        size_t keyBase = key.size();
+        size_t skip = dirPath.native().size() + (dirPath.native().ends_with('/') ? 0 : 1);
         for (fs::recursive_directory_iterator iter(dirPath, fs::directory_options::skip_permission_denied), end; iter != end; ++iter) {
             auto& entry = *iter;
+            const std::string& native = entry.path().native();
+            std::string_view name = std::string_view(native).substr(native.rfind('/') + 1);
+            key.resize(keyBase);
+            key.append(native, skip);
             // Skip specific directories and files
             if (entry.is_directory()) {
-                if (entry.path().filename() == ".git" || 
-                    entry.path().filename() == "build" || 
-                    entry.path().filename() == "vcpkg") {
+                if (name == ".git" || name == "build" || name == "vcpkg" || !sparseIncludesDirectory(sparse, key)) {
                     iter.disable_recursion_pending();  // Prevent further recursion into these directories
                     continue;
                 }
             }
 
-            if (entry.path().filename() == "CMakeLists.txt" || entry.path().filename() == ".DS_Store") {
+            if (isIgnoredWorktreeFile(name)) {
                 continue;  // Skip specific files
             }
 
-            if (fs::is_regular_file(entry.path())) {
-                processFile(entry.path());
+            if (entry.is_regular_file()) {
+                processFile(key);
             }
         }
     };
 
+    // Ask the fsmonitor daemon what changed since the last full `add .`. When it
+    // can answer, only those paths are rehashed; otherwise scan everything.
+    std::string newToken;
+    std::vector<std::string> changedPaths;
+    bool monitored = fsmonitorQuery(root, readFsmonitorToken(root), newToken, changedPaths);
+
+    if (monitored && addAll) {
+        // `add .` rewrites the index, so start from what it already holds
+        kept.assign(index->begin(), index->end());
+    } else if (addAll && sparse.enabled) {
+        for (const IndexEntry& entry : *index) {
+            if (!sparseIncludesFile(sparse, std::string(entry.path))) {
+                kept.push_back(entry);
+            }
+        }
+    }
+
+    auto processChangedPath = [&](const std::string& changedPath) {
+        fs::path fullPath = root / changedPath;
+        if (fs::is_directory(fullPath)) {
+            iterateFiles(fullPath);
+        } else if (fs::is_regular_file(fullPath)) {
+            if (!isIgnoredWorktreeFile(fullPath)) {
+                processFile(worktreeKey(root, fullPath));
+            }
+        } else if (addAll && sparseIncludesDirectory(sparse, changedPath)) {
+            // Deleted: the path and anything that lived under it are dropped
+            deletedPaths.push_back(arena.copy(changedPath));
+        }
+    };
+
     // Iterate over input paths and process them
     for (const auto& path : paths) {
-        if (fs::is_directory(path)) {
-            iterateFiles(path);  // Explore directory
-        } else if (fs::is_regular_file(path)) {
-            processFile(path);  // Process single file
+        fs::path fullPath = fs::path(path).is_absolute() ? fs::path(path) : root / path;
+        if (fs::is_directory(fullPath)) {
+            if (!monitored) {
+                iterateFiles(fullPath);  // Explore directory
+                continue;
+            }
+            std::string prefix = worktreeKey(root, fullPath);
+            for (const auto& changedPath : changedPaths) {
+                if (prefix == "." || changedPath == prefix || changedPath.rfind(prefix + "/", 0) == 0) {
+                    processChangedPath(changedPath);
+                }
+            }
+        } else if (fs::is_regular_file(fullPath)) {
+            processFile(worktreeKey(root, fullPath));  // Process single file
         }
     }
-
-    // Determine the mode to open the index file
-    std::ios_base::openmode mode = std::ios::app;
-    if (std::find(paths.begin(), paths.end(), ".") != paths.end()) {
-        mode = std::ios::trunc;
+    std::sort(filesToHash.begin(), filesToHash.end());
+    filesToHash.erase(std::unique(filesToHash.begin(), filesToHash.end()), filesToHash.end());
+
+    // Stores each file as a blob, or as chunks when it is over chunking.threshold
+    std::string rootPrefix = (root / "").string();
+    std::vector<std::string> filePaths;
+    filePaths.reserve(filesToHash.size());
+    for (std::string_view relativePath : filesToHash) {
+        filePaths.push_back(rootPrefix);
+        filePaths.back().append(relativePath);
+    }
+    std::vector<std::string> shas = hashFileObjects(filePaths, git_dir, true, ioBackend(git_dir));
+    IndexEntries updates(&arena);
+    updates.reserve(filesToHash.size());
+    for (size_t i = 0; i < filesToHash.size(); ++i) {
+        updates.push_back({filesToHash[i], arena.copy(shas[i])});
     }
 
-    // Write to index file
-    std::ofstream indexFile(".git/index", mode);
-    if (!indexFile) {
-        throw std::runtime_error("Could not open index file");
+    // Objects go to disk before the index names them
+    syncObjects(git_dir);
+    if (!addAll) {
+        // Merge into the sorted entries
+        indexLock.commit(mergeIndex(*index, updates));
+        return;
     }
 
-    for (const auto& [filePath, fileSHA] : fileMap) {
-        indexFile << filePath << " " << fileSHA << "\n";
+    // `add .` replaces the whole index
+    if (!deletedPaths.empty()) {
+        std::sort(deletedPaths.begin(), deletedPaths.end());
+        std::erase_if(kept, [&](const IndexEntry& entry) {
+            for (size_t end = entry.path.size(); end != std::string_view::npos && end > 0; end = entry.path.rfind('/', end - 1)) {
+                if (std::binary_search(deletedPaths.begin(), deletedPaths.end(), entry.path.substr(0, end))) {
+                    return true;
+                }
+            }
+            return false;
+        });
     }
+    kept.insert(kept.end(), updates.begin(), updates.end());
+    sortIndexEntries(kept);
+    indexLock.commit(formatIndex(kept));
 
-    indexFile.close();
-    std::cout << "Files added to index." << std::endl;
+    // The index now mirrors the whole worktree as of newToken
+    writeFsmonitorToken(root, newToken);
 }
 
-
-string _WriteTree(const fs::path& path, const std::map<std::string, std::string>& fileMap) {
-    if (filesystem::is_empty(path))
-    {
-        return string("");
-    }
-    vector<filesystem::directory_entry> entries;
-    for (const auto& entry : filesystem::directory_iterator(path))
-    {
-        if (entry.path().filename() == ".git" || entry.path().filename() == "build" || entry.path().filename() == "vcpkg" || entry.path().filename() == ".git" || entry.path().filename() == "CMakeLists.txt" || entry.path().filename() == ".DS_Store")
-        {
-            continue;
+// The index against HEAD's tree. The answer only changes with one of them,
+// so the last one is kept in .git/staged-cache under both their identities
+// and reused while neither changed.
+static vector<mygit::StatusEntry> stagedChanges(const std::string& git_dir, const IndexView& index) {
+    std::string headSha = getHeadSHA(git_dir);
+    std::string headTree = headSha.empty() ? "" : commitTreeSHA(headSha, git_dir);
+    std::string key = index.identity() + " " + headTree;
+    std::string cachePath = git_dir + "/staged-cache";
+
+    vector<mygit::StatusEntry> entries;
+    std::ifstream cache(cachePath);
+    std::string line;
+    if (!index.identity().empty() && std::getline(cache, line) && line == key) {
+        while (std::getline(cache, line)) {
+            if (line.size() > 2) {
+                entries.push_back({static_cast<mygit::StatusEntry::State>(line[0] - '0'), line.substr(2)});
+            }
         }
-        entries.push_back(entry);
+        return entries;
     }
-    sort(entries.begin(), entries.end(), [](const auto& entry1, const auto& entry2) {
-        return entry1.path().filename().string() < entry2.path().filename().string();
+
+    diffTreeWithIndex(headTree, index, [&](const std::string& sha) {
+        return std::make_shared<const std::string>(readObject(sha, git_dir));
+    }, [&](const mygit::TreeChange& change) {
+        entries.push_back({change.kind == mygit::TreeChange::Kind::Added     ? mygit::StatusEntry::State::StagedAdded
+                           : change.kind == mygit::TreeChange::Kind::Deleted ? mygit::StatusEntry::State::StagedDeleted
+                                                                             : mygit::StatusEntry::State::StagedModified,
+                           change.path});
     });
-    ostringstream tree_body;
-    for (const auto& entry : entries)
-    {
-        // cout << entry.path() << "file=" << entry.is_regular_file() << '\n';
-        if (entry.is_directory())
-        {
-            string mode = "40000";
-            string name = entry.path().filename().string();
-            string sha_bytes = _WriteTree(entry.path(),fileMap);
-            if (sha_bytes.empty())
-            {
-                continue;
+
+    std::string content = key + "\n";
+    for (const auto& entry : entries) {
+        content += std::to_string(static_cast<int>(entry.state)) + " " + entry.path + "\n";
+    }
+    try {
+        LockFile(cachePath).commit(content);
+    } catch (const std::exception&) {
+        // Another status is writing the same answer
+    }
+    return entries;
+}
+
+vector<mygit::StatusEntry> status(const fs::path& root) {
+    return status(root, *IndexView::open((root / ".git" / "index").string()));
+}
+
+vector<mygit::StatusEntry> status(const fs::path& root, const IndexView& index) {
+    // Staged changes first, then the worktree against the index
+    vector<mygit::StatusEntry> entries = stagedChanges((root / ".git").string(), index);
+    vector<mygit::StatusEntry> worktree = worktreeStatus(root, index);
+    entries.insert(entries.end(), worktree.begin(), worktree.end());
+    return entries;
+}
+
+vector<mygit::StatusEntry> worktreeStatus(const fs::path& root, const IndexView& index) {
+    // Paths outside a sparse checkout cone are absent on purpose
+    SparseCone sparse = readSparseCone((root / ".git").string());
+
+    // Candidate paths: the daemon's changed set, or every tracked and worktree file
+    std::string newToken;
+    std::vector<std::string> changedPaths;
+    std::set<std::string> candidates;
+    if (fsmonitorQuery(root, readFsmonitorToken(root), newToken, changedPaths)) {
+        for (const auto& changedPath : changedPaths) {
+            candidates.insert(changedPath);
+            std::string prefix = changedPath + "/";
+            for (auto it = index.lowerBound(prefix); it != index.end() && (*it).path.starts_with(prefix); ++it) {
+                candidates.emplace((*it).path);
             }
-            
-            tree_body << mode + " " + name + '\0' + sha_bytes;
         }
-        else if (entry.is_regular_file())
-        {
-            std::string filePath = fs::relative(entry.path()).string();
-            auto it = fileMap.find(filePath);
-            if (it != fileMap.end()) {
-                auto perms = filesystem::status(entry).permissions();
-                unsigned int perm_value = static_cast<unsigned int>(perms) & 0777;  // Mask for the permission bits
-                string mode = "100" + to_string(perm_value); 
-                string name = entry.path().filename().string();
-                string blob = CreateBlobString(entry.path().string());
-                string sha_bytes = ComputeShaHash(blob);
-                tree_body << mode + " " + name + '\0' + sha_bytes;
+    } else {
+        candidates.insert(".");
+        for (const IndexEntry& entry : index) {
+            std::string filePath(entry.path);
+            if (sparseIncludesFile(sparse, filePath)) {
+                candidates.insert(filePath);
             }
         }
     }
-    if(tree_body.str().empty()){
-        return string("");
-    }
-    string tree = "tree " + to_string(tree_body.str().size()) + '\0' + tree_body.str();
-    string sha_bytes = ComputeShaHash(tree);
-    string sha = HexadecimalSha(sha_bytes);
-    string compressedContent = compressContent(tree);
-            
-    storeCompressedFile(sha, compressedContent);
-    
-    return sha_bytes;
-}
-
-string getHeadSHA() {
-    std::string headPath = ".git/refs/heads/main";
-    if (fs::exists(headPath)) {
-        std::ifstream headFile(headPath);
-        if (headFile.is_open()) {
-            std::string sha;
-            std::getline(headFile, sha);
-            headFile.close();
-            return sha;
-        } else {
-            std::cerr << "Error: Unable to open file " << headPath << std::endl;
-            return "";
+
+    std::map<std::string, mygit::StatusEntry::State> report;
+    auto checkFile = [&](const fs::path& filePath) {
+        if (isIgnoredWorktreeFile(filePath)) {
+            return;
+        }
+        std::string relativePath = worktreeKey(root, filePath);
+        if (!sparseIncludesFile(sparse, relativePath)) {
+            return;
+        }
+        std::string sha1 = hashFileObject(filePath.string(), (root / ".git").string(), false);
+        std::optional<std::string_view> staged = index.find(relativePath);
+        if (!staged) {
+            report[relativePath] = mygit::StatusEntry::State::Untracked;
+        } else if (*staged != sha1) {
+            report[relativePath] = mygit::StatusEntry::State::Modified;
+        }
+    };
+
+    for (const auto& candidate : candidates) {
+        fs::path fullPath = root / candidate;
+        if (fs::is_directory(fullPath)) {
+            for (fs::recursive_directory_iterator iter(fullPath, fs::directory_options::skip_permission_denied), end; iter != end; ++iter) {
+                auto& entry = *iter;
+                if (entry.is_directory()) {
+                    if (entry.path().filename() == ".git" ||
+                        entry.path().filename() == "build" ||
+                        entry.path().filename() == "vcpkg" ||
+                        !sparseIncludesDirectory(sparse, worktreeKey(root, entry.path()))) {
+                        iter.disable_recursion_pending();
+                    }
+                    continue;
+                }
+                if (entry.is_regular_file()) {
+                    checkFile(entry.path());
+                }
+            }
+        } else if (fs::is_regular_file(fullPath)) {
+            checkFile(fullPath);
+        } else if (index.find(candidate) && sparseIncludesFile(sparse, candidate)) {
+            report[candidate] = mygit::StatusEntry::State::Deleted;
         }
-    } else {
-        return "";
     }
-}
 
-void commit(std::string& indexPath, std::string& message) {
-    std::ifstream indexFile(indexPath);
-    if (!indexFile) {
-        throw std::runtime_error("Could not open index file");
+    vector<mygit::StatusEntry> entries;
+    for (const auto& [filePath, state] : report) {
+        entries.push_back({state, filePath});
     }
+    return entries;
+}
 
-    std::map<std::string, std::string> fileMap;
+
+// Hex SHA of the tree a commit points at
+string commitTreeSHA(const std::string& commitSHA, const std::string& git_dir) {
+    std::string commitContent = readObject(commitSHA, git_dir);
+    size_t nullPos = commitContent.find('\0');
+    if (nullPos != std::string::npos) {
+        commitContent = commitContent.substr(nullPos + 1);
+    }
+    std::istringstream iss(commitContent);
     std::string line;
-    while (std::getline(indexFile, line)) {
-        std::istringstream iss(line);
-        std::string filePath, fileSHA;
-        if (!(iss >> filePath >> fileSHA)) {
-            continue;
+    while (std::getline(iss, line)) {
+        if (line.substr(0, 5) == "tree ") {
+            return line.substr(5);
         }
-        fileMap[filePath] = fileSHA;
     }
-    indexFile.close();
-
-    std::string rootPath = ".";
-    std::string treeSHA = _WriteTree(rootPath, fileMap);
-    string sha = HexadecimalSha(treeSHA);
-    string headSha = getHeadSHA();
-    commitTree("-p", headSha, "-m", message, sha);
-    // updateHeadSHA(sha);
-
-    // Delete and flush the index file
-    // std::ofstream ofs(indexPath, std::ios::trunc);
-    // if (!ofs) {
-    //     throw std::runtime_error("Could not open index file to clear it");
-    // }
-    // ofs.close();
+    throw std::runtime_error("No tree SHA found in commit.");
 }
 
-std::string decompressContent(const std::string& compressedContent) {
-    z_stream zs;
-    memset(&zs, 0, sizeof(zs));
-
-    if (inflateInit(&zs) != Z_OK) {
-        throw std::runtime_error("inflateInit failed while decompressing.");
+// State shared by the directories of one commit's tree
+struct WorktreeTreeWriter {
+    const IndexView& index;
+    const std::set<std::string>* dirtyPaths;  // null rehashes every file
+    const string& git_dir;
+    const SparseCone* sparse;
+    IoBackend backend;
+    Arena& arena;
+    NewTreeEntries entries;                   // stacked like writeDiskTree's
+};
+
+// Writes the tree of the directory at path, whose index key prefix ("" or
+// "dir/") is in key; key is restored before returning. False when there is
+// nothing to store. With a sparse cone, entries outside it are not in the
+// worktree; they are carried over unchanged from baseTreeSHA, the same
+// directory in HEAD's tree.
+static bool writeWorktreeTree(WorktreeTreeWriter& writer, const fs::path& path, std::string& key,
+                              const string& baseTreeSHA, ObjectId& id) {
+    Arena& arena = writer.arena;
+    NewTreeEntries& entries = writer.entries;
+    const SparseCone* sparse = writer.sparse;
+    size_t start = entries.size();
+    size_t keyBase = key.size();
+
+    NewTreeEntries baseSubtrees(&arena);  // by name; a used one gets an empty name
+    if (sparse && !baseTreeSHA.empty()) {
+        std::string baseTree = readObject(baseTreeSHA, writer.git_dir);
+        for (const TreeEntry& entry : TreeView::fromObject(baseTree)) {
+            key.resize(keyBase);
+            key.append(entry.name);
+            bool included = isTreeMode(entry.mode) ? sparseIncludesDirectory(*sparse, key)
+                                                   : sparseIncludesFile(*sparse, key);
+            if (!included) {
+                entries.push_back({entry.mode, arena.copy(entry.name), entry.id});
+            } else if (isTreeMode(entry.mode)) {
+                baseSubtrees.push_back({entry.mode, arena.copy(entry.name), entry.id});
+            }
+        }
+        sort(baseSubtrees.begin(), baseSubtrees.end(), [](const NewTreeEntry& a, const NewTreeEntry& b) { return a.name < b.name; });
     }
 
-    zs.next_in = (Bytef*)compressedContent.data();
-    zs.avail_in = compressedContent.size();
-
-    int ret;
-    char outbuffer[32768];
-    std::string decompressedContent;
-
-    do {
-        zs.next_out = reinterpret_cast<Bytef*>(outbuffer);
-        zs.avail_out = sizeof(outbuffer);
-
-        ret = inflate(&zs, 0);
+    // Files whose content must be hashed, as one batch once the directory is listed
+    std::vector<std::string> filePaths;
+    std::pmr::vector<size_t> hashedEntries(&arena);
+    if (filesystem::is_directory(path)) {
+        for (const auto& entry : filesystem::directory_iterator(path))
+        {
+            const string& native = entry.path().native();
+            string_view name = string_view(native).substr(native.rfind('/') + 1);
+            if (name == ".git" || name == "build" || name == "vcpkg" || name == "CMakeLists.txt" || name == ".DS_Store")
+            {
+                continue;
+            }
+            key.resize(keyBase);
+            key.append(name);
+            if (entry.is_directory())
+            {
+                if (sparse && !sparseIncludesDirectory(*sparse, key)) {
+                    continue;
+                }
+                string baseSubtree;
+                auto base = lower_bound(baseSubtrees.begin(), baseSubtrees.end(), name,
+                                        [](const NewTreeEntry& a, string_view b) { return a.name < b; });
+                if (base != baseSubtrees.end() && base->name == name) {
+                    baseSubtree = base->id.hex();
+                    base->name = string_view();
+                }
+                key.push_back('/');
+                ObjectId subtree;
+                if (writeWorktreeTree(writer, entry.path(), key, baseSubtree, subtree)) {
+                    entries.push_back({TREE_MODE, arena.copy(name), subtree});
+                }
+            }
+            else if (entry.is_regular_file())
+            {
+                std::optional<std::string_view> staged = writer.index.find(key);
+                if (staged && (!sparse || sparseIncludesFile(*sparse, key))) {
+                    entries.push_back({fileMode(entry), arena.copy(name), {}});
+                    if (writer.dirtyPaths && !isPathDirty(*writer.dirtyPaths, key)) {
+                        // Untouched since the index was written, so the staged SHA is current
+                        entries.back().id = idFromHex(*staged);
+                    } else {
+                        // Store it too, so the tree never points at a missing object
+                        filePaths.push_back(native);
+                        hashedEntries.push_back(entries.size() - 1);
+                    }
+                }
+            }
+        }
+    }
+    if (!filePaths.empty()) {
+        std::vector<std::string> shas = hashFileObjects(filePaths, writer.git_dir, true, writer.backend);
+        for (size_t i = 0; i < shas.size(); ++i) {
+            entries[hashedEntries[i]].id = idFromHex(shas[i]);
+        }
+    }
 
-        if (decompressedContent.size() < zs.total_out) {
-            decompressedContent.append(outbuffer, zs.total_out - decompressedContent.size());
+    // Partly sparse directories that are gone from the worktree still hold
+    // entries outside the cone
+    for (const NewTreeEntry& base : baseSubtrees) {
+        if (base.name.empty()) {
+            continue;
         }
-    } while (ret == Z_OK);
+        key.resize(keyBase);
+        key.append(base.name).push_back('/');
+        ObjectId subtree;
+        if (writeWorktreeTree(writer, path / base.name, key, base.id.hex(), subtree)) {
+            entries.push_back({TREE_MODE, base.name, subtree});
+        }
+    }
+    key.resize(keyBase);
+
+    if (entries.size() == start) {
+        return false;
+    }
+    id = storeTree(span(entries).subspan(start), writer.git_dir);
+    entries.resize(start);
+    return true;
+}
 
-    inflateEnd(&zs);
+string getHeadSHA(const std::string& git_dir) {
+    std::string branch = headBranch(git_dir);
+    if (!branch.empty()) {
+        return readRef(git_dir, "refs/heads/" + branch);
+    }
+    std::ifstream headFile(git_dir + "/HEAD");
+    std::string sha;
+    std::getline(headFile, sha);
+    return sha.size() == 40 ? sha : "";
+}
 
-    if (ret != Z_STREAM_END) {
-        throw std::runtime_error("Exception during zlib decompression: (" + std::to_string(ret) + ") " + zs.msg);
+string commit(const fs::path& root, const std::string& message) {
+    std::string indexPath = (root / ".git" / "index").string();
+    if (!fs::exists(indexPath)) {
+        throw std::runtime_error("Could not open index file");
     }
+    return commit(root, message, *IndexView::open(indexPath));
+}
 
-    return decompressedContent;
+string commit(const fs::path& root, const std::string& message, const IndexView& index) {
+    std::string git_dir = (root / ".git").string();
+
+    // With the fsmonitor daemon only files changed since the index was
+    // written need to be reread
+    std::string newToken;
+    std::vector<std::string> changedPaths;
+    std::set<std::string> dirtyPaths;
+    bool monitored = fsmonitorQuery(root, readFsmonitorToken(root), newToken, changedPaths);
+    dirtyPaths.insert(changedPaths.begin(), changedPaths.end());
+
+    string headSha = getHeadSHA(git_dir);
+    SparseCone sparse = readSparseCone(git_dir);
+    string baseTreeSHA = sparse.enabled && !headSha.empty() ? commitTreeSHA(headSha, git_dir) : "";
+
+    // Paths and tree entries live in the arena until the tree is written
+    Arena arena;
+    WorktreeTreeWriter writer{index, monitored ? &dirtyPaths : nullptr, git_dir,
+                              sparse.enabled ? &sparse : nullptr, ioBackend(git_dir), arena, NewTreeEntries(&arena)};
+    std::string key;
+    ObjectId tree;
+    string sha = writeWorktreeTree(writer, root, key, baseTreeSHA, tree) ? tree.hex() : "";
+    string commitSha = commitTree(sha, {headSha}, message, git_dir);
+    // The worktree now matches the tree, so the next checkout can start from it
+    setCheckedOutTree(git_dir, sha);
+    return commitSha;
 }
 
-std::string readObject(const std::string& sha) {
-    std::string objectDir = ".git/objects/" + sha.substr(0, 2);
-    std::string objectFile = objectDir + "/" + sha.substr(2);
+std::string readObject(const std::string& sha, const std::string& git_dir) {
+    std::string objectFile = getFilePathFromSHA(sha, git_dir);
 
     std::ifstream inFile(objectFile, std::ios::binary);
     if (!inFile) {
@@ -905,59 +1147,183 @@ std::string readObject(const std::string& sha) {
     return decompressContent(compressedContent);
 }
 
-void extractTree(const std::string& treeSHA, const fs::path& basePath) {
-    std::string treeContent = readObject(treeSHA);
+// readObject for many objects, with the object files read as one batch
+const size_t PARALLEL_INFLATE_BYTES = 1 << 20;
 
-    // Remove the header from treeContent
-    size_t nullPos = treeContent.find('\0');
-    if (nullPos != std::string::npos) {
-        treeContent = treeContent.substr(nullPos + 1);
+std::vector<std::string> readObjects(const std::vector<std::string>& shas, const std::string& git_dir,
+                                     IoBackend backend) {
+    std::vector<FileRead> reads(shas.size());
+    for (size_t i = 0; i < shas.size(); ++i) {
+        reads[i].path = getFilePathFromSHA(shas[i], git_dir);
     }
-
-    size_t i = 0;
-    while (i < treeContent.size()) {
-        // Extract mode
-        std::string mode;
-        while (treeContent[i] != ' ') {
-            mode += treeContent[i];
-            i++;
+    readFiles(reads, backend);
+    size_t compressedBytes = 0;
+    for (const FileRead& read : reads) {
+        if (read.error) {
+            throw std::runtime_error("Could not open object file: " + read.path);
         }
-        i++; // Skip the space
+        compressedBytes += read.data.size();
+    }
 
-        // Extract filename
-        std::string filename;
-        while (treeContent[i] != '\0') {
-            filename += treeContent[i];
-            i++;
+    // Inflating is the CPU-bound part of a checkout, so a batch with enough
+    // data to pay for the threads is spread over them
+    std::vector<std::string> objects(reads.size());
+    std::vector<std::exception_ptr> errors(reads.size());
+    auto inflate = [&](size_t i) {
+        try {
+            objects[i] = decompressContent(reads[i].data);
+            reads[i].data = std::string();
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    if (compressedBytes >= PARALLEL_INFLATE_BYTES) {
+        runOnThreads(reads.size(), inflate);
+    } else {
+        for (size_t i = 0; i < reads.size(); ++i) {
+            inflate(i);
+        }
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
         }
-        i++; // Skip the null byte
+    }
+    return objects;
+}
 
-        // Extract SHA-1 hash (next 20 bytes)
-        std::string sha = to_hex_string(reinterpret_cast<const unsigned char*>(&treeContent[i]), 20);
-        i += 20;
+// Type of an object, inflating only as much as the header needs
+std::string readObjectType(const std::string& sha, const std::string& git_dir) {
+    std::string objectFile = getFilePathFromSHA(sha, git_dir);
+    std::ifstream inFile(objectFile, std::ios::binary);
+    if (!inFile) {
+        throw std::runtime_error("Could not open object file: " + objectFile);
+    }
+    char compressed[512];
+    inFile.read(compressed, sizeof(compressed));
+
+    std::string inflated = decompressPrefix(std::string_view(compressed, inFile.gcount()), 32);
+    size_t space = inflated.find(' ');
+    if (space == std::string::npos) {
+        throw std::runtime_error("Malformed object header: " + sha);
+    }
+    return inflated.substr(0, space);
+}
 
-        fs::path filePath = basePath / filename;
-        if (mode == "40000") { // Directory
+const size_t CHECKOUT_BATCH = 512;  // files read and written per batch
+
+// Creates the directories of a tree and lists the regular files below it as
+// (worktree path, object SHA). prefix is basePath relative to the worktree
+// root ("" or ending in '/'). With a sparse cone, subtrees and blobs outside
+// it are never read.
+static void collectTreeFiles(const std::string& treeSHA, const fs::path& basePath, const std::string& git_dir,
+                             const SparseCone* sparse, const std::string& prefix,
+                             std::vector<std::pair<std::string, std::string>>& files) {
+    std::string treeContent = readObject(treeSHA, git_dir);
+
+    for (const TreeEntry& entry : TreeView::fromObject(treeContent)) {
+        fs::path filePath = basePath / entry.name;
+        std::string relativePath = prefix + std::string(entry.name);
+        if (isTreeMode(entry.mode)) { // Directory
+            if (sparse && !sparseIncludesDirectory(*sparse, relativePath)) {
+                continue;
+            }
             fs::create_directories(filePath);
-            extractTree(sha, filePath);
-        } else if (mode.substr(0, 3) == "100") { // File
-            std::string blobContent = readObject(sha);
-
-            // Remove the header from blobContent
-            size_t nullPos = blobContent.find('\0');
-            if (nullPos != std::string::npos) {
-                blobContent = blobContent.substr(nullPos + 1);
+            collectTreeFiles(entry.id.hex(), filePath, git_dir, sparse, relativePath + "/", files);
+        } else if ((entry.mode & FILE_MODE_MASK) == REGULAR_FILE_MODE) { // File
+            if (sparse && !sparseIncludesFile(*sparse, relativePath)) {
+                continue;
             }
+            files.emplace_back(filePath.string(), entry.id.hex());
+        }
+    }
+}
 
-            std::ofstream outFile(filePath, std::ios::binary);
-            outFile << blobContent;
-            outFile.close();
+// Writes (worktree path, object SHA) files whose directories exist. Objects
+// are read and files written in batches through the core.ioBackend backend;
+// chunked files are streamed on their own.
+static void writeWorktreeFiles(const std::vector<std::pair<std::string, std::string>>& files,
+                               const std::string& git_dir) {
+    IoBackend backend = ioBackend(git_dir);
+
+    for (size_t start = 0; start < files.size(); start += CHECKOUT_BATCH) {
+        size_t end = std::min(start + CHECKOUT_BATCH, files.size());
+        std::vector<std::string> shas;
+        for (size_t i = start; i < end; ++i) {
+            shas.push_back(files[i].second);
+        }
+        std::vector<std::string> objects = readObjects(shas, git_dir, backend);
+
+        std::vector<FileWrite> writes;
+        for (size_t i = start; i < end; ++i) {
+            const std::string& object = objects[i - start];
+            if (object.compare(0, 8, "chunked ") == 0) {
+                std::ofstream outFile(files[i].first, std::ios::binary);
+                writeFileContent(files[i].second, outFile, git_dir);
+                continue;
+            }
+            size_t nullPos = object.find('\0');
+            size_t contentStart = nullPos == std::string::npos ? 0 : nullPos + 1;
+            writes.push_back(FileWrite{files[i].first, std::string_view(object).substr(contentStart)});
+        }
+        writeFiles(writes, backend);
+        for (const FileWrite& write : writes) {
+            if (write.error) {
+                throw std::runtime_error("Could not write " + write.path + ": " + strerror(write.error));
+            }
         }
     }
 }
 
-void removeAllExceptGit() {
-    for (const auto& entry : fs::directory_iterator(".")) {
+void extractTree(const std::string& treeSHA, const fs::path& basePath, const std::string& git_dir,
+                 const SparseCone* sparse, const std::string& prefix) {
+    std::vector<std::pair<std::string, std::string>> files;
+    collectTreeFiles(treeSHA, basePath, git_dir, sparse, prefix, files);
+    writeWorktreeFiles(files, git_dir);
+}
+
+// Moves the worktree from fromTreeSHA to treeSHA by touching only the files
+// that differ. The diff is complete before anything is changed, so a missing
+// object fails the checkout with the worktree untouched.
+static void checkoutChanges(const fs::path& root, const std::string& fromTreeSHA, const std::string& treeSHA,
+                            const std::string& git_dir, const SparseCone& sparse) {
+    std::vector<std::string> removals;
+    std::vector<std::pair<std::string, std::string>> files;
+    diffTrees(fromTreeSHA, treeSHA, [&](const std::string& sha) {
+        return std::make_shared<const std::string>(readObject(sha, git_dir));
+    }, [&](const mygit::TreeChange& change) {
+        if (!sparseIncludesFile(sparse, change.path)) {
+            return;
+        }
+        bool regular = (change.newMode & FILE_MODE_MASK) == REGULAR_FILE_MODE;
+        if (change.kind != mygit::TreeChange::Kind::Deleted && regular) {
+            files.emplace_back((root / change.path).string(), change.newSha);
+        } else if (change.kind != mygit::TreeChange::Kind::Added) {
+            removals.push_back(change.path);
+        }
+    });
+
+    // Removals first: a file may be replaced by a directory of the same name
+    for (const auto& path : removals) {
+        std::error_code ec;
+        fs::remove(root / path, ec);
+        for (fs::path dir = (root / path).parent_path(); dir != root && fs::is_empty(dir, ec) && !ec;
+             dir = dir.parent_path()) {
+            fs::remove(dir, ec);
+        }
+    }
+    std::set<fs::path> directories;
+    for (const auto& file : files) {
+        directories.insert(fs::path(file.first).parent_path());
+    }
+    for (const auto& directory : directories) {
+        fs::create_directories(directory);
+    }
+    writeWorktreeFiles(files, git_dir);
+}
+
+void removeAllExceptGit(const fs::path& root) {
+    for (const auto& entry : fs::directory_iterator(root)) {
         if (entry.path().filename() == ".git" || entry.path().filename() == "build" || 
             entry.path().filename() == "vcpkg" || entry.path().filename() == "CMakeLists.txt" || 
             entry.path().filename() == ".DS_Store") {
@@ -967,30 +1333,120 @@ void removeAllExceptGit() {
     }
 }
 
-void extractCommit(string& commitSHA) {
-    removeAllExceptGit(); // Remove all files and directories except specified ones
+// Replaces the index with the regular files of a tree, so a fresh checkout
+// starts out clean. Files outside a sparse cone stay in the index: they are
+// tracked, just not materialized.
+static void writeIndexFromTree(const std::string& treeSHA, const std::string& git_dir) {
+    LockFile indexLock(git_dir + "/index", durabilityMode(git_dir) != Durability::Off);
+    Arena arena;
+    IndexEntries entries(&arena);
+    walkTree(treeSHA, [&](const std::string& sha) { return std::make_shared<const std::string>(readObject(sha, git_dir)); },
+             TreeWalkOptions{.recursive = true, .showTrees = false, .paths = {}, .threads = 0},
+             [&](const mygit::TreeItem& item) {
+                 if ((item.mode & FILE_MODE_MASK) == REGULAR_FILE_MODE) {
+                     entries.push_back({arena.copy(item.name), arena.copy(item.sha)});
+                 }
+             });
+    sortIndexEntries(entries);
+    indexLock.commit(formatIndex(entries));
+}
 
-    std::string commitContent = readObject(commitSHA);
-    cout<<commitContent<<endl;
-    size_t nullPos = commitContent.find('\0');
-    if (nullPos != std::string::npos) {
-        commitContent = commitContent.substr(nullPos + 1);
+void extractCommit(const fs::path& root, const std::string& commitSHA, bool force) {
+    std::string git_dir = (root / ".git").string();
+    std::string treeSHA = commitTreeSHA(commitSHA, git_dir);
+    SparseCone sparse = readSparseCone(git_dir);
+
+    std::string currentTreeSHA = force ? "" : checkedOutTree(git_dir);
+    if (!currentTreeSHA.empty() && objectExists(currentTreeSHA, git_dir)) {
+        checkoutChanges(root, currentTreeSHA, treeSHA, git_dir, sparse);
+    } else {
+        removeAllExceptGit(root); // Remove all files and directories except specified ones
+        extractTree(treeSHA, root, git_dir, sparse.enabled ? &sparse : nullptr);
     }
-    std::istringstream iss(commitContent);
-    std::string line;
-    std::string treeSHA;
+    writeIndexFromTree(treeSHA, git_dir);
+    setCheckedOutTree(git_dir, treeSHA);
+}
 
-    while (std::getline(iss, line)) {
-        if (line.substr(0, 5) == "tree ") {
-            treeSHA = line.substr(5);
-            break;
+// The tree the worktree was last checked out or committed from
+string checkedOutTree(const string& git_dir) {
+    std::ifstream file(git_dir + "/CHECKED_OUT_TREE");
+    std::string sha;
+    std::getline(file, sha);
+    return sha.size() == 40 ? sha : "";
+}
+
+void setCheckedOutTree(const string& git_dir, const string& treeSHA) {
+    std::string path = git_dir + "/CHECKED_OUT_TREE";
+    if (treeSHA.empty()) {
+        fs::remove(path);
+        return;
+    }
+    LockFile(path).commit(treeSHA + "\n");
+}
+
+// Text output shared by the CLI and serve mode
+string formatTree(const vector<mygit::TreeItem>& items, bool nameOnly) {
+    string output;
+    char mode[16];
+    for (const auto& item : items) {
+        if (nameOnly) {
+            output.append(item.name).push_back('\n');
+            continue;
         }
+        snprintf(mode, sizeof(mode), "%06o", item.mode);
+        output.append(mode).append(" ").append(item.type).append(" ");
+        output.append(item.sha).append("   ").append(item.name).push_back('\n');
     }
+    return output;
+}
 
-    if (treeSHA.empty()) {
-        throw std::runtime_error("No tree SHA found in commit.");
+string formatStatus(const vector<mygit::StatusEntry>& entries) {
+    if (entries.empty()) {
+        return "nothing to commit, working tree matches the index\n";
     }
+    string output;
+    for (const auto& entry : entries) {
+        switch (entry.state) {
+            case mygit::StatusEntry::State::Modified:  output += "modified:   "; break;
+            case mygit::StatusEntry::State::Deleted:   output += "deleted:    "; break;
+            case mygit::StatusEntry::State::Untracked: output += "untracked:  "; break;
+            case mygit::StatusEntry::State::StagedAdded:    output += "new file:   "; break;
+            case mygit::StatusEntry::State::StagedModified: output += "staged:     "; break;
+            case mygit::StatusEntry::State::StagedDeleted:  output += "removed:    "; break;
+        }
+        output += entry.path + "\n";
+    }
+    return output;
+}
 
-    fs::path basePath = ".";
-    extractTree(treeSHA, basePath);
-}
\ No newline at end of file
+string formatTreeChanges(const vector<mygit::TreeChange>& changes, DiffFormat format) {
+    string output;
+    char modes[32];
+    for (const auto& change : changes) {
+        char status = change.kind == mygit::TreeChange::Kind::Added     ? 'A'
+                      : change.kind == mygit::TreeChange::Kind::Deleted ? 'D'
+                      : change.kind == mygit::TreeChange::Kind::Renamed ? 'R'
+                      : change.kind == mygit::TreeChange::Kind::Copied  ? 'C'
+                                                                        : 'M';
+        bool moved = status == 'R' || status == 'C';
+        if (format == DiffFormat::Raw) {
+            snprintf(modes, sizeof(modes), ":%06o %06o ", change.oldMode, change.newMode);
+            output.append(modes);
+            output.append(change.oldSha.empty() ? string(40, '0') : change.oldSha).push_back(' ');
+            output.append(change.newSha.empty() ? string(40, '0') : change.newSha).push_back(' ');
+        }
+        if (format != DiffFormat::NameOnly) {
+            output.push_back(status);
+            if (moved) {
+                snprintf(modes, sizeof(modes), "%03d", change.similarity);
+                output.append(modes);
+            }
+            output.push_back('\t');
+            if (moved) {
+                output.append(change.oldPath).push_back('\t');
+            }
+        }
+        output.append(change.path).push_back('\n');
+    }
+    return output;
+}